@@ -0,0 +1,721 @@
+/**
+ * @file Benchmark.cpp
+ * @brief Benchmark de vazão da aquisição completa, do socket UDP ao IXImgSink
+ *
+ * Varre modo de binning (tamanho do quadro), número de buffers de quadro
+ * (XFRAME_NUM), tamanho do buffer do socket e máscara de afinidade, e mede
+ * quadros/s, pacotes/s, latência por etapa (p50/p90/p99/p99.9), descartes
+ * (XEVENT_IMG_PARSE_PAC_LOST, XEVENT_IMG_TRANSFER_BUF_FULL, ...) e CPU por
+ * thread. Os resultados vão para CSV e/ou JSON para comparar versões do SDK.
+ * Com --trace, os pontos de XTraceRecorder de todos os casos vão para um
+ * JSON trace_event, aberto em ui.perfetto.dev ou chrome://tracing.
+ *
+ * Windows: a cadeia da DLL, XAcquisition -> XUDPImgEngine -> XPacketPool ->
+ * XUDPImgParse -> XFrameTransfer -> IXImgSink, contra o detector ou o xsim
+ * (--host-ip). As threads são internas à DLL: só há latência do sink e CPU
+ * do processo.
+ * Linux: XDeviceSim no próprio processo em 127.0.0.2 como fonte de pacotes
+ * e XBenchPipeline, as mesmas etapas montadas com os componentes dos
+ * cabeçalhos (XUDPMmsgRecv, XPacketRingPool, XLinePlacer). A CPU do
+ * processo inclui a do simulador.
+ *
+ * Compilação:
+ *   Linux:   g++ -std=c++11 -O2 -pthread -I../include Benchmark.cpp -o xbench
+ *   Windows: cl /EHsc /O2 /I..\include Benchmark.cpp
+ *
+ * Exemplos:
+ *   ./xbench --binning 0,1 --buffers 8,40 --rcvbuf 1M,8M --affinity 0,0x7 --csv bench.csv
+ *   ./xbench --binning 0 --buffers 8 --rcvbuf 256K --trace trace.json
+ *   Benchmark.exe --host-ip 192.168.1.1 --frames 500 --json sdk.json
+ */
+
+#include "xbench.h" // Estatísticas, CSV/JSON e a cadeia de loopback
+#include "xtrace.h" // Pontos de trace por thread
+
+#ifdef _MSC_VER
+#include "xsystem.h"		 // Descoberta do detector
+#include "xdevice.h"		 // Dispositivo detector
+#include "xcommand.h"		 // Binning
+#include "xacquisition.h"	 // Aquisição da DLL
+#include "xframe_transfer.h" // Transferência de quadros da DLL
+#include "xgig_factory.h"	 // Factory de comunicação
+#include "ixcmd_sink.h"
+
+#ifdef _WIN64
+#pragma comment(lib, "..\\lib\\x64\\XLibDllKosti.lib")
+#else
+#pragma comment(lib, "..\\lib\\x86\\XLibDllKosti.lib")
+#endif
+#else
+#include "xdevice_sim.h" // Fonte de pacotes no loopback
+#endif
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+static volatile sig_atomic_t is_exit = 0;
+
+static void onSignal(int)
+{
+	is_exit = 1;
+}
+
+// ============================================================================
+// OPÇÕES
+// ============================================================================
+
+/** @brief Parâmetros da varredura e da fonte de pacotes */
+struct BenchOptions
+{
+	vector<uint32_t> binnings;
+	vector<uint32_t> buffers;
+	vector<uint32_t> rcvbufs;
+	vector<uint32_t> affinities;
+	uint32_t frames;
+	uint32_t width;	 // Sem binning, só no Linux
+	uint32_t height;
+	uint32_t depth;
+	uint32_t payload;
+	uint16_t port;
+	double fps;
+	double loss;
+	bool is_check;
+	string host_ip; // Só no Windows
+	string csv_file;
+	string json_file;
+	string trace_file;
+};
+
+/**
+ * @brief Lê uma lista "a,b,c" de inteiros decimais ou 0x hexadecimais,
+ *        com sufixo K ou M opcional (1M = 1048576)
+ */
+static bool parseList(const char *text, vector<uint32_t> &list)
+{
+	list.clear();
+	while (*text)
+	{
+		char *end;
+		unsigned long value = strtoul(text, &end, 0);
+		if (end == text)
+			return false;
+		if ('K' == *end || 'k' == *end)
+		{
+			value *= 1024;
+			end++;
+		}
+		else if ('M' == *end || 'm' == *end)
+		{
+			value *= 1024 * 1024;
+			end++;
+		}
+		list.push_back((uint32_t)value);
+		if (',' == *end)
+			end++;
+		else if (*end)
+			return false;
+		text = end;
+	}
+	return !list.empty();
+}
+
+static void printUsage(const char *name)
+{
+	printf("Uso: %s [opções]\n"
+		   "  --binning L       modos de binning, 0 = 1x1, 1 = 2x2 (padrão 0,1)\n"
+		   "  --buffers L       buffers de quadro, XFRAME_NUM (padrão 8,%u)\n"
+		   "  --rcvbuf L        SO_RCVBUF do socket de imagem (padrão 1M,8M)\n"
+		   "  --affinity L      máscaras de afinidade, 0 = sem fixar (padrão 0)\n"
+		   "  --frames N        quadros por caso (padrão 200)\n"
+		   "  --check           confere o padrão de pixels do simulador\n"
+		   "  --csv ARQ         grava os resultados em CSV\n"
+		   "  --json ARQ        grava os resultados em JSON\n"
+		   "  --trace ARQ       grava o trace das threads em JSON trace_event\n"
+#ifdef _MSC_VER
+		   "  --host-ip IP      IP local ligado ao detector (obrigatório)\n",
+		   name, XFRAME_NUM);
+#else
+		   "  --width N         colunas sem binning (padrão 1400)\n"
+		   "  --height N        linhas sem binning (padrão 1200)\n"
+		   "  --depth N         bits por pixel (padrão 16)\n"
+		   "  --payload N       bytes de imagem por pacote (padrão %u)\n"
+		   "  --fps F           quadros por segundo da fonte, 0 = sem limite (padrão 0)\n"
+		   "  --loss P          perda injetada por pacote\n"
+		   "  --port N          porta de imagem local (padrão %u)\n",
+		   name, XFRAME_NUM, XSIM_PAYLOAD_SIZE, XSIM_IMG_PORT);
+#endif
+}
+
+static bool parseOptions(int argc, char **argv, BenchOptions &opt)
+{
+	parseList("0,1", opt.binnings);
+	opt.buffers.clear();
+	opt.buffers.push_back(8);
+	opt.buffers.push_back(XFRAME_NUM);
+	parseList("1M,8M", opt.rcvbufs);
+	parseList("0", opt.affinities);
+	opt.frames = 200;
+	opt.width = 1400;
+	opt.height = 1200;
+	opt.depth = 16;
+	opt.payload = 8192;
+	opt.port = 4001;
+	opt.fps = 0;
+	opt.loss = 0;
+	opt.is_check = false;
+
+	for (int i = 1; i < argc; i++)
+	{
+		string name = argv[i];
+		if ("--check" == name)
+		{
+			opt.is_check = true;
+			continue;
+		}
+		if (i + 1 >= argc)
+			return false;
+		const char *value = argv[++i];
+		bool is_ok = true;
+		if ("--binning" == name)
+			is_ok = parseList(value, opt.binnings);
+		else if ("--buffers" == name)
+			is_ok = parseList(value, opt.buffers);
+		else if ("--rcvbuf" == name)
+			is_ok = parseList(value, opt.rcvbufs);
+		else if ("--affinity" == name)
+			is_ok = parseList(value, opt.affinities);
+		else if ("--frames" == name)
+			opt.frames = (uint32_t)atoi(value);
+		else if ("--width" == name)
+			opt.width = (uint32_t)atoi(value);
+		else if ("--height" == name)
+			opt.height = (uint32_t)atoi(value);
+		else if ("--depth" == name)
+			opt.depth = (uint32_t)atoi(value);
+		else if ("--payload" == name)
+			opt.payload = (uint32_t)atoi(value);
+		else if ("--port" == name)
+			opt.port = (uint16_t)atoi(value);
+		else if ("--fps" == name)
+			opt.fps = atof(value);
+		else if ("--loss" == name)
+			opt.loss = atof(value);
+		else if ("--host-ip" == name)
+			opt.host_ip = value;
+		else if ("--csv" == name)
+			opt.csv_file = value;
+		else if ("--json" == name)
+			opt.json_file = value;
+		else if ("--trace" == name)
+			opt.trace_file = value;
+		else
+			is_ok = false;
+		if (!is_ok)
+			return false;
+	}
+	return opt.frames > 0;
+}
+
+// ============================================================================
+// SINK DE MEDIÇÃO
+// ============================================================================
+
+/**
+ * @class BenchSink
+ * @brief Conta quadros e descartes e mede o tempo gasto em OnFrameReady()
+ *
+ * Os eventos podem chegar da thread de parse e os quadros da thread de
+ * transferência, por isso os contadores são atômicos. A estatística de
+ * latência só é escrita pela thread de transferência.
+ * No Linux, com --check, o sink só toma um lease do quadro (XFrameLease) e
+ * a conferência roda numa thread própria, sem cópia e sem segurar a
+ * transferência.
+ */
+class BenchSink : public IXImgSink
+{
+public:
+	void Reset(const XBenchCase &bench_case, bool is_check)
+	{
+		_is_check = is_check;
+		_frames = 0;
+		_bytes = 0;
+		_pac_lost = 0;
+		_buf_full = 0;
+		_data_lost = 0;
+		_dm_drop = 0;
+		_bad_frames = 0;
+		_last_ns = 0;
+		_width = 0;
+		_height = 0;
+		_is_complete = false;
+		_sink_stat.Clear();
+		_sink_stat.Reserve(bench_case._frame_num);
+	}
+
+	void OnXError(uint32_t err_id, const char *err_msg_) override
+	{
+		printf("OnXERROR: %u, %s\n", err_id, err_msg_);
+	}
+
+	void OnXEvent(uint32_t event_id, uint32_t data) override
+	{
+		if (XEVENT_IMG_PARSE_PAC_LOST == event_id)
+			_pac_lost += data;
+		else if (XEVENT_IMG_TRANSFER_BUF_FULL == event_id)
+			_buf_full += data ? data : 1;
+		else if (XEVENT_IMG_PARSE_DATA_LOST == event_id)
+			_data_lost += data;
+		else if (XEVENT_IMG_PARSE_DM_DROP == event_id)
+			_dm_drop += data;
+	}
+
+	void OnFrameReady(XImage *image_) override
+	{
+#ifdef _MSC_VER
+		// No Linux quem mede o sink é XBenchPipeline; a DLL não tem pontos de trace
+		XTraceScope scope(XTRACE_SINK, (uint32_t)_frames);
+#endif
+		uint64_t start = XBenchNow();
+		if (_is_check)
+		{
+#ifndef _MSC_VER
+			if (_pipeline_)
+			{
+				lock_guard<mutex> lock(_check_mutex);
+				_check_queue.push_back(_pipeline_->Lease(image_));
+				_check_cond.notify_one();
+			}
+			else if (!checkFrame(image_))
+				_bad_frames++;
+#else
+			if (!checkFrame(image_))
+				_bad_frames++;
+#endif
+		}
+		_width = image_->_width;
+		_height = image_->_height;
+		_bytes += (uint64_t)image_->_width * image_->_height * ((image_->_pixel_depth > 16) ? 4 : 2);
+		uint64_t end = XBenchNow();
+		_sink_stat.Add(end - start);
+		_last_ns = end;
+		_frames++;
+	}
+
+	void OnFrameComplete() override
+	{
+		_is_complete = true;
+	}
+
+	/** @brief Copia contadores e latência do sink para o resultado */
+	void getResult(XBenchResult &result)
+	{
+		result._frames = _frames;
+		result._bytes = _bytes;
+		result._pac_lost = _pac_lost;
+		result._buf_full = _buf_full;
+		result._data_lost = _data_lost;
+		result._dm_drop = _dm_drop;
+		result._bad_frames = _bad_frames;
+		_sink_stat.GetSummary(result._latency[XBENCH_STAGE_SINK]);
+	}
+
+#ifndef _MSC_VER
+	/** @brief Passa a conferir os quadros da cadeia numa thread própria */
+	void startCheck(XBenchPipeline *pipeline_)
+	{
+		_pipeline_ = pipeline_;
+		_is_check_exit = false;
+		_check_thread = thread(&BenchSink::checkProc, this);
+	}
+
+	/** @brief Confere os quadros pendentes e solta os leases; antes de fechar a cadeia */
+	void stopCheck()
+	{
+		{
+			lock_guard<mutex> lock(_check_mutex);
+			_is_check_exit = true;
+			_check_cond.notify_one();
+		}
+		if (_check_thread.joinable())
+			_check_thread.join();
+		_pipeline_ = NULL;
+	}
+#endif
+
+	/** @brief Perdas que encerram um quadro sem entregá-lo */
+	uint64_t getDropped()
+	{
+		return _data_lost + _buf_full;
+	}
+
+	atomic<uint64_t> _frames;
+	atomic<uint64_t> _last_ns;
+	atomic<uint32_t> _width;
+	atomic<uint32_t> _height;
+	atomic<bool> _is_complete;
+
+private:
+	/**
+	 * @brief Confere o padrão do XDeviceSim, pixel = linha + coluna + id do
+	 *        quadro, relativo ao primeiro pixel
+	 */
+	template <typename T>
+	static bool checkPattern(XImage *image_)
+	{
+		XImageView<T> view = image_->GetView<T>();
+		uint32_t mask = (image_->_pixel_depth >= 32) ? 0xFFFFFFFF : (1u << image_->_pixel_depth) - 1;
+		uint32_t base = view.At(0, 0);
+		for (uint32_t row = 0; row < view.GetHeight(); row++)
+		{
+			const T *line = view.Row(row);
+			for (uint32_t col = 0; col < view.GetWidth(); col++)
+			{
+				if ((T)((base + row + col) & mask) != line[col])
+					return false;
+			}
+		}
+		return true;
+	}
+
+	static bool checkFrame(XImage *image_)
+	{
+		if (image_->_pixel_depth > 16)
+			return checkPattern<uint32_t>(image_);
+		return checkPattern<uint16_t>(image_);
+	}
+
+#ifndef _MSC_VER
+	void checkProc()
+	{
+		while (1)
+		{
+			XFrameLease lease;
+			{
+				unique_lock<mutex> lock(_check_mutex);
+				while (_check_queue.empty() && !_is_check_exit)
+					_check_cond.wait(lock);
+				if (_check_queue.empty())
+					break;
+				lease = _check_queue.front();
+				_check_queue.pop_front();
+			}
+			// O slot volta à cadeia quando o lease sai de escopo
+			if (lease.IsValid() && !checkFrame(lease.GetImage()))
+				_bad_frames++;
+		}
+	}
+#endif
+
+	bool _is_check;
+	atomic<uint64_t> _bytes;
+	atomic<uint64_t> _pac_lost;
+	atomic<uint64_t> _buf_full;
+	atomic<uint64_t> _data_lost;
+	atomic<uint64_t> _dm_drop;
+	atomic<uint64_t> _bad_frames;
+	XLatencyStat _sink_stat;
+#ifndef _MSC_VER
+	XBenchPipeline *_pipeline_ = NULL;
+	thread _check_thread;
+	mutex _check_mutex;
+	condition_variable _check_cond;
+	deque<XFrameLease> _check_queue;
+	bool _is_check_exit = false;
+#endif
+};
+
+BenchSink bench_sink;
+
+/** @brief Duração da medição: do início da aquisição ao último quadro */
+static double elapsedSeconds(uint64_t start_ns)
+{
+	uint64_t end_ns = bench_sink._last_ns;
+	if (0 == end_ns)
+		end_ns = XBenchNow();
+	return (end_ns - start_ns) / 1e9;
+}
+
+// ============================================================================
+// EXECUÇÃO DE UM CASO
+// ============================================================================
+
+#ifdef _MSC_VER
+
+/** @brief Ignora os eventos de saúde durante a medição */
+class BenchCmdSink : public IXCmdSink
+{
+public:
+	void OnXError(uint32_t err_id, const char *err_msg_) override
+	{
+		printf("OnXError: %u, %s\n", err_id, err_msg_);
+	}
+	void OnXEvent(uint32_t event_id, XHealthPara data) override
+	{
+	}
+};
+
+BenchCmdSink cmd_sink;
+
+/**
+ * @brief Roda um caso com a cadeia da DLL já ligada ao detector
+ *
+ * Termina quando a DLL chama OnFrameComplete(), quando todos os quadros
+ * foram entregues ou descartados, ou após 5 s sem quadro novo.
+ */
+static bool runCase(XCommand &xcommand, XAcquisition &xacquisition, XDevice *xdevice_ptr,
+					const XBenchCase &bench_case, XBenchResult &result)
+{
+	if (1 != xcommand.SetPara(XPARA_BINNING_MODE, bench_case._binning))
+		printf("Falha ao definir o modo de binning %u\n", bench_case._binning);
+
+	if (!xacquisition.Open(xdevice_ptr, &xcommand, bench_case._socket_buf_size,
+						   bench_case._frame_buf_num, bench_case._affinity_mask))
+	{
+		printf("Falha ao abrir o canal de imagem: %u\n", xacquisition.GetLastError());
+		return false;
+	}
+
+	bench_sink.Reset(bench_case, false);
+	uint64_t cpu = XProcessCpuNs();
+	uint64_t start = XBenchNow();
+	xacquisition.Grab(bench_case._frame_num);
+
+	uint64_t frames = 0;
+	uint64_t progress_ns = start;
+	while (!is_exit && !bench_sink._is_complete &&
+		   bench_sink._frames + bench_sink.getDropped() < bench_case._frame_num)
+	{
+		this_thread::sleep_for(chrono::milliseconds(10));
+		if (bench_sink._frames != frames)
+		{
+			frames = bench_sink._frames;
+			progress_ns = XBenchNow();
+		}
+		else if (XBenchNow() - progress_ns > 5000000000ULL)
+		{
+			printf("Sem quadros há 5 s, caso interrompido\n");
+			break;
+		}
+	}
+
+	xacquisition.Stop();
+	result._seconds = elapsedSeconds(start);
+	result._cpu_process = (XProcessCpuNs() - cpu) / (result._seconds * 1e7);
+	xacquisition.Close();
+
+	result._pipeline_ = "sdk";
+	result._case = bench_case;
+	result._case._width = bench_sink._width;
+	result._case._height = bench_sink._height;
+	result._socket_buf_actual = bench_case._socket_buf_size;
+	bench_sink.getResult(result);
+	return true;
+}
+
+#else
+
+/**
+ * @brief Roda um caso com o simulador e a cadeia de loopback
+ *
+ * A fonte manda frame_num quadros; a medição termina quando ela para e a
+ * cadeia não recebe pacotes por 200 ms.
+ */
+static bool runCase(const BenchOptions &opt, const XBenchCase &bench_case, XBenchResult &result)
+{
+	XSimConfig config;
+	XInitSimConfig(config);
+	strcpy(config._host_ip, "127.0.0.1");
+	config._img_port = opt.port;
+	config._width = bench_case._width;
+	config._height = bench_case._height;
+	config._pixel_depth = bench_case._pixel_depth;
+	config._payload_size = opt.payload;
+	config._frame_rate = opt.fps;
+	config._frame_num = bench_case._frame_num;
+	config._loss = opt.loss;
+
+	XDeviceSim sim;
+	if (!sim.Open(config))
+	{
+		printf("Falha ao abrir o simulador: %s\n", strerror(sim.GetLastError()));
+		return false;
+	}
+
+	XBenchPipeline pipeline;
+	if (!pipeline.Open(bench_case, "127.0.0.1", opt.port, &bench_sink))
+	{
+		printf("Falha ao abrir a cadeia de loopback: %s\n", strerror(pipeline.GetLastError()));
+		return false;
+	}
+
+	bench_sink.Reset(bench_case, opt.is_check);
+	if (opt.is_check)
+		bench_sink.startCheck(&pipeline);
+	pipeline.Start();
+	uint64_t cpu = XProcessCpuNs();
+	uint64_t start = XBenchNow();
+	sim.SetGrab(1);
+
+	while (!is_exit && sim.IsGrabbing())
+	{
+		this_thread::sleep_for(chrono::milliseconds(10));
+	}
+	sim.SetGrab(0);
+
+	// Espera a cadeia esvaziar
+	uint64_t packets;
+	do
+	{
+		packets = pipeline.GetPackets();
+		this_thread::sleep_for(chrono::milliseconds(200));
+	} while (!is_exit && packets != pipeline.GetPackets());
+
+	pipeline.Stop();
+	bench_sink.stopCheck();
+	result._seconds = elapsedSeconds(start);
+	result._cpu_process = (XProcessCpuNs() - cpu) / (result._seconds * 1e7);
+
+	XSimStats stats;
+	sim.GetStats(stats);
+	sim.Close();
+
+	result._pipeline_ = "loopback";
+	result._case = bench_case;
+	result._sent_frames = stats._frames;
+	result._sent_packets = stats._packets;
+	pipeline.GetResult(result, result._seconds);
+	bench_sink.getResult(result);
+	return true;
+}
+
+#endif
+
+static void printResult(const XBenchResult &r)
+{
+	const XLatencySummary &total = r._latency[XBENCH_STAGE_TOTAL];
+	const XLatencySummary &sink = r._latency[XBENCH_STAGE_SINK];
+	printf("binning %u %ux%u buffers %u rcvbuf %u (%u) afinidade 0x%X: "
+		   "%.1f quadros/s %.0f pacotes/s %.1f MB/s | pac_lost %llu buf_full %llu data_lost %llu | "
+		   "total p50 %.0f p99 %.0f us, sink p99 %.0f us | CPU %.0f%%\n",
+		   r._case._binning, r._case._width, r._case._height, r._case._frame_buf_num,
+		   r._case._socket_buf_size, r._socket_buf_actual, r._case._affinity_mask,
+		   XBenchRate(r._frames, r._seconds), XBenchRate(r._packets, r._seconds),
+		   XBenchRate(r._bytes, r._seconds) / (1024.0 * 1024.0),
+		   (unsigned long long)r._pac_lost, (unsigned long long)r._buf_full,
+		   (unsigned long long)r._data_lost, total._p50, total._p99, sink._p99, r._cpu_process);
+	if (r._bad_frames)
+		printf("  %llu quadros com pixels errados\n", (unsigned long long)r._bad_frames);
+}
+
+int main(int argc, char **argv)
+{
+	BenchOptions opt;
+	if (!parseOptions(argc, argv, opt))
+	{
+		printUsage(argv[0]);
+		return 1;
+	}
+
+	signal(SIGINT, onSignal);
+	signal(SIGTERM, onSignal);
+
+#ifdef _MSC_VER
+	if (opt.host_ip.empty())
+	{
+		printUsage(argv[0]);
+		return 1;
+	}
+
+	// Liga ao detector uma vez, os casos só reabrem o canal de imagem
+	XSystem xsystem(opt.host_ip.c_str());
+	xsystem.RegisterEventSink(&cmd_sink);
+	if (!xsystem.Open() || xsystem.FindDevice() <= 0)
+	{
+		printf("Nenhum dispositivo encontrado a partir de %s\n", opt.host_ip.c_str());
+		return 1;
+	}
+	XDevice *xdevice_ptr = xsystem.GetDevice(0);
+
+	XGigFactory xfactory;
+	XCommand xcommand(&xfactory);
+	xcommand.RegisterEventSink(&cmd_sink);
+	XFrameTransfer xtransfer;
+	xtransfer.RegisterEventSink(&bench_sink);
+	XAcquisition xacquisition(&xfactory);
+	xacquisition.RegisterEventSink(&bench_sink);
+	xacquisition.RegisterFrameTransfer(&xtransfer);
+
+	if (!xcommand.Open(xdevice_ptr))
+	{
+		printf("Falha ao abrir o canal de comando\n");
+		return 1;
+	}
+#endif
+
+	if (!opt.trace_file.empty())
+		XTraceRecorder::Get().Start();
+
+	vector<XBenchResult> results;
+	for (size_t b = 0; b < opt.binnings.size() && !is_exit; b++)
+		for (size_t f = 0; f < opt.buffers.size() && !is_exit; f++)
+			for (size_t s = 0; s < opt.rcvbufs.size() && !is_exit; s++)
+				for (size_t a = 0; a < opt.affinities.size() && !is_exit; a++)
+				{
+					XBenchCase bench_case;
+					bench_case._binning = opt.binnings[b];
+					bench_case._width = opt.width >> bench_case._binning;
+					bench_case._height = opt.height >> bench_case._binning;
+					bench_case._pixel_depth = opt.depth;
+					bench_case._payload_size = opt.payload;
+					bench_case._frame_buf_num = opt.buffers[f];
+					bench_case._socket_buf_size = opt.rcvbufs[s];
+					bench_case._affinity_mask = opt.affinities[a];
+					bench_case._frame_num = opt.frames;
+
+					XBenchResult result;
+					XClearBenchResult(result);
+#ifdef _MSC_VER
+					if (!runCase(xcommand, xacquisition, xdevice_ptr, bench_case, result))
+						continue;
+#else
+					if (!runCase(opt, bench_case, result))
+						continue;
+#endif
+					printResult(result);
+					results.push_back(result);
+				}
+
+#ifdef _MSC_VER
+	xcommand.Close();
+	xsystem.Close();
+#endif
+
+	if (!opt.csv_file.empty() && !XWriteBenchCsv(opt.csv_file.c_str(), results))
+		printf("Falha ao gravar %s\n", opt.csv_file.c_str());
+	if (!opt.json_file.empty() && !XWriteBenchJson(opt.json_file.c_str(), results))
+		printf("Falha ao gravar %s\n", opt.json_file.c_str());
+	if (!opt.trace_file.empty())
+	{
+		XTraceRecorder &recorder = XTraceRecorder::Get();
+		recorder.Stop();
+		if (!recorder.WriteJson(opt.trace_file.c_str()))
+			printf("Falha ao gravar %s\n", opt.trace_file.c_str());
+		else if (recorder.GetOverwriteNum())
+			printf("Trace: %llu eventos mais antigos sobrescritos\n",
+				   (unsigned long long)recorder.GetOverwriteNum());
+	}
+
+	return 0;
+}
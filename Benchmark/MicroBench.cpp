@@ -0,0 +1,590 @@
+/**
+ * @file MicroBench.cpp
+ * @brief Microbenchmarks dos kernels de parse, correção, análise, CRC e E/S (Linux)
+ *
+ * Mede cada kernel isolado sobre um quadro sintético de semente fixa, com
+ * aquecimento e várias repetições, e informa ns/pixel e GB/s da mediana
+ * (ns/pacote e pacotes/s para o parse do cabeçalho).
+ * Roda sem interface e sem detector.
+ *
+ * As classes da DLL (XUDPImgParse, XCorrection, XAnalyze, XImageHandler,
+ * XTifFormat) só existem no Windows; aqui são medidos os equivalentes dos
+ * cabeçalhos que as substituem na aquisição:
+ *   parse    XParseImgPacket e XLinePlacer::Put (parse + cópia dos dados)
+ *   correct  XCorrectKernel por ISA, com pixels defeituosos, e XCorrectBatch
+ *   analyze  XFrameStats: média, mediana e tudo; 1 thread contra todas em
+ *            um quadro 2x2 maior, onde as bandas compensam a junção dos histogramas
+ *   crc      XFastCrc::PutByte, fatias de 8 e PCLMULQDQ
+ *   raw      XRawSink (buffered, O_DIRECT, io_uring), fread e XRawMap
+ *   tif      XTifStream e XTifMap
+ * A leitura dos arquivos encontra o cache de páginas quente.
+ *
+ * Compilação:
+ *   g++ -std=c++11 -O2 -pthread -I../include MicroBench.cpp -o xmicro
+ *
+ * Exemplos:
+ *   ./xmicro
+ *   ./xmicro --filter correct --reps 20 --csv micro.csv
+ *   ./xmicro --width 2800 --height 2400 --dir /mnt/ssd --json micro.json
+ */
+
+// Antes dos cabeçalhos do SDK: xtif_format.h deixa #pragma pack(2) ativo
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "xbench.h"			  // Cronometragem e saída CSV/JSON
+#include "xline_place.h"	  // Parse e colocação dos pacotes
+#include "xcorrect_kernel.h"  // Correção offset/ganho/defeitos
+#include "xcorrect_batch.h"	  // Correção em várias threads
+#include "xframe_stats.h"	  // Média e mediana
+#include "xcrc.h"			  // CRC32
+#include "xraw_sink.h"		  // Gravação de .dat
+#include "xraw_map.h"		  // Leitura de .dat mapeada
+#include "xtif_stream.h"	  // Gravação de TIFF
+#include "xtif_map.h"		  // Leitura de TIFF mapeada
+
+using namespace std;
+
+// ============================================================================
+// OPÇÕES E RESULTADOS
+// ============================================================================
+
+static uint32_t width = 1400;
+static uint32_t height = 1200;
+static uint32_t payload_size = 8192;
+static uint32_t io_frames = 16;
+static uint32_t warmup = 2;
+static uint32_t reps = 10;
+static uint32_t seed = 1;
+static string filter;
+static string dir = "/tmp";
+
+static vector<XMicroResult> results;
+
+/** @brief Evita que o compilador descarte os resultados dos kernels */
+static volatile uint64_t sink_value = 0;
+
+/** @brief Verdadeiro se "grupo nome" contém o filtro */
+static bool isSelected(const char *group, const string &name)
+{
+	string full = string(group) + " " + name;
+	return filter.empty() || string::npos != full.find(filter);
+}
+
+/**
+ * @brief Mede func se selecionado pelo filtro e guarda o resultado
+ *
+ * Com packets, o kernel trabalha por pacote: pixels e bytes ficam 0 e a
+ * saída é em ns/pacote.
+ */
+template <typename Func>
+static void run(const char *group, const string &name, uint64_t pixels, uint64_t bytes, Func func,
+				uint64_t packets = 0)
+{
+	if (!isSelected(group, name))
+		return;
+
+	XMicroResult result;
+	memset(&result, 0, sizeof(result));
+	snprintf(result._group, sizeof(result._group), "%s", group);
+	snprintf(result._name, sizeof(result._name), "%s", name.c_str());
+	result._pixels = pixels;
+	result._bytes = bytes;
+	result._packets = packets;
+	XRunMicro(result, func, warmup, reps);
+
+	if (packets)
+		printf("%-8s %-28s %9.2f ns/pacote %7.2f Mpac/s  mediana %9.3f ms  mín %9.3f ms\n",
+			   result._group, result._name, XMicroNsPerPacket(result), XMicroPacketsPerSec(result) / 1e6,
+			   result._median_ns / 1e6, result._min_ns / 1e6);
+	else
+		printf("%-8s %-28s %9.4f ns/pixel %8.3f GB/s  mediana %9.3f ms  mín %9.3f ms\n",
+			   result._group, result._name, XMicroNsPerPixel(result), XMicroGBps(result),
+			   result._median_ns / 1e6, result._min_ns / 1e6);
+	results.push_back(result);
+}
+
+// ============================================================================
+// DADOS SINTÉTICOS
+// ============================================================================
+
+/** @brief Quadro de 16 bits sem line info sobre um buffer próprio */
+struct Frame
+{
+	vector<uint16_t> pixels;
+	XImage image;
+
+	void init()
+	{
+		pixels.assign((size_t)width * height, 0);
+		image._width = width;
+		image._height = height;
+		image._pixel_depth = 16;
+		image._size = pixels.size() * sizeof(uint16_t);
+		image._data_offset = 0;
+		image._data_ = (uint8_t *)&pixels[0];
+		image._device_ = NULL;
+	}
+};
+
+/** @brief Nível base + gradiente + ruído, como uma projeção clara */
+static void fillFrame(Frame &frame, uint32_t base, uint32_t noise, mt19937 &rand)
+{
+	uniform_int_distribution<uint32_t> dist(0, noise);
+	for (uint32_t row = 0; row < height; row++)
+		for (uint32_t col = 0; col < width; col++)
+			frame.pixels[(size_t)row * width + col] = (uint16_t)(base + ((row + col) & 0xFF) + dist(rand));
+}
+
+/**
+ * @brief Pacotes de um quadro no formato do detector: cabeçalho de
+ *        HEADER_SIZE bytes e pacotes de dados com linhas inteiras até
+ *        payload_size, ou linhas divididas por PACKET_ID
+ */
+static void buildPackets(const Frame &frame, vector<vector<uint8_t>> &buffers, vector<XPacket> &packets)
+{
+	uint32_t line_bytes = width * sizeof(uint16_t);
+	const uint8_t *data = frame.image._data_;
+	buffers.clear();
+
+	vector<uint8_t> head(HEADER_SIZE, 0);
+	head[CMD] = 0;
+	head[FRAME_SIZE + 2] = (uint8_t)(height >> 8);
+	head[FRAME_SIZE + 3] = (uint8_t)height;
+	buffers.push_back(head);
+
+	uint32_t line_num = payload_size / line_bytes;
+	for (uint32_t line = 0; line < height;)
+	{
+		uint32_t pos = 0;
+		uint32_t size = line_bytes;
+		uint32_t lines = 1;
+		if (line_num > 1)
+		{
+			lines = (height - line < line_num) ? height - line : line_num;
+			size = lines * line_bytes;
+		}
+		for (uint32_t packet_id = 0; pos < size; packet_id++)
+		{
+			uint32_t len = (size - pos < payload_size) ? size - pos : payload_size;
+			vector<uint8_t> buf(PAYLOAD + len, 0);
+			buf[CMD] = 1;
+			buf[LINE_ID] = (uint8_t)(line >> 8);
+			buf[LINE_ID + 1] = (uint8_t)line;
+			buf[PACKET_ID] = (uint8_t)packet_id;
+			buf[PAYLOAD_SIZE] = (uint8_t)(len >> 8);
+			buf[PAYLOAD_SIZE + 1] = (uint8_t)len;
+			memcpy(&buf[PAYLOAD], data + (size_t)line * line_bytes + pos, len);
+			buffers.push_back(buf);
+			pos += len;
+		}
+		line += lines;
+	}
+
+	packets.resize(buffers.size());
+	for (size_t i = 0; i < buffers.size(); i++)
+	{
+		packets[i].next_ = NULL;
+		packets[i].size = (int32_t)buffers[i].size();
+		packets[i].data_ = &buffers[i][0];
+	}
+}
+
+static const char *isaName(uint32_t isa)
+{
+	if (XCOR_ISA_AVX2 == isa)
+		return "avx2";
+	if (XCOR_ISA_SSE41 == isa)
+		return "sse41";
+	return "scalar";
+}
+
+static const char *sinkName(uint32_t backend)
+{
+	if (XSINK_URING == backend)
+		return "uring";
+	if (XSINK_DIRECT == backend)
+		return "direct";
+	return "buffered";
+}
+
+// ============================================================================
+// GRUPOS
+// ============================================================================
+
+static void benchParse(const Frame &frame)
+{
+	vector<vector<uint8_t>> buffers;
+	vector<XPacket> packets;
+	buildPackets(frame, buffers, packets);
+	uint64_t pixels = (uint64_t)width * height;
+	uint64_t bytes = frame.image._size;
+
+	// Só lê os cabeçalhos: o custo é por pacote, não por pixel
+	run("parse", "header", 0, 0, [&]() {
+		uint64_t sum = 0;
+		XHeader header;
+		for (size_t i = 0; i < packets.size(); i++)
+		{
+			if (XParseImgPacket(&packets[i], header))
+				sum += header._line_id + header._payload_size;
+		}
+		sink_value += sum;
+	}, packets.size());
+
+	Frame out;
+	out.init();
+	XLinePlacer placer;
+	placer.Open(&out.image, payload_size);
+	placer.SetFrame(out.image._data_);
+	run("parse", "place", pixels, bytes, [&]() {
+		for (size_t i = 0; i < packets.size(); i++)
+			placer.Put(&packets[i]);
+	});
+	if (isSelected("parse", "place") && 0 != memcmp(out.image._data_, frame.image._data_, bytes))
+		printf("parse place: quadro montado difere do original\n");
+}
+
+static void benchCorrect(Frame &frame, mt19937 &rand)
+{
+	Frame dark, out;
+	dark.init();
+	out.init();
+	fillFrame(dark, 900, 31, rand);
+
+	vector<float> gain((size_t)width * height);
+	uniform_real_distribution<float> gain_dist(0.9f, 1.1f);
+	for (size_t i = 0; i < gain.size(); i++)
+		gain[i] = gain_dist(rand);
+
+	XCorrectKernel kernel;
+	kernel.Open(width, height);
+	kernel.SetOffset(&dark.image);
+	kernel.SetGain(&gain[0]);
+	kernel.SetBaseline(100);
+
+	uint64_t pixels = (uint64_t)width * height;
+	uint64_t bytes = frame.image._size;
+	uint32_t best = XCorrectDetectIsa();
+	for (uint32_t isa = XCOR_ISA_SCALAR; isa <= best; isa++)
+	{
+		kernel.SetIsa(isa);
+		run("correct", string("offset+gain ") + isaName(isa), pixels, bytes,
+			[&]() { kernel.Correct(&frame.image, &out.image); });
+	}
+	kernel.SetIsa(XCOR_ISA_AUTO);
+
+	// 0,1% de pixels defeituosos em posições de semente fixa
+	uniform_int_distribution<uint32_t> row_dist(0, height - 1);
+	uniform_int_distribution<uint32_t> col_dist(0, width - 1);
+	for (uint64_t i = 0; i < pixels / 1000; i++)
+		kernel.SetDefect(row_dist(rand), col_dist(rand));
+	run("correct", string("offset+gain+defect ") + isaName(best), pixels, bytes,
+		[&]() { kernel.Correct(&frame.image, &out.image); });
+
+	XCorrectBatch batch;
+	if (batch.Open(&kernel, 0))
+	{
+		vector<XImage *> src(1, &frame.image);
+		vector<XImage *> dst(1, &out.image);
+		char name[48];
+		snprintf(name, sizeof(name), "batch %u threads", batch.GetThreadNum());
+		run("correct", name, pixels, bytes, [&]() { batch.DoCorrect(&src, &dst); });
+	}
+}
+
+static void benchAnalyze(Frame &frame)
+{
+	uint64_t pixels = (uint64_t)width * height;
+	uint64_t bytes = frame.image._size;
+
+	XFrameStats stats;
+	stats.Open(1);
+	run("analyze", "mean", pixels, bytes, [&]() {
+		stats.Calc(&frame.image, XSTAT_MEAN);
+		sink_value += (uint64_t)stats.GetMean();
+	});
+	run("analyze", "median", pixels, bytes, [&]() {
+		stats.Calc(&frame.image, XSTAT_MEDIAN);
+		sink_value += stats.GetMedian();
+	});
+	run("analyze", "all", pixels, bytes, [&]() { stats.Calc(&frame.image, XSTAT_ALL); });
+
+	// Cada banda junta um histograma de 64K posições no fim; em um quadro
+	// pequeno isso come o ganho das threads. O quadro 2x2 mede as duas
+	// formas no mesmo tamanho.
+	if (!isSelected("analyze", "all 2x2"))
+		return;
+	uint32_t big_width = width * 2;
+	uint32_t big_height = height * 2;
+	vector<uint16_t> big_pixels((size_t)big_width * big_height);
+	for (uint32_t row = 0; row < big_height; row++)
+		for (uint32_t col = 0; col < big_width; col++)
+			big_pixels[(size_t)row * big_width + col] = frame.pixels[(size_t)(row % height) * width + col % width];
+	XImage big;
+	big._width = big_width;
+	big._height = big_height;
+	big._pixel_depth = 16;
+	big._size = big_pixels.size() * sizeof(uint16_t);
+	big._data_offset = 0;
+	big._data_ = (uint8_t *)&big_pixels[0];
+	big._device_ = NULL;
+	run("analyze", "all 2x2 1 thread", pixels * 4, bytes * 4, [&]() { stats.Calc(&big, XSTAT_ALL); });
+
+	XFrameStats multi;
+	if (multi.Open(0) && multi.GetThreadNum() > 1)
+	{
+		char name[48];
+		snprintf(name, sizeof(name), "all 2x2 %u threads", multi.GetThreadNum());
+		run("analyze", name, pixels * 4, bytes * 4, [&]() { multi.Calc(&big, XSTAT_ALL); });
+	}
+	big._data_ = NULL;
+}
+
+static void benchCrc(Frame &frame)
+{
+	const uint8_t *data = frame.image._data_;
+	size_t size = frame.image._size;
+	uint64_t pixels = (uint64_t)width * height;
+
+	run("crc", "PutByte", pixels, size, [&]() {
+		XFastCrc crc(XCRC32_KEY);
+		for (size_t i = 0; i < size; i++)
+			crc.PutByte(data[i]);
+		sink_value += crc.Done();
+	});
+	run("crc", "slice8", pixels, size,
+		[&]() { sink_value += XCrcUpdateSlice8(0xFFFFFFFF, data, size); });
+	if (XCrcHasPclmul())
+	{
+		run("crc", "pclmul", pixels, size,
+			[&]() { sink_value += XCrcUpdatePclmul(0xFFFFFFFF, data, size); });
+	}
+}
+
+static void writeRaw(Frame &frame, const string &dat_file, uint32_t backend)
+{
+	XRawSink sink;
+	sink.OpenFile(dat_file.c_str(), backend, frame.image._size, io_frames);
+	for (uint32_t i = 0; i < io_frames; i++)
+		sink.Write(&frame.image);
+	sink.CloseFile();
+}
+
+static void readRaw(Frame &frame, const string &dat_file)
+{
+	uint64_t pixels = (uint64_t)width * height * io_frames;
+	uint64_t bytes = (uint64_t)frame.image._size * io_frames;
+	writeRaw(frame, dat_file, XSINK_BUFFERED);
+
+	Frame out;
+	out.init();
+	run("raw", "read fread", pixels, bytes, [&]() {
+		FILE *in = fopen(dat_file.c_str(), "rb");
+		if (!in)
+			return;
+		for (uint32_t i = 0; i < io_frames; i++)
+		{
+			if (1 != fread(out.image._data_, frame.image._size, 1, in))
+				break;
+		}
+		fclose(in);
+	});
+	run("raw", "read map", pixels, bytes, [&]() {
+		XRawMap map;
+		if (!map.Open(dat_file.c_str()))
+			return;
+		for (uint32_t i = 0; i < map.GetFrameNum(); i++)
+			memcpy(out.image._data_, map.GetImage(i)->_data_, frame.image._size);
+	});
+	if (0 != memcmp(out.image._data_, frame.image._data_, frame.image._size))
+		printf("raw: quadro lido difere do gravado\n");
+}
+
+static void benchRaw(Frame &frame)
+{
+	string dat_file = dir + "/xmicro.dat";
+	uint64_t pixels = (uint64_t)width * height * io_frames;
+	uint64_t bytes = (uint64_t)frame.image._size * io_frames;
+
+	// Backends indisponíveis caem para o anterior, mede cada um uma vez
+	uint32_t last = 0xFF;
+	for (uint32_t backend = XSINK_BUFFERED; backend <= XSINK_URING; backend++)
+	{
+		XRawSink probe;
+		if (!probe.OpenFile(dat_file.c_str(), backend))
+		{
+			printf("raw: não foi possível criar %s\n", dat_file.c_str());
+			return;
+		}
+		uint32_t actual = probe.GetBackend();
+		probe.CloseFile();
+		if (actual == last)
+			continue;
+		last = actual;
+		run("raw", string("write ") + sinkName(actual), pixels, bytes,
+			[&]() { writeRaw(frame, dat_file, actual); });
+	}
+
+	// As leituras usam um arquivo gravado fora da medição
+	if (isSelected("raw", "read fread") || isSelected("raw", "read map"))
+		readRaw(frame, dat_file);
+
+	remove(dat_file.c_str());
+	remove(XRawHeaderName(dat_file.c_str()).c_str());
+}
+
+static void writeTif(Frame &frame, const string &tif_file)
+{
+	XTifStream tif;
+	if (!tif.Open(tif_file.c_str()))
+		return;
+	for (uint32_t i = 0; i < io_frames; i++)
+		tif.Write(&frame.image);
+	tif.Close();
+}
+
+static void benchTif(Frame &frame)
+{
+	string tif_file = dir + "/xmicro.tif";
+	uint64_t pixels = (uint64_t)width * height * io_frames;
+	uint64_t bytes = (uint64_t)frame.image._size * io_frames;
+
+	run("tif", "write", pixels, bytes, [&]() { writeTif(frame, tif_file); });
+
+	if (isSelected("tif", "read map"))
+	{
+		writeTif(frame, tif_file);
+		Frame out;
+		out.init();
+		run("tif", "read map", pixels, bytes, [&]() {
+			XTifMap map;
+			if (!map.Open(tif_file.c_str()))
+				return;
+			for (uint32_t i = 0; i < map.GetPageNum(); i++)
+				memcpy(out.image._data_, map.GetImage(i)->_data_, frame.image._size);
+		});
+		if (0 != memcmp(out.image._data_, frame.image._data_, frame.image._size))
+			printf("tif: quadro lido difere do gravado\n");
+	}
+
+	remove(tif_file.c_str());
+}
+
+static void printUsage(const char *name)
+{
+	printf("Uso: %s [opções]\n"
+		   "  --width N         colunas (padrão 1400)\n"
+		   "  --height N        linhas (padrão 1200)\n"
+		   "  --payload N       bytes de imagem por pacote (padrão 8192)\n"
+		   "  --io-frames N     quadros por arquivo nos testes de E/S (padrão 16)\n"
+		   "  --warmup N        repetições de aquecimento (padrão 2)\n"
+		   "  --reps N          repetições medidas (padrão 10)\n"
+		   "  --seed N          semente dos dados sintéticos (padrão 1)\n"
+		   "  --filter TEXTO    só os testes cujo \"grupo nome\" contém TEXTO\n"
+		   "  --dir DIR         diretório dos arquivos temporários (padrão /tmp)\n"
+		   "  --csv ARQ         grava os resultados em CSV\n"
+		   "  --json ARQ        grava os resultados em JSON\n",
+		   name);
+}
+
+int main(int argc, char **argv)
+{
+	string csv_file;
+	string json_file;
+
+	static const struct option options[] = {
+		{"width", required_argument, NULL, 'w'},
+		{"height", required_argument, NULL, 'h'},
+		{"payload", required_argument, NULL, 'p'},
+		{"io-frames", required_argument, NULL, 'n'},
+		{"warmup", required_argument, NULL, 'u'},
+		{"reps", required_argument, NULL, 'r'},
+		{"seed", required_argument, NULL, 's'},
+		{"filter", required_argument, NULL, 'f'},
+		{"dir", required_argument, NULL, 'd'},
+		{"csv", required_argument, NULL, 'c'},
+		{"json", required_argument, NULL, 'j'},
+		{"help", no_argument, NULL, '?'},
+		{NULL, 0, NULL, 0}};
+
+	int opt;
+	while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1)
+	{
+		switch (opt)
+		{
+		case 'w':
+			width = (uint32_t)atoi(optarg);
+			break;
+		case 'h':
+			height = (uint32_t)atoi(optarg);
+			break;
+		case 'p':
+			payload_size = (uint32_t)atoi(optarg);
+			break;
+		case 'n':
+			io_frames = (uint32_t)atoi(optarg);
+			break;
+		case 'u':
+			warmup = (uint32_t)atoi(optarg);
+			break;
+		case 'r':
+			reps = (uint32_t)atoi(optarg);
+			break;
+		case 's':
+			seed = (uint32_t)atoi(optarg);
+			break;
+		case 'f':
+			filter = optarg;
+			break;
+		case 'd':
+			dir = optarg;
+			break;
+		case 'c':
+			csv_file = optarg;
+			break;
+		case 'j':
+			json_file = optarg;
+			break;
+		default:
+			printUsage(argv[0]);
+			return 1;
+		}
+	}
+
+	// PACKET_ID tem um byte e PAYLOAD_SIZE dois
+	if (0 == width || 0 == height || height > MAX_LINE_NUM || 0 == io_frames || payload_size < 2 ||
+		payload_size > 0xFFFF || payload_size + PAYLOAD > XPAC_SIZE ||
+		(width * 2 + payload_size - 1) / payload_size > 256)
+	{
+		printUsage(argv[0]);
+		return 1;
+	}
+
+	mt19937 rand(seed);
+	Frame frame;
+	frame.init();
+	fillFrame(frame, 3000, 255, rand);
+
+	printf("Quadro %ux%u 16 bits, %u aquecimentos, %u repetições, semente %u\n",
+		   width, height, warmup, reps, seed);
+
+	benchParse(frame);
+	benchCorrect(frame, rand);
+	benchAnalyze(frame);
+	benchCrc(frame);
+	benchRaw(frame);
+	benchTif(frame);
+
+	if (!csv_file.empty() && !XWriteMicroCsv(csv_file.c_str(), results))
+		printf("Falha ao gravar %s\n", csv_file.c_str());
+	if (!json_file.empty() && !XWriteMicroJson(json_file.c_str(), results))
+		printf("Falha ao gravar %s\n", json_file.c_str());
+
+	return 0;
+}
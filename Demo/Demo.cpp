@@ -31,7 +31,13 @@
 
 // Manipulação e correção de imagens
 #include "ximage_handler.h" // Salvamento de imagens em disco
+#include "xasync_writer.h"	// Gravação de quadros em uma thread de E/S
 #include "xcorrection.h"	// Correções de imagem (offset, ganho)
+#include "xcorrect_batch.h" // Correção em lote em todas as threads
+#include "xcalib_stream.h"	// Calibração de offset/ganho quadro a quadro
+#include "xraw_map.h"		// Leitura de arquivos .dat mapeados em memória
+#include "xframe_stats.h"	// Média e mediana de quadros em uma passada
+#include "xcrc_file.h"		// CRC32 dos arquivos gravados
 
 #ifdef _MSC_VER
 #include "xthread_win.h"
@@ -68,6 +74,9 @@ using namespace std;
 /** @brief Manipulador para salvar imagens capturadas em disco */
 XImageHandler ximg_handle;
 
+/** @brief Fila de gravação: tira a escrita em disco da thread de transferência */
+XAsyncWriter ximg_writer;
+
 /** @brief Evento de sincronização para sinalizar conclusão da captura */
 XEvent frame_complete;
 
@@ -102,6 +111,7 @@ uint32_t frame_buffer_size = 400; // Buffer para x86: 400 frames
 void displayMenu();
 void clearBuffer();
 uint64_t getImageAverage(string file_name);
+int correctScan(const string &prefix, int num, XCorrectKernel &kernel);
 HANDLE abrirPortaSerial(const char *porta);
 void enviarComando(HANDLE hSerial, const std::string &comando);
 
@@ -219,7 +229,7 @@ class ImgSink : public IXImgSink
 		// Salva o frame em disco se o modo de salvamento estiver ativo
 		if (is_save)
 		{
-			ximg_handle.Write(image_);
+			ximg_writer.Write(image_);
 		}
 	}
 
@@ -239,6 +249,21 @@ class ImgSink : public IXImgSink
 
 		if (is_save)
 		{
+			// Espera a fila de gravação esvaziar antes de fechar o arquivo
+			bool is_written = ximg_writer.Flush();
+			if (!is_written)
+			{
+				XWriteStats stats;
+				ximg_writer.GetStats(stats);
+				printf("Falha ao gravar quadros em %s (%llu no total), arquivo .crc não gerado\n",
+					   save_file_name.c_str(), (unsigned long long)stats._failed);
+			}
+
+			// CRCs calculados na thread de E/S durante a gravação
+			XCrcInfo crc_info;
+			ximg_writer.TakeChecksum(crc_info);
+			string dat_name = save_file_name;
+
 			// Gera arquivo .txt com metadados da imagem (header)
 			string txt_name = save_file_name.replace(save_file_name.find(".dat"), 4, ".txt");
 
@@ -248,6 +273,11 @@ class ImgSink : public IXImgSink
 			// Fecha o arquivo de imagem e libera recursos
 			ximg_handle.CloseFile();
 
+			// Grava o arquivo .crc usado para verificar o .dat ao carregá-lo;
+			// com quadros faltando ele não descreveria o arquivo
+			if (is_written)
+				XWriteCrcFile(dat_name.c_str(), crc_info);
+
 			// Desativa o modo de salvamento
 			is_save = 0;
 		}
@@ -292,6 +322,9 @@ int main(int argc, char **argv)
 	}
 
 	XSystem xsystem(host_ip);
+
+	ximg_writer.Open(&ximg_handle);
+	ximg_writer.SetChecksum(1);
 	XDevice *xdevice_ptr = NULL;
 
 	int32_t device_count = 0;
@@ -316,6 +349,10 @@ int main(int argc, char **argv)
 	xacquisition.RegisterFrameTransfer(&xtransfer);
 
 	XCorrection xcorrection;
+	XCorrectKernel xkernel; // Offset e ganho da opção 8, para corrigir a tomografia
+	XCalibStream xcalib;
+	XRawInfo raw_info;
+	XRawMap raw_map;
 
 	string send_str;
 	string recv_str;
@@ -544,7 +581,19 @@ int main(int argc, char **argv)
 
 			cin >> offset_file;
 
-			if (!ximg_handle.ReadFile(offset_file.c_str()))
+			// Arquivos sem .crc são aceitos, os corrompidos não
+			if (XCheckFileCrc(offset_file.c_str()) > XCRC_FILE_MISSING)
+			{
+				cout << "Arquivo de offset corrompido, retornando ao menu principal" << endl;
+
+				xcorrection.Close();
+				break;
+			}
+
+			// Acumula os quadros um a um, sem carregar o arquivo inteiro na memória
+			if (!XReadRawInfo(offset_file.c_str(), raw_info) ||
+				!xcalib.Begin(raw_info._width, raw_info._height, raw_info._pixel_depth) ||
+				!xcalib.AddFile(offset_file.c_str()) || !xcalib.Finish())
 			{
 				cout << "Falha ao abrir o arquivo de offset, retornando ao menu principal" << endl;
 
@@ -552,7 +601,7 @@ int main(int argc, char **argv)
 				break;
 			}
 
-			if (!xcorrection.CalculateOffset(ximg_handle._images_))
+			if (!xcorrection.CalculateOffset(xcalib.GetMeanImage()))
 			{
 				cout << "Falha ao calcular o offset, retornando ao menu principal" << endl;
 
@@ -560,11 +609,27 @@ int main(int argc, char **argv)
 				break;
 			}
 
+			if (!xkernel.Open(raw_info._width, raw_info._height) ||
+				!xkernel.SetOffset(xcalib.GetMeanImage()))
+			{
+				xkernel.Close();
+			}
+
 			cout << "Offset calculado com sucesso, por favor insira o nome do arquivo de ganho, *.dat \n";
 
 			cin >> gain_file;
 
-			if (!ximg_handle.ReadFile(gain_file.c_str()))
+			if (XCheckFileCrc(gain_file.c_str()) > XCRC_FILE_MISSING)
+			{
+				cout << "Arquivo de ganho corrompido, retornando ao menu principal" << endl;
+
+				xcorrection.Close();
+				break;
+			}
+
+			if (!XReadRawInfo(gain_file.c_str(), raw_info) ||
+				!xcalib.Begin(raw_info._width, raw_info._height, raw_info._pixel_depth) ||
+				!xcalib.AddFile(gain_file.c_str()) || !xcalib.Finish())
 			{
 				cout << "Falha ao abrir o arquivo de ganho, retornando ao menu principal" << endl;
 
@@ -572,19 +637,35 @@ int main(int argc, char **argv)
 				break;
 			}
 
-			if (!xcorrection.CalculateGain(ximg_handle._images_, 0))
+			if (!xcorrection.CalculateGain(xcalib.GetMeanImage(), 0))
 			{
 				cout << "Falha ao calcular o ganho, retornando ao menu principal" << endl;
 
 				xcorrection.Close();
+				xkernel.Close();
 				break;
 			}
 
+			// O kernel fica com a calibração para corrigir a próxima tomografia
+			if (!xkernel.IsOpen() || !xkernel.CalculateGain(xcalib.GetMeanImage(), 0))
+			{
+				xkernel.Close();
+			}
+
 			cout << "Ganho calculado com sucesso, por favor insira o nome do arquivo de imagem, *.dat \n";
 
 			cin >> img_file;
 
-			if (!ximg_handle.ReadFile(img_file.c_str()))
+			if (XCheckFileCrc(img_file.c_str()) > XCRC_FILE_MISSING)
+			{
+				cout << "Arquivo de imagem corrompido, retornando ao menu principal" << endl;
+
+				xcorrection.Close();
+				break;
+			}
+
+			// Cópia na escrita: a correção no local não altera o arquivo
+			if (!raw_map.Open(img_file.c_str(), XMAP_COPY))
 			{
 				cout << "Falha ao abrir o arquivo de imagem, retornando ao menu principal" << endl;
 
@@ -592,10 +673,11 @@ int main(int argc, char **argv)
 				break;
 			}
 
-			if (!xcorrection.DoCorrect(ximg_handle._images_))
+			if (!xcorrection.DoCorrect(raw_map.GetImages()))
 			{
 				cout << "Falha ao corrigir a imagem, retornando ao menu principal" << endl;
 
+				raw_map.Close();
 				xcorrection.Close();
 				break;
 			}
@@ -608,6 +690,8 @@ int main(int argc, char **argv)
 
 			xcorrection.Close();
 
+			raw_map.Close();
+
 			clearBuffer();
 
 			break;
@@ -734,6 +818,7 @@ int main(int argc, char **argv)
 			int numeroFramesMax = 200;
 			int intervaloDeEspera = 3000; // Em milissegundos
 			int conscutiveErrors = 0;
+			int projecoes = 0;
 
 			cout << "Esperando 4 segundos (segurança)" << endl;
 			Sleep(4000);
@@ -765,6 +850,7 @@ int main(int argc, char **argv)
 
 				// Sleep(5000); //Garantir que o handler fez tudo que precisava. Talvez isso não seja necessário; testar
 				ximg_handle.CloseFile(); // Fazer o imghandler liberar a imagem
+				projecoes = i;
 				// media = getImageAverage(local_file_name);
 				// std::cout << "Ciclos erro Total : " << bad_cycles << " Consecutivos: " << conscutiveErrors << endl;
 
@@ -794,6 +880,17 @@ int main(int argc, char **argv)
 			cout << endl
 				 << "Tomografia finalizada" << endl;
 			// cout << "Ciclos ruins: " << bad_cycles << endl << endl;
+
+			// Correção offline de todas as projeções de uma vez, não quadro a quadro
+			if (xkernel.IsOpen())
+			{
+				int corrigidas = correctScan("20250904/img", projecoes, xkernel);
+				cout << corrigidas << " de " << projecoes << " projeções corrigidas em 20250904/img*_cor.dat" << endl;
+			}
+			else
+			{
+				cout << "Sem offset/ganho (opção 8), projeções não corrigidas" << endl;
+			}
 			break;
 		}
 
@@ -1022,21 +1119,29 @@ uint64_t getImageAverage(string file_name)
 		return 0;
 	}
 
-	uint64_t soma_total = 0;
-	uint16_t valor;
-
-	for (int y = 0; y < 1200; y++)
+	// Geometria do arquivo .txt; sem ele, o tamanho padrão do detector
+	XRawInfo info;
+	if (!XReadRawInfo(file_name.c_str(), info))
 	{
-		for (int x = 0; x < 1400; x++)
-		{
-			imagemDat.read(reinterpret_cast<char *>(&valor), sizeof(valor));
-			soma_total += valor;
-		}
+		info._width = 1400;
+		info._height = 1200;
+		info._pixel_depth = 16;
 	}
 
+	// Lê o primeiro quadro de uma vez, em vez de pixel a pixel
+	std::vector<uint8_t> quadro(XRawFrameSize(info));
+	imagemDat.read(reinterpret_cast<char *>(quadro.data()), quadro.size());
 	imagemDat.close();
 
-	uint64_t media = soma_total / (1400 * 1200);
+	XImage imagem;
+	imagem._width = info._width;
+	imagem._height = info._height;
+	imagem._pixel_depth = info._pixel_depth;
+	imagem._data_ = quadro.data();
+
+	static XFrameStats estatisticas;
+	uint64_t media = (uint64_t)estatisticas.CalcMean(&imagem);
+	imagem._data_ = NULL;
 
 	std::cout << "\nMedia de " << file_name << ": " << media << std::endl;
 	if (media < 10000)
@@ -1045,3 +1150,62 @@ uint64_t getImageAverage(string file_name)
 		std::cout << "Imagem igual ou acima da media" << std::endl;
 	return media;
 }
+
+/**
+ * @brief Corrige as projeções de uma tomografia com XCorrectBatch
+ *
+ * Cada projeção <prefix><i>.dat é copiada para <prefix><i>_cor.dat, que é
+ * mapeado com escrita e corrigido no local. Todos os quadros vão para um
+ * único DoCorrect(), que reparte o trabalho entre projeções e faixas de
+ * linhas em todas as threads.
+ *
+ * @param prefix Caminho das projeções sem o índice, ex. "20250904/img"
+ * @param num Número de projeções, índices 1 a num
+ * @param kernel Kernel com offset e ganho já calculados
+ * @return Número de projeções corrigidas
+ */
+int correctScan(const string &prefix, int num, XCorrectKernel &kernel)
+{
+	XCorrectBatch batch;
+	if (!batch.Open(&kernel, 0))
+		return 0;
+
+	std::vector<XRawMap *> maps;
+	std::vector<XImage *> images;
+	for (int i = 1; i <= num; i++)
+	{
+		string src_file = prefix + std::to_string(i) + ".dat";
+		string dst_file = prefix + std::to_string(i) + "_cor.dat";
+		XRawInfo info;
+		if (!XReadRawInfo(src_file.c_str(), info) ||
+			!CopyFileA(src_file.c_str(), dst_file.c_str(), FALSE) ||
+			!XCopyRawInfo(src_file.c_str(), dst_file.c_str()))
+		{
+			cout << "Falha ao copiar " << src_file << endl;
+			continue;
+		}
+
+		XRawMap *map = new XRawMap;
+		if (!map->Open(dst_file.c_str(), XMAP_WRITE))
+		{
+			cout << "Falha ao abrir " << dst_file << endl;
+			delete map;
+			continue;
+		}
+		maps.push_back(map);
+		images.insert(images.end(), map->GetImages()->begin(), map->GetImages()->end());
+	}
+
+	auto inicio = std::chrono::steady_clock::now();
+	bool is_ok = batch.DoCorrect(&images);
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - inicio).count();
+	if (is_ok)
+		cout << images.size() << " quadros corrigidos em " << ms << " ms com " << batch.GetThreadNum() << " threads" << endl;
+	else
+		cout << "Falha ao corrigir a tomografia (geometria diferente da calibração?)" << endl;
+
+	// Fechar o mapeamento grava os quadros corrigidos nos arquivos
+	for (size_t i = 0; i < maps.size(); i++)
+		delete maps[i];
+	return is_ok ? (int)maps.size() : 0;
+}
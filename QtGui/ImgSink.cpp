@@ -95,7 +95,7 @@ void ImgSink::OnFrameReady(XImage *image_)
 	// Obtém estado atual da captura
 	uint32_t lost_frame_count = this->parent_->get_lost_frame_count();
 	bool is_save = this->parent_->get_is_save();
-	XImageHandler *ximg_handle = this->parent_->get_ximage_handler();
+	XAsyncWriter *ximg_writer = this->parent_->get_ximage_writer();
 
 	// Log de informações do frame para debug
 	std::cout << "Frame ready" << std::endl;
@@ -103,10 +103,10 @@ void ImgSink::OnFrameReady(XImage *image_)
 	std::cout << "Height: " << image_->_height << std::endl;
 	std::cout << "Lost line: " << lost_frame_count << std::endl;
 
-	// Salva o frame em disco se solicitado
+	// Enfileira uma cópia do frame para a thread de gravação
 	if (is_save)
 	{
-		ximg_handle->Write(image_);
+		ximg_writer->Write(image_);
 	}
 }
 
@@ -138,6 +138,10 @@ void ImgSink::OnFrameComplete()
 	// Finaliza salvamento se estava ativo
 	if (is_save)
 	{
+		// Espera a fila de gravação esvaziar
+		if (!this->parent_->get_ximage_writer()->Flush())
+			std::cout << "Falha ao gravar quadros em " << save_file_name << std::endl;
+
 		// Gera nome do arquivo .txt substituindo extensão
 		std::string txt_name = save_file_name.replace(save_file_name.find(".dat"), 4, ".txt");
 
@@ -87,6 +87,9 @@ QtGui::QtGui(QWidget *parent)
 {
 	ui.setupUi(this);
 
+	// Quadros são gravados por uma thread de E/S, fora do OnFrameReady
+	ximg_writer.Open(&ximg_handle);
+
 	// ========================================================================
 	// CONEXÃO DE SINAIS E SLOTS (EVENTOS E MANIPULADORES)
 	// ========================================================================
@@ -557,6 +560,11 @@ XImageHandler *QtGui::get_ximage_handler()
 	return &ximg_handle;
 }
 
+XAsyncWriter *QtGui::get_ximage_writer()
+{
+	return &ximg_writer;
+}
+
 XEvent *QtGui::get_xevent()
 {
 	return &this->xevent;
@@ -7,6 +7,7 @@
 #include "CmdSink.h"
 #include "ImgSink.h"
 #include "ximage_handler.h"
+#include "xasync_writer.h"
 #include "xsystem.h"
 #include "xdevice.h"
 #include "xcommand.h"
@@ -27,6 +28,7 @@ public:
     bool get_is_save();
     std::string get_save_file_name();
     XImageHandler* get_ximage_handler();
+    XAsyncWriter* get_ximage_writer();
     XEvent* get_xevent();
     void set_frame_count(uint32_t);
     void set_lost_frame_count(uint32_t);
@@ -54,6 +56,7 @@ private:
     CmdSink* cmd_sink;
 	ImgSink* img_sink;
     XImageHandler ximg_handle;
+    XAsyncWriter ximg_writer; // Fila de gravação em thread de E/S
 	XEvent xevent;
     XGigFactory xfactory;
     XSystem* xsystem;
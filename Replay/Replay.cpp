@@ -0,0 +1,178 @@
+/**
+ * @file Replay.cpp
+ * @brief Reenvio de capturas .pcapng/.pcap para o X-LIB local (Linux)
+ *
+ * Lê a captura sem libpcap e reenvia os payloads UDP a partir de
+ * 127.0.0.2 para as portas originais em 127.0.0.1, onde XUDPCmdEngine e
+ * XUDPImgEngine escutam. Permite reproduzir a temporização de campo e
+ * medir a vazão do parser com tráfego real.
+ *
+ * Compilação:
+ *   g++ -std=c++11 -O2 -pthread -I../include Replay.cpp -o xreplay
+ *
+ * Exemplos:
+ *   ./xreplay ../network/findDevices_imgCmdChannel.pcapng              (tempo original)
+ *   ./xreplay --speed 10 --loops 0 --src-ip 192.168.1.2 captura.pcapng  (10x, sem fim)
+ *   ./xreplay --speed 0 --duration 3600 --port 4001 captura.pcapng      (taxa máxima, 1 h)
+ */
+
+#include "xpcap_replay.h" // Leitura e reenvio de capturas
+
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+static XPcapReplay replay;
+static volatile sig_atomic_t is_exit = 0;
+
+static void onSignal(int)
+{
+	is_exit = 1;
+	replay.Stop();
+}
+
+static void printUsage(const char *name)
+{
+	printf("Uso: %s [opções] captura.pcapng\n"
+		   "  --speed F         1 = tempo original, 2, 10 = mais rápido, 0 = taxa máxima (padrão 1)\n"
+		   "  --loops N         repetições da captura, 0 = até Ctrl+C (padrão 1)\n"
+		   "  --duration S      para após S segundos\n"
+		   "  --src-ip IP       só pacotes enviados por este IP na captura (ex. o detector)\n"
+		   "  --port N          só pacotes para esta porta (ex. 4001 imagem, 3000 comando)\n"
+		   "  --source-ip IP    origem do reenvio (padrão %s)\n"
+		   "  --target-ip IP    destino do reenvio (padrão %s)\n",
+		   name, XREPLAY_SOURCE_IP, XREPLAY_TARGET_IP);
+}
+
+int main(int argc, char **argv)
+{
+	double speed = 1;
+	uint32_t loop_num = 1;
+	uint32_t duration = 0;
+	uint32_t src_ip = 0;
+	uint16_t port = 0;
+	const char *source_ip = XREPLAY_SOURCE_IP;
+	const char *target_ip = XREPLAY_TARGET_IP;
+
+	static const struct option options[] = {
+		{"speed", required_argument, NULL, 's'},
+		{"loops", required_argument, NULL, 'l'},
+		{"duration", required_argument, NULL, 'd'},
+		{"src-ip", required_argument, NULL, 'c'},
+		{"port", required_argument, NULL, 'p'},
+		{"source-ip", required_argument, NULL, 'o'},
+		{"target-ip", required_argument, NULL, 't'},
+		{"help", no_argument, NULL, '?'},
+		{NULL, 0, NULL, 0}};
+
+	int opt;
+	in_addr addr;
+	while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1)
+	{
+		switch (opt)
+		{
+		case 's':
+			speed = atof(optarg);
+			break;
+		case 'l':
+			loop_num = (uint32_t)atoi(optarg);
+			break;
+		case 'd':
+			duration = (uint32_t)atoi(optarg);
+			break;
+		case 'c':
+			if (1 != inet_pton(AF_INET, optarg, &addr))
+			{
+				printUsage(argv[0]);
+				return 1;
+			}
+			src_ip = ntohl(addr.s_addr);
+			break;
+		case 'p':
+			port = (uint16_t)atoi(optarg);
+			break;
+		case 'o':
+			source_ip = optarg;
+			break;
+		case 't':
+			target_ip = optarg;
+			break;
+		default:
+			printUsage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind >= argc)
+	{
+		printUsage(argv[0]);
+		return 1;
+	}
+
+	XPcapFile capture;
+	if (!capture.Open(argv[optind]))
+	{
+		printf("Falha ao ler a captura %s\n", argv[optind]);
+		return 1;
+	}
+
+	if (!replay.Open(&capture, src_ip, port, source_ip, target_ip))
+	{
+		printf("Nenhum pacote UDP para reenviar, ou endereços inválidos\n");
+		return 1;
+	}
+
+	printf("%u de %u pacotes UDP, %.3f s por volta\n", replay.GetPacketNum(),
+		   capture.GetPacketNum(), capture.GetDuration() / 1e9);
+
+	signal(SIGINT, onSignal);
+	signal(SIGTERM, onSignal);
+
+	// O reenvio roda em outra thread, esta mostra as estatísticas
+	std::atomic<bool> is_done(false);
+	std::thread run_thread([&]() { replay.Run(speed, loop_num); is_done = true; });
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	XReplayStats last;
+	memset(&last, 0, sizeof(last));
+	while (!is_exit && !is_done)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		if (duration && seconds >= duration)
+		{
+			replay.Stop();
+		}
+
+		XReplayStats stats;
+		replay.GetStats(stats);
+		if (stats._packets / 10000 != last._packets / 10000 || stats._loops != last._loops)
+		{
+			printf("voltas %llu pacotes %llu %.1f MB/s atrasados %llu (máx %.1f us)\n",
+				   (unsigned long long)stats._loops, (unsigned long long)stats._packets,
+				   stats._bytes / seconds / (1024.0 * 1024.0), (unsigned long long)stats._late,
+				   stats._max_late_ns / 1000.0);
+			last = stats;
+		}
+	}
+
+	replay.Stop();
+	run_thread.join();
+
+	XReplayStats stats;
+	replay.GetStats(stats);
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	printf("Total: %llu voltas, %llu pacotes, %llu bytes em %.2f s (%.0f pacotes/s), "
+		   "atrasados %llu, máx %.1f us\n",
+		   (unsigned long long)stats._loops, (unsigned long long)stats._packets,
+		   (unsigned long long)stats._bytes, seconds, stats._packets / seconds,
+		   (unsigned long long)stats._late, stats._max_late_ns / 1000.0);
+
+	return 0;
+}
@@ -0,0 +1,173 @@
+/**
+ * @file Simulator.cpp
+ * @brief Simulador do detector X-Panel 1412i na interface de loopback (Linux)
+ *
+ * Responde à descoberta por broadcast, ao canal de comando e transmite
+ * quadros pelo protocolo UDP de imagem, permitindo testar XSystem,
+ * XCommand, XAcquisition e os parsers de imagem sem o detector.
+ * Perda, reordenação e duplicação de pacotes podem ser injetadas.
+ *
+ * Compilação:
+ *   g++ -std=c++11 -O2 -pthread -I../include Simulator.cpp -o xsim
+ *
+ * Exemplo (detector em 127.0.0.2, quadros para 127.0.0.1:4001):
+ *   ./xsim --fps 30 --loss 0.001 --reorder 0.01
+ */
+
+#include "xdevice_sim.h" // Simulador do detector
+
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+
+static volatile sig_atomic_t is_exit = 0;
+
+static void onSignal(int)
+{
+	is_exit = 1;
+}
+
+static void printUsage(const char *name)
+{
+	printf("Uso: %s [opções]\n"
+		   "  --device-ip IP    endereço do detector simulado (padrão %s)\n"
+		   "  --host-ip IP      destino das imagens (padrão: quem enviar comandos)\n"
+		   "  --img-port N      porta de imagem do host (padrão %u)\n"
+		   "  --width N         colunas (padrão 1400)\n"
+		   "  --height N        linhas (padrão 1200)\n"
+		   "  --depth N         bits por pixel (padrão 16)\n"
+		   "  --payload N       bytes de imagem por pacote (padrão %u)\n"
+		   "  --fps F           quadros por segundo, 0 = sem limite (padrão 10)\n"
+		   "  --frames N        quadros por aquisição, 0 = contínuo\n"
+		   "  --loss P          probabilidade de perda por pacote\n"
+		   "  --reorder P       probabilidade de troca com o pacote seguinte\n"
+		   "  --dup P           probabilidade de duplicação\n"
+		   "  --seed N          semente das falhas injetadas\n"
+		   "  --auto            transmite sem esperar o comando de aquisição\n",
+		   name, XSIM_DEVICE_IP, XSIM_IMG_PORT, XSIM_PAYLOAD_SIZE);
+}
+
+int main(int argc, char **argv)
+{
+	XSimConfig config;
+	XInitSimConfig(config);
+
+	static const struct option options[] = {
+		{"device-ip", required_argument, NULL, 'd'},
+		{"host-ip", required_argument, NULL, 'H'},
+		{"img-port", required_argument, NULL, 'i'},
+		{"width", required_argument, NULL, 'w'},
+		{"height", required_argument, NULL, 'h'},
+		{"depth", required_argument, NULL, 'b'},
+		{"payload", required_argument, NULL, 'p'},
+		{"fps", required_argument, NULL, 'f'},
+		{"frames", required_argument, NULL, 'n'},
+		{"loss", required_argument, NULL, 'l'},
+		{"reorder", required_argument, NULL, 'r'},
+		{"dup", required_argument, NULL, 'u'},
+		{"seed", required_argument, NULL, 's'},
+		{"auto", no_argument, NULL, 'a'},
+		{"help", no_argument, NULL, '?'},
+		{NULL, 0, NULL, 0}};
+
+	int opt;
+	while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1)
+	{
+		switch (opt)
+		{
+		case 'd':
+			snprintf(config._device_ip, sizeof(config._device_ip), "%s", optarg);
+			break;
+		case 'H':
+			snprintf(config._host_ip, sizeof(config._host_ip), "%s", optarg);
+			break;
+		case 'i':
+			config._img_port = (uint16_t)atoi(optarg);
+			break;
+		case 'w':
+			config._width = (uint32_t)atoi(optarg);
+			break;
+		case 'h':
+			config._height = (uint32_t)atoi(optarg);
+			break;
+		case 'b':
+			config._pixel_depth = (uint32_t)atoi(optarg);
+			break;
+		case 'p':
+			config._payload_size = (uint32_t)atoi(optarg);
+			break;
+		case 'f':
+			config._frame_rate = atof(optarg);
+			break;
+		case 'n':
+			config._frame_num = (uint32_t)atoi(optarg);
+			break;
+		case 'l':
+			config._loss = atof(optarg);
+			break;
+		case 'r':
+			config._reorder = atof(optarg);
+			break;
+		case 'u':
+			config._duplicate = atof(optarg);
+			break;
+		case 's':
+			config._seed = (uint32_t)atoi(optarg);
+			break;
+		case 'a':
+			config._is_auto_start = 1;
+			break;
+		default:
+			printUsage(argv[0]);
+			return 1;
+		}
+	}
+
+	// Sem host fixo a transmissão automática vai para o loopback
+	if (config._is_auto_start && !config._host_ip[0])
+	{
+		strcpy(config._host_ip, "127.0.0.1");
+	}
+
+	XDeviceSim sim;
+	if (!sim.Open(config))
+	{
+		printf("Falha ao abrir o simulador: %s\n", strerror(sim.GetLastError()));
+		return 1;
+	}
+
+	signal(SIGINT, onSignal);
+	signal(SIGTERM, onSignal);
+
+	printf("Detector simulado em %s (comando %u, broadcast %u), %ux%u %u bits\n",
+		   config._device_ip, config._cmd_port, config._broad_port,
+		   config._width, config._height, config._pixel_depth);
+
+	// Estatísticas a cada segundo até Ctrl+C
+	XSimStats last;
+	memset(&last, 0, sizeof(last));
+	while (!is_exit)
+	{
+		std::this_thread::sleep_for(std::chrono::seconds(1));
+
+		XSimStats stats;
+		sim.GetStats(stats);
+		printf("quadros %llu (%llu/s) %.1f MB/s pacotes %llu perdidos %llu reordenados %llu "
+			   "duplicados %llu comandos %llu inválidos %llu\n",
+			   (unsigned long long)stats._frames,
+			   (unsigned long long)(stats._frames - last._frames),
+			   (stats._bytes - last._bytes) / (1024.0 * 1024.0),
+			   (unsigned long long)stats._packets, (unsigned long long)stats._lost,
+			   (unsigned long long)stats._reordered, (unsigned long long)stats._duplicated,
+			   (unsigned long long)stats._commands, (unsigned long long)stats._bad_commands);
+		last = stats;
+	}
+
+	sim.Close();
+
+	return 0;
+}
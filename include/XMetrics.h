@@ -3,6 +3,9 @@
 #include <vector>
 #include <utility>
 #include <ctime>
+#include <chrono>
+#include <atomic>
+#include <memory>
 
 using namespace std;
 
@@ -39,3 +42,221 @@ public:
 	vector< pair <time_t, XHeader* >> FrameLines;
 };
 
+
+
+/*
+	Compact record of one received line, as exposed by XMetricsRing.
+*/
+struct XLineRecord
+{
+	uint16_t LineId;
+	uint8_t PacketId;
+	uint32_t LineStamp;
+	uint64_t TimeNs;
+};
+
+/*
+	Copy of the metrics of one frame, filled by XMetricsRing::GetFrame().
+	Reuse one object per reader: Lines keeps its capacity, so reading does
+	not allocate once it has grown to the line count of a frame.
+*/
+struct XFrameMetrics
+{
+	uint32_t Sequence;
+	uint16_t FrameId;
+	uint32_t HeaderStamp;
+	uint64_t HeaderTimeNs;
+	uint32_t LineNum;
+	uint32_t Overflow;		//Lines beyond the per-frame capacity, not stored
+	vector<XLineRecord> Lines;
+
+	XLineRecord GetLine(uint32_t i) const
+	{
+		return Lines[i];
+	}
+};
+
+/*
+	Allocation-free replacement for XMetrics. All storage is allocated once
+	by Open(): frame_num frame slots of line_num line records each. The parse
+	thread fills the current slot with PutFrameHeader()/PutFrameLines() and
+	publishes it with PushMetrics(), nothing is allocated or freed per line.
+	Any thread reads published frames with GetFrame().
+	Each slot is a seqlock: its Sequence is 0 while the writer fills it and
+	the frame sequence number once published. A reader copies the slot and
+	checks Sequence again afterwards, so a slot the writer wrapped around to
+	meanwhile is reported as lost instead of returned torn. The fields are
+	relaxed atomics, plain loads and stores on x86.
+*/
+class XMetricsRing
+{
+public:
+	XMetricsRing()
+		: _frame_num(0)
+		, _line_num(0)
+		, _cur(0)
+		, _sequence(0)
+	{
+		_published.store(0);
+	};
+	~XMetricsRing()
+	{
+		Close();
+	}
+
+	bool Open(uint32_t line_num, uint32_t frame_num = XFRAME_NUM)
+	{
+		//One slot is always being filled, so keep at least one readable
+		if (0 == line_num || frame_num < 2)
+			return false;
+		Close();
+		size_t total = (size_t)line_num * frame_num;
+		_lines.reset(new atomic<uint64_t>[total]);
+		_times.reset(new atomic<uint64_t>[total]);
+		_frames.reset(new FrameSlot[frame_num]);
+		_frame_num = frame_num;
+		_line_num = line_num;
+		Reset();
+		return true;
+	}
+	void Close()
+	{
+		_lines.reset();
+		_times.reset();
+		_frames.reset();
+		_frame_num = 0;
+		_line_num = 0;
+	}
+	/*
+		Only call when neither side is running.
+	*/
+	void Reset()
+	{
+		_cur = 0;
+		_sequence = 0;
+		_published.store(0);
+		for (uint32_t i = 0; i < _frame_num; ++i)
+			_frames[i].Sequence.store(0);
+	}
+	static uint64_t Now()
+	{
+		return (uint64_t)chrono::duration_cast<chrono::nanoseconds>(
+			chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	//Writer side, parse thread only
+	void PutFrameHeader(uint64_t time_ns, const XHeader* header_)
+	{
+		if (0 == _frame_num)
+			return;
+		FrameSlot& slot = _frames[_cur];
+		slot.Sequence.store(0, memory_order_relaxed);
+		//Readers which see a field below also see Sequence 0
+		atomic_thread_fence(memory_order_release);
+		slot.FrameId.store(header_->_frame_id, memory_order_relaxed);
+		slot.HeaderStamp.store(header_->_line_stamp, memory_order_relaxed);
+		slot.HeaderTimeNs.store(time_ns, memory_order_relaxed);
+		slot.LineNum.store(0, memory_order_relaxed);
+		slot.Overflow.store(0, memory_order_relaxed);
+	}
+	void PutFrameLines(uint64_t time_ns, const XHeader* header_)
+	{
+		if (0 == _frame_num)
+			return;
+		FrameSlot& slot = _frames[_cur];
+		uint32_t num = slot.LineNum.load(memory_order_relaxed);
+		if (num >= _line_num)
+		{
+			slot.Overflow.store(slot.Overflow.load(memory_order_relaxed) + 1, memory_order_relaxed);
+			return;
+		}
+		size_t pos = (size_t)_cur * _line_num + num;
+		_lines[pos].store(PackLine(header_), memory_order_relaxed);
+		_times[pos].store(time_ns, memory_order_relaxed);
+		slot.LineNum.store(num + 1, memory_order_relaxed);
+	}
+	void PushMetrics()
+	{
+		if (0 == _frame_num)
+			return;
+		_frames[_cur].Sequence.store(++_sequence, memory_order_release);
+		_cur = (_cur + 1) % _frame_num;
+		_published.store(_sequence, memory_order_release);
+	}
+
+	//Reader side, any thread
+	uint32_t GetPublished() const
+	{
+		return _published.load(memory_order_acquire);
+	}
+	/*
+		Copy the metrics of published frame sequence number seq (1 based).
+		Fails if it is not published yet or its slot has been reused.
+	*/
+	bool GetFrame(uint32_t seq, XFrameMetrics& metrics) const
+	{
+		uint32_t published = GetPublished();
+		if (0 == seq || seq > published || published - seq >= _frame_num - 1)
+			return false;
+		uint32_t index = (seq - 1) % _frame_num;
+		const FrameSlot& slot = _frames[index];
+		if (slot.Sequence.load(memory_order_acquire) != seq)
+			return false;
+		metrics.Sequence = seq;
+		metrics.FrameId = slot.FrameId.load(memory_order_relaxed);
+		metrics.HeaderStamp = slot.HeaderStamp.load(memory_order_relaxed);
+		metrics.HeaderTimeNs = slot.HeaderTimeNs.load(memory_order_relaxed);
+		metrics.LineNum = slot.LineNum.load(memory_order_relaxed);
+		metrics.Overflow = slot.Overflow.load(memory_order_relaxed);
+		if (metrics.LineNum > _line_num)
+			metrics.LineNum = _line_num;
+		metrics.Lines.resize(metrics.LineNum);
+		size_t pos = (size_t)index * _line_num;
+		for (uint32_t i = 0; i < metrics.LineNum; ++i)
+		{
+			uint64_t line = _lines[pos + i].load(memory_order_relaxed);
+			XLineRecord& record = metrics.Lines[i];
+			record.LineId = (uint16_t)(line >> 40);
+			record.PacketId = (uint8_t)(line >> 32);
+			record.LineStamp = (uint32_t)line;
+			record.TimeNs = _times[pos + i].load(memory_order_relaxed);
+		}
+		//The copy only counts if the writer did not start on the slot
+		atomic_thread_fence(memory_order_acquire);
+		return slot.Sequence.load(memory_order_relaxed) == seq;
+	}
+	bool GetLastFrame(XFrameMetrics& metrics) const
+	{
+		return GetFrame(GetPublished(), metrics);
+	}
+
+private:
+	XMetricsRing(const XMetricsRing&);
+	XMetricsRing& operator = (const XMetricsRing&);
+
+	struct FrameSlot
+	{
+		atomic<uint32_t> Sequence;
+		atomic<uint16_t> FrameId;
+		atomic<uint32_t> HeaderStamp;
+		atomic<uint64_t> HeaderTimeNs;
+		atomic<uint32_t> LineNum;
+		atomic<uint32_t> Overflow;
+	};
+
+	//LineId, PacketId and LineStamp in one word, so a line is one store
+	static uint64_t PackLine(const XHeader* header_)
+	{
+		return ((uint64_t)header_->_line_id << 40) | ((uint64_t)header_->_packet_id << 32)
+			| header_->_line_stamp;
+	}
+
+	uint32_t _frame_num;
+	uint32_t _line_num;
+	uint32_t _cur;
+	uint32_t _sequence;
+	atomic<uint32_t> _published;
+	unique_ptr<atomic<uint64_t>[]> _lines;
+	unique_ptr<atomic<uint64_t>[]> _times;
+	unique_ptr<FrameSlot[]> _frames;
+};
@@ -0,0 +1,374 @@
+/*
+  Copyright (c), Detection Technology Inc.
+  All right reserved.
+
+ */
+
+#ifndef XASYNC_WRITER_H
+#define XASYNC_WRITER_H
+#include "xconfigure.h"
+#include "ximage.h"
+#include "ximage_handler.h"
+#include "xcrc_file.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+//What XAsyncWriter::Write() does when every buffer is queued
+#define XWRITE_BLOCK      0   //Wait for the I/O thread to free a buffer
+#define XWRITE_DROP       1   //Drop the frame and count it
+#define XWRITE_SPILL      2   //Take an extra heap buffer, up to spill_num
+
+#define XWRITE_BUF_NUM    8
+
+/*
+  Counters of XAsyncWriter. Throughput is bytes written per second spent
+  inside XImageHandler::Write(). Frames the handler failed to write count
+  in _failed only, not in _written, _bytes or the checksums.
+ */
+struct XWriteStats
+{
+     uint64_t _queued;
+     uint64_t _written;
+     uint64_t _failed;
+     uint64_t _dropped;
+     uint64_t _spilled;
+     uint64_t _bytes;
+     uint32_t _depth;
+     uint32_t _max_depth;
+     double   _write_seconds;
+};
+
+/*
+  XAsyncWriter moves the file write out of IXImgSink::OnFrameReady().
+  Write() copies the frame into one of a fixed set of preallocated buffers
+  and queues it, a dedicated I/O thread then hands the copies to
+  XImageHandler::Write() in order. A slow disk only fills the queue instead
+  of stalling the transfer thread.
+  Call Flush() before XImageHandler::SaveHeaderFile() / CloseFile(), it
+  returns once every queued frame is on disk, 0 if any of them could not
+  be written.
+  With SetChecksum() the I/O thread also computes the CRC of each frame and
+  of the file after writing it, TakeChecksum() hands them over for
+  XWriteCrcFile().
+ */
+class XAsyncWriter
+{
+public:
+     XAsyncWriter()
+          :_handler_(NULL)
+          ,_policy(XWRITE_BLOCK)
+          ,_buf_num(0)
+          ,_spill_num(0)
+          ,_spill_used(0)
+          ,_frame_size(0)
+          ,_is_writing(0)
+          ,_is_stop(0)
+          ,_is_checksum(0)
+          ,_flush_failed(0)
+          ,_file_crc(XCRC32_KEY)
+     {
+          memset(&_stats, 0, sizeof(_stats));
+          XClearCrcInfo(_crc_info);
+     }
+     ~XAsyncWriter()
+     {
+          Close();
+     }
+
+     /*
+       spill_num is the most extra buffers XWRITE_SPILL may hold at once.
+      */
+     bool Open(XImageHandler* handler_, uint32_t buf_num = XWRITE_BUF_NUM,
+               uint32_t policy = XWRITE_BLOCK, uint32_t spill_num = XWRITE_BUF_NUM)
+     {
+          Close();
+          if(!handler_ || 0 == buf_num)
+               return 0;
+          _handler_ = handler_;
+          _buf_num = buf_num;
+          _policy = policy;
+          _spill_num = spill_num;
+          _is_stop = 0;
+          _flush_failed = 0;
+          memset(&_stats, 0, sizeof(_stats));
+          XClearCrcInfo(_crc_info);
+          _file_crc.Done();
+          _thread = std::thread(&XAsyncWriter::WriteProc, this);
+          return 1;
+     }
+     /*
+       Write out every queued frame and stop the I/O thread.
+      */
+     void Close()
+     {
+          if(!_thread.joinable())
+               return;
+          Flush();
+          {
+               std::lock_guard<std::mutex> lock(_mutex);
+               _is_stop = 1;
+          }
+          _queue_cond.notify_all();
+          _thread.join();
+          FreeBuffers();
+          _handler_ = NULL;
+     }
+     void SetPolicy(uint32_t policy)
+     {
+          std::lock_guard<std::mutex> lock(_mutex);
+          _policy = policy;
+     }
+     /*
+       Compute the CRCs of the frames written from now on.
+      */
+     void SetChecksum(bool is_checksum)
+     {
+          std::lock_guard<std::mutex> lock(_mutex);
+          _is_checksum = is_checksum;
+     }
+     /*
+       Wait for the queue like Flush(), then move the CRCs of the frames
+       written since the last call into info and start over, call it once
+       per file.
+      */
+     void TakeChecksum(XCrcInfo& info)
+     {
+          std::unique_lock<std::mutex> lock(_mutex);
+          while(!_queue.empty() || _is_writing)
+               _free_cond.wait(lock);
+          info = _crc_info;
+          info._crc = _file_crc.Done();
+          XClearCrcInfo(_crc_info);
+     }
+     /*
+       Queue a copy of image_. Return 0 if the frame was dropped.
+      */
+     bool Write(XImage* image_)
+     {
+          if(!_handler_ || !image_ || !image_->_data_)
+               return 0;
+          size_t size = GetImageSize(image_);
+          std::unique_lock<std::mutex> lock(_mutex);
+          //The buffers follow the frame size, resize once the queue is idle
+          if(size != _frame_size)
+          {
+               while(!_queue.empty() || _is_writing)
+                    _free_cond.wait(lock);
+               FreeBuffers();
+               for(uint32_t i = 0; i < _buf_num; i++)
+               {
+                    XImage* buf_ = AllocBuffer(size);
+                    if(!buf_)
+                    {
+                         FreeBuffers();
+                         return 0;
+                    }
+                    _free.push_back(buf_);
+               }
+               _frame_size = size;
+          }
+          XImage* buf_ = NULL;
+          if(_free.empty())
+          {
+               if(XWRITE_DROP == _policy)
+               {
+                    _stats._dropped++;
+                    return 0;
+               }
+               if(XWRITE_SPILL == _policy && _spill_used < _spill_num)
+               {
+                    buf_ = AllocBuffer(size);
+                    if(buf_)
+                    {
+                         _spills.push_back(buf_);
+                         _spill_used++;
+                         _stats._spilled++;
+                    }
+               }
+               while(!buf_ && _free.empty())
+                    _free_cond.wait(lock);
+          }
+          if(!buf_)
+          {
+               buf_ = _free.back();
+               _free.pop_back();
+          }
+          //The copy runs unlocked, the buffer belongs to this thread now
+          lock.unlock();
+          buf_->_width = image_->_width;
+          buf_->_height = image_->_height;
+          buf_->_pixel_depth = image_->_pixel_depth;
+          buf_->_data_offset = image_->_data_offset;
+          buf_->_device_ = image_->_device_;
+          buf_->_size = size;
+          memcpy(buf_->_data_, image_->_data_, size);
+          lock.lock();
+          _queue.push_back(buf_);
+          _stats._queued++;
+          _stats._depth = (uint32_t)_queue.size();
+          if(_stats._depth > _stats._max_depth)
+               _stats._max_depth = _stats._depth;
+          lock.unlock();
+          _queue_cond.notify_one();
+          return 1;
+     }
+     /*
+       Wait until every queued frame has been written. Return 0 if a frame
+       failed to be written since the last Flush(), GetStats() has the count.
+      */
+     bool Flush()
+     {
+          std::unique_lock<std::mutex> lock(_mutex);
+          while(!_queue.empty() || _is_writing)
+               _free_cond.wait(lock);
+          bool ret = (_stats._failed == _flush_failed);
+          _flush_failed = _stats._failed;
+          return ret;
+     }
+     uint32_t GetQueueDepth()
+     {
+          std::lock_guard<std::mutex> lock(_mutex);
+          return (uint32_t)_queue.size();
+     }
+     void GetStats(XWriteStats& stats)
+     {
+          std::lock_guard<std::mutex> lock(_mutex);
+          stats = _stats;
+          stats._depth = (uint32_t)_queue.size();
+     }
+     /*
+       Write throughput in MB/s.
+      */
+     double GetThroughput()
+     {
+          std::lock_guard<std::mutex> lock(_mutex);
+          if(_stats._write_seconds <= 0)
+               return 0;
+          return _stats._bytes / _stats._write_seconds / (1024.0 * 1024.0);
+     }
+
+private:
+     XAsyncWriter(const XAsyncWriter&);
+     XAsyncWriter& operator = (const XAsyncWriter&);
+
+     static size_t GetImageSize(XImage* image_)
+     {
+          uint32_t pixel_byte = (image_->_pixel_depth > 16) ? 4 : 2;
+          return ((size_t)image_->_width * pixel_byte + image_->_data_offset)
+               * image_->_height;
+     }
+     static XImage* AllocBuffer(size_t size)
+     {
+          uint8_t* data_ = (uint8_t*)_aligned_malloc(
+               (size + SSE_ALIGN_BYTE - 1) & ~((size_t)SSE_ALIGN_BYTE - 1),
+               SSE_ALIGN_BYTE);
+          if(!data_)
+               return NULL;
+          XImage* image_ = new XImage;
+          image_->_data_ = data_;
+          return image_;
+     }
+     static void DeleteBuffer(XImage* image_)
+     {
+          _aligned_free(image_->_data_);
+          image_->_data_ = NULL;
+          delete image_;
+     }
+     void FreeBuffers()
+     {
+          for(size_t i = 0; i < _free.size(); i++)
+               DeleteBuffer(_free[i]);
+          _free.clear();
+          _frame_size = 0;
+     }
+     void WriteProc()
+     {
+          std::unique_lock<std::mutex> lock(_mutex);
+          while(1)
+          {
+               while(!_is_stop && _queue.empty())
+                    _queue_cond.wait(lock);
+               if(_queue.empty())
+                    return;
+               XImage* buf_ = _queue.front();
+               _queue.pop_front();
+               _is_writing = 1;
+               bool is_checksum = _is_checksum;
+               lock.unlock();
+
+               std::chrono::steady_clock::time_point start =
+                    std::chrono::steady_clock::now();
+               bool is_written = _handler_->Write(buf_);
+               double seconds = std::chrono::duration<double>(
+                    std::chrono::steady_clock::now() - start).count();
+               //Off the acquisition path, the frame is still in the cache.
+               //A frame that is not on disk must not be in the .crc file
+               uint32_t frame_crc = 0;
+               is_checksum = is_checksum && is_written;
+               if(is_checksum)
+               {
+                    XFastCrc crc(XCRC32_KEY);
+                    XImageCrc(buf_, crc);
+                    frame_crc = crc.Done();
+                    XImageCrc(buf_, _file_crc);
+               }
+
+               lock.lock();
+               if(is_checksum)
+               {
+                    _crc_info._frame_size = (uint64_t)buf_->_width * buf_->_height
+                         * ((buf_->_pixel_depth > 16) ? 4 : 2);
+                    _crc_info._size += _crc_info._frame_size;
+                    _crc_info._frame_crcs.push_back(frame_crc);
+               }
+               _is_writing = 0;
+               if(is_written)
+               {
+                    _stats._written++;
+                    _stats._bytes += buf_->_size;
+                    _stats._write_seconds += seconds;
+               }
+               else
+                    _stats._failed++;
+               std::vector<XImage*>::iterator spill =
+                    std::find(_spills.begin(), _spills.end(), buf_);
+               if(spill != _spills.end())
+               {
+                    _spills.erase(spill);
+                    DeleteBuffer(buf_);
+                    _spill_used--;
+               }
+               else
+                    _free.push_back(buf_);
+               _free_cond.notify_all();
+          }
+     }
+
+     XImageHandler* _handler_;
+     uint32_t _policy;
+     uint32_t _buf_num;
+     uint32_t _spill_num;
+     uint32_t _spill_used;
+     size_t   _frame_size;
+     bool     _is_writing;
+     bool     _is_stop;
+     bool     _is_checksum;
+     uint64_t _flush_failed;                  //_stats._failed at the last Flush()
+     std::vector<XImage*> _free;
+     std::vector<XImage*> _spills;          //Extra XWRITE_SPILL buffers
+     std::deque<XImage*>  _queue;
+     std::mutex _mutex;
+     std::condition_variable _queue_cond;     //Frame queued or stop
+     std::condition_variable _free_cond;      //Buffer freed or queue drained
+     std::thread _thread;
+     XWriteStats _stats;
+     XFastCrc _file_crc;                      //Only used by the I/O thread
+     XCrcInfo _crc_info;
+};
+#endif //XASYNC_WRITER_H
@@ -0,0 +1,944 @@
+/*
+  Copyright (c), Detection Technology Inc.
+  All right reserved.
+
+ */
+
+#ifndef XBENCH_H
+#define XBENCH_H
+#include "xconfigure.h"
+#include "iximg_sink.h"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#ifdef __linux__
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include "xudp_mmsg.h"
+#include "xpacket_ring.h"
+#include "xline_place.h"
+#include "xframe_lease.h"
+#include "XMetrics.h"
+#include "xtrace.h"
+#endif
+
+//Latency stages of one acquisition
+#define XBENCH_STAGE_POOL      0   //Packet received -> taken from the packet pool by the parser
+#define XBENCH_STAGE_PARSE     1   //Packet taken -> payload placed in the frame
+#define XBENCH_STAGE_TRANSFER  2   //Frame complete -> handed to the sink
+#define XBENCH_STAGE_SINK      3   //Time spent in OnFrameReady()
+#define XBENCH_STAGE_TOTAL     4   //Last packet of the frame received -> sink returned
+#define XBENCH_STAGE_WIRE      5   //Frame header received -> last packet received
+#define XBENCH_STAGE_NUM       6
+
+//Threads whose CPU time is measured, the sink runs on the transfer thread
+#define XBENCH_THREAD_ENGINE   0
+#define XBENCH_THREAD_PARSE    1
+#define XBENCH_THREAD_TRANSFER 2
+#define XBENCH_THREAD_NUM      3
+
+#define XBENCH_MAX_SAMPLES     (1 << 22)   //Kept per stage for the percentiles
+#define XBENCH_WAIT_TIME       10          //Thread wait for input, ms
+
+inline const char* XBenchStageName(uint32_t stage)
+{
+     switch(stage)
+     {
+     case XBENCH_STAGE_POOL:     return "pool";
+     case XBENCH_STAGE_PARSE:    return "parse";
+     case XBENCH_STAGE_TRANSFER: return "transfer";
+     case XBENCH_STAGE_SINK:     return "sink";
+     case XBENCH_STAGE_TOTAL:    return "total";
+     case XBENCH_STAGE_WIRE:     return "wire";
+     }
+     return "";
+}
+inline const char* XBenchThreadName(uint32_t thread)
+{
+     switch(thread)
+     {
+     case XBENCH_THREAD_ENGINE:   return "engine";
+     case XBENCH_THREAD_PARSE:    return "parse";
+     case XBENCH_THREAD_TRANSFER: return "transfer";
+     }
+     return "";
+}
+inline uint64_t XBenchNow()
+{
+     return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+/*
+  CPU time used so far by the calling thread and by the whole process, ns.
+ */
+inline uint64_t XThreadCpuNs()
+{
+#ifdef _MSC_VER
+     FILETIME create, exit, kernel, user;
+     if(!GetThreadTimes(GetCurrentThread(), &create, &exit, &kernel, &user))
+          return 0;
+     return ((((uint64_t)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime)
+             + (((uint64_t)user.dwHighDateTime << 32) | user.dwLowDateTime)) * 100;
+#else
+     timespec ts;
+     clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+     return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+inline uint64_t XProcessCpuNs()
+{
+#ifdef _MSC_VER
+     FILETIME create, exit, kernel, user;
+     if(!GetProcessTimes(GetCurrentProcess(), &create, &exit, &kernel, &user))
+          return 0;
+     return ((((uint64_t)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime)
+             + (((uint64_t)user.dwHighDateTime << 32) | user.dwLowDateTime)) * 100;
+#else
+     timespec ts;
+     clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+     return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+/*
+  CPUs of affinity_mask in the order XAcquisition::GetAffinityList() hands
+  them out, bit 0 first. Empty for mask 0, no pinning.
+ */
+inline std::vector<uint32_t> XBenchAffinityList(uint32_t affinity_mask)
+{
+     std::vector<uint32_t> list;
+     for(uint32_t cpu = 0; cpu < 32; cpu++)
+          if(affinity_mask & (1u << cpu))
+               list.push_back(cpu);
+     return list;
+}
+
+/*
+  Latency percentiles of one stage, in microseconds.
+ */
+struct XLatencySummary
+{
+     uint64_t _count;
+     double _mean;
+     double _p50;
+     double _p90;
+     double _p99;
+     double _p999;
+     double _max;
+};
+
+/*
+  Latency samples of one stage, written by one thread. Samples beyond
+  XBENCH_MAX_SAMPLES only update the count, mean and max. Reserve() the
+  expected count so the measured threads do not allocate.
+ */
+class XLatencyStat
+{
+public:
+     XLatencyStat()
+          :_count(0)
+          ,_sum(0)
+          ,_max(0)
+     {}
+     ~XLatencyStat()
+     {}
+
+     void Reserve(size_t num)
+     {
+          _samples.reserve((num < XBENCH_MAX_SAMPLES) ? num : XBENCH_MAX_SAMPLES);
+     }
+     void Clear()
+     {
+          _samples.clear();
+          _count = 0;
+          _sum = 0;
+          _max = 0;
+     }
+     void Add(uint64_t ns)
+     {
+          _count++;
+          _sum += ns;
+          if(ns > _max)
+               _max = ns;
+          if(_samples.size() < XBENCH_MAX_SAMPLES)
+               _samples.push_back(ns);
+     }
+     uint64_t GetCount()
+     {
+          return _count;
+     }
+     /*
+       Nearest rank percentiles, sorts the samples.
+      */
+     void GetSummary(XLatencySummary& summary)
+     {
+          memset(&summary, 0, sizeof(summary));
+          summary._count = _count;
+          if(0 == _count)
+               return;
+          std::sort(_samples.begin(), _samples.end());
+          summary._mean = (double)_sum / _count / 1000.0;
+          summary._p50 = Percentile(0.5);
+          summary._p90 = Percentile(0.9);
+          summary._p99 = Percentile(0.99);
+          summary._p999 = Percentile(0.999);
+          summary._max = _max / 1000.0;
+     }
+
+private:
+     XLatencyStat(const XLatencyStat&);
+     XLatencyStat& operator = (const XLatencyStat&);
+
+     double Percentile(double p)
+     {
+          size_t rank = (size_t)(p * _samples.size() + 0.999999);
+          if(rank < 1)
+               rank = 1;
+          if(rank > _samples.size())
+               rank = _samples.size();
+          return _samples[rank - 1] / 1000.0;
+     }
+
+     std::vector<uint64_t> _samples;
+     uint64_t _count;
+     uint64_t _sum;
+     uint64_t _max;
+};
+
+/*
+  One point of the sweep. _frame_buf_num is the frame_buffer_size of
+  XAcquisition::Open(), XFRAME_NUM by default.
+ */
+struct XBenchCase
+{
+     uint32_t _binning;          //XPARA_BINNING_MODE, 0 1x1, 1 2x2
+     uint32_t _width;            //Pixels after binning
+     uint32_t _height;
+     uint32_t _pixel_depth;
+     uint32_t _payload_size;     //Image bytes per packet of the source
+     uint32_t _frame_buf_num;
+     uint32_t _socket_buf_size;  //Requested SO_RCVBUF
+     uint32_t _affinity_mask;    //0 leaves the threads to the scheduler
+     uint32_t _frame_num;        //Frames grabbed
+};
+
+/*
+  Result of one case. The drop counters sum the data of the sink events,
+  _cpu is percent of one core per thread, -1 when the threads are not ours
+  to measure.
+ */
+struct XBenchResult
+{
+     const char* _pipeline_;     //"sdk" or "loopback"
+     XBenchCase _case;
+     uint32_t _socket_buf_actual;
+     double _seconds;
+     uint64_t _frames;           //Delivered to the sink
+     uint64_t _packets;          //Received by the engine, 0 if unknown
+     uint64_t _bytes;            //Pixel bytes delivered
+     uint64_t _sent_frames;      //By the packet source, 0 if unknown
+     uint64_t _sent_packets;
+     uint64_t _pac_lost;         //XEVENT_IMG_PARSE_PAC_LOST
+     uint64_t _buf_full;         //XEVENT_IMG_TRANSFER_BUF_FULL
+     uint64_t _data_lost;        //XEVENT_IMG_PARSE_DATA_LOST
+     uint64_t _dm_drop;          //XEVENT_IMG_PARSE_DM_DROP
+     uint64_t _bad_frames;       //Failed the pixel check
+     XLatencySummary _latency[XBENCH_STAGE_NUM];
+     double _cpu[XBENCH_THREAD_NUM];
+     double _cpu_process;
+};
+
+inline void XClearBenchResult(XBenchResult& result)
+{
+     memset(&result, 0, sizeof(result));
+     result._pipeline_ = "";
+     for(uint32_t i = 0; i < XBENCH_THREAD_NUM; i++)
+          result._cpu[i] = -1;
+}
+inline double XBenchRate(uint64_t count, double seconds)
+{
+     return (seconds > 0) ? count / seconds : 0;
+}
+/*
+  Write the results as CSV, one row per case, the header row first.
+ */
+inline bool XWriteBenchCsv(const char* file_, const std::vector<XBenchResult>& results)
+{
+     FILE* out_ = fopen(file_, "w");
+     if(!out_)
+          return 0;
+     fprintf(out_, "pipeline,binning,width,height,pixel_depth,frame_buf_num,socket_buf_size,"
+             "socket_buf_actual,affinity_mask,frame_num,seconds,frames,packets,bytes,"
+             "sent_frames,sent_packets,frames_per_s,packets_per_s,mbytes_per_s,"
+             "pac_lost,buf_full,data_lost,dm_drop,bad_frames");
+     for(uint32_t s = 0; s < XBENCH_STAGE_NUM; s++)
+     {
+          const char* name_ = XBenchStageName(s);
+          fprintf(out_, ",%s_count,%s_mean_us,%s_p50_us,%s_p90_us,%s_p99_us,%s_p999_us,%s_max_us",
+                  name_, name_, name_, name_, name_, name_, name_);
+     }
+     for(uint32_t t = 0; t < XBENCH_THREAD_NUM; t++)
+          fprintf(out_, ",cpu_%s", XBenchThreadName(t));
+     fprintf(out_, ",cpu_process\n");
+
+     for(size_t i = 0; i < results.size(); i++)
+     {
+          const XBenchResult& r = results[i];
+          fprintf(out_, "%s,%u,%u,%u,%u,%u,%u,%u,0x%X,%u,%.3f,%llu,%llu,%llu,%llu,%llu,"
+                  "%.2f,%.1f,%.2f,%llu,%llu,%llu,%llu,%llu",
+                  r._pipeline_, r._case._binning, r._case._width, r._case._height,
+                  r._case._pixel_depth, r._case._frame_buf_num, r._case._socket_buf_size,
+                  r._socket_buf_actual, r._case._affinity_mask, r._case._frame_num,
+                  r._seconds, (unsigned long long)r._frames, (unsigned long long)r._packets,
+                  (unsigned long long)r._bytes, (unsigned long long)r._sent_frames,
+                  (unsigned long long)r._sent_packets, XBenchRate(r._frames, r._seconds),
+                  XBenchRate(r._packets, r._seconds),
+                  XBenchRate(r._bytes, r._seconds) / (1024.0 * 1024.0),
+                  (unsigned long long)r._pac_lost, (unsigned long long)r._buf_full,
+                  (unsigned long long)r._data_lost, (unsigned long long)r._dm_drop,
+                  (unsigned long long)r._bad_frames);
+          for(uint32_t s = 0; s < XBENCH_STAGE_NUM; s++)
+          {
+               const XLatencySummary& l = r._latency[s];
+               fprintf(out_, ",%llu,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f", (unsigned long long)l._count,
+                       l._mean, l._p50, l._p90, l._p99, l._p999, l._max);
+          }
+          for(uint32_t t = 0; t < XBENCH_THREAD_NUM; t++)
+               fprintf(out_, ",%.1f", r._cpu[t]);
+          fprintf(out_, ",%.1f\n", r._cpu_process);
+     }
+     return 0 == fclose(out_);
+}
+/*
+  Write the results as a JSON array of objects with the fields of the CSV
+  columns, the latencies and CPU loads grouped per stage and thread.
+ */
+inline bool XWriteBenchJson(const char* file_, const std::vector<XBenchResult>& results)
+{
+     FILE* out_ = fopen(file_, "w");
+     if(!out_)
+          return 0;
+     fprintf(out_, "[\n");
+     for(size_t i = 0; i < results.size(); i++)
+     {
+          const XBenchResult& r = results[i];
+          fprintf(out_, "  {\"pipeline\": \"%s\", \"binning\": %u, \"width\": %u, \"height\": %u, "
+                  "\"pixel_depth\": %u, \"frame_buf_num\": %u, \"socket_buf_size\": %u, "
+                  "\"socket_buf_actual\": %u, \"affinity_mask\": %u, \"frame_num\": %u,\n",
+                  r._pipeline_, r._case._binning, r._case._width, r._case._height,
+                  r._case._pixel_depth, r._case._frame_buf_num, r._case._socket_buf_size,
+                  r._socket_buf_actual, r._case._affinity_mask, r._case._frame_num);
+          fprintf(out_, "   \"seconds\": %.3f, \"frames\": %llu, \"packets\": %llu, \"bytes\": %llu, "
+                  "\"sent_frames\": %llu, \"sent_packets\": %llu, \"frames_per_s\": %.2f, "
+                  "\"packets_per_s\": %.1f, \"mbytes_per_s\": %.2f,\n",
+                  r._seconds, (unsigned long long)r._frames, (unsigned long long)r._packets,
+                  (unsigned long long)r._bytes, (unsigned long long)r._sent_frames,
+                  (unsigned long long)r._sent_packets, XBenchRate(r._frames, r._seconds),
+                  XBenchRate(r._packets, r._seconds),
+                  XBenchRate(r._bytes, r._seconds) / (1024.0 * 1024.0));
+          fprintf(out_, "   \"pac_lost\": %llu, \"buf_full\": %llu, \"data_lost\": %llu, "
+                  "\"dm_drop\": %llu, \"bad_frames\": %llu,\n   \"latency_us\": {",
+                  (unsigned long long)r._pac_lost, (unsigned long long)r._buf_full,
+                  (unsigned long long)r._data_lost, (unsigned long long)r._dm_drop,
+                  (unsigned long long)r._bad_frames);
+          for(uint32_t s = 0; s < XBENCH_STAGE_NUM; s++)
+          {
+               const XLatencySummary& l = r._latency[s];
+               fprintf(out_, "%s\n    \"%s\": {\"count\": %llu, \"mean\": %.2f, \"p50\": %.2f, "
+                       "\"p90\": %.2f, \"p99\": %.2f, \"p999\": %.2f, \"max\": %.2f}",
+                       s ? "," : "", XBenchStageName(s), (unsigned long long)l._count,
+                       l._mean, l._p50, l._p90, l._p99, l._p999, l._max);
+          }
+          fprintf(out_, "},\n   \"cpu_percent\": {");
+          for(uint32_t t = 0; t < XBENCH_THREAD_NUM; t++)
+               fprintf(out_, "\"%s\": %.1f, ", XBenchThreadName(t), r._cpu[t]);
+          fprintf(out_, "\"process\": %.1f}}%s\n", r._cpu_process,
+                  (i + 1 < results.size()) ? "," : "");
+     }
+     fprintf(out_, "]\n");
+     return 0 == fclose(out_);
+}
+
+/*
+  Timing of one kernel, _pixels, _bytes and _packets are the work of one
+  repetition. Per packet kernels such as header parsing leave _pixels and
+  _bytes 0. The rates are computed from the median repetition.
+ */
+struct XMicroResult
+{
+     char _group[16];
+     char _name[48];
+     uint64_t _pixels;
+     uint64_t _bytes;
+     uint64_t _packets;
+     uint32_t _reps;
+     double _min_ns;
+     double _median_ns;
+     double _mean_ns;
+};
+
+inline double XMicroNsPerPixel(const XMicroResult& result)
+{
+     return result._pixels ? result._median_ns / result._pixels : 0;
+}
+inline double XMicroGBps(const XMicroResult& result)
+{
+     return (result._median_ns > 0) ? result._bytes / result._median_ns : 0;
+}
+inline double XMicroNsPerPacket(const XMicroResult& result)
+{
+     return result._packets ? result._median_ns / result._packets : 0;
+}
+inline double XMicroPacketsPerSec(const XMicroResult& result)
+{
+     return (result._median_ns > 0) ? result._packets * 1e9 / result._median_ns : 0;
+}
+/*
+  Call func warmup times untimed, then reps times timed one by one.
+ */
+template <typename Func>
+inline void XRunMicro(XMicroResult& result, Func func, uint32_t warmup, uint32_t reps)
+{
+     if(0 == reps)
+          reps = 1;
+     for(uint32_t i = 0; i < warmup; i++)
+          func();
+     std::vector<uint64_t> times(reps);
+     for(uint32_t i = 0; i < reps; i++)
+     {
+          uint64_t start = XBenchNow();
+          func();
+          times[i] = XBenchNow() - start;
+     }
+     std::sort(times.begin(), times.end());
+     uint64_t sum = 0;
+     for(uint32_t i = 0; i < reps; i++)
+          sum += times[i];
+     result._reps = reps;
+     result._min_ns = (double)times[0];
+     result._median_ns = (reps & 1) ? (double)times[reps / 2]
+          : (times[reps / 2 - 1] + times[reps / 2]) / 2.0;
+     result._mean_ns = (double)sum / reps;
+}
+inline bool XWriteMicroCsv(const char* file_, const std::vector<XMicroResult>& results)
+{
+     FILE* out_ = fopen(file_, "w");
+     if(!out_)
+          return 0;
+     fprintf(out_, "group,name,pixels,bytes,packets,reps,min_ns,median_ns,mean_ns,"
+             "ns_per_pixel,gbytes_per_s,ns_per_packet,packets_per_s\n");
+     for(size_t i = 0; i < results.size(); i++)
+     {
+          const XMicroResult& r = results[i];
+          fprintf(out_, "%s,%s,%llu,%llu,%llu,%u,%.0f,%.0f,%.0f,%.4f,%.3f,%.2f,%.0f\n",
+                  r._group, r._name, (unsigned long long)r._pixels,
+                  (unsigned long long)r._bytes, (unsigned long long)r._packets, r._reps,
+                  r._min_ns, r._median_ns, r._mean_ns, XMicroNsPerPixel(r), XMicroGBps(r),
+                  XMicroNsPerPacket(r), XMicroPacketsPerSec(r));
+     }
+     return 0 == fclose(out_);
+}
+inline bool XWriteMicroJson(const char* file_, const std::vector<XMicroResult>& results)
+{
+     FILE* out_ = fopen(file_, "w");
+     if(!out_)
+          return 0;
+     fprintf(out_, "[\n");
+     for(size_t i = 0; i < results.size(); i++)
+     {
+          const XMicroResult& r = results[i];
+          fprintf(out_, "  {\"group\": \"%s\", \"name\": \"%s\", \"pixels\": %llu, \"bytes\": %llu, "
+                  "\"packets\": %llu, \"reps\": %u, \"min_ns\": %.0f, \"median_ns\": %.0f, "
+                  "\"mean_ns\": %.0f, \"ns_per_pixel\": %.4f, \"gbytes_per_s\": %.3f, "
+                  "\"ns_per_packet\": %.2f, \"packets_per_s\": %.0f}%s\n", r._group, r._name,
+                  (unsigned long long)r._pixels, (unsigned long long)r._bytes,
+                  (unsigned long long)r._packets, r._reps, r._min_ns, r._median_ns, r._mean_ns,
+                  XMicroNsPerPixel(r), XMicroGBps(r), XMicroNsPerPacket(r),
+                  XMicroPacketsPerSec(r), (i + 1 < results.size()) ? "," : "");
+     }
+     fprintf(out_, "]\n");
+     return 0 == fclose(out_);
+}
+
+#ifdef __linux__
+/*
+  XBenchPipeline is the acquisition path of the SDK rebuilt from the header
+  components, so that it can be measured on Linux against XDeviceSim:
+    engine thread    XUDPMmsgRecv -> XPacketRingPool     (XUDPImgEngine, XPacketPool)
+    parse thread     XPacketRingPool -> XLinePlacer      (XUDPImgParse)
+    transfer thread  frame queue -> IXImgSink            (XFrameTransfer)
+  The frames go to the _frame_buf_num slots of a XFrameLeasePool, like the
+  XFRAME_NUM frame buffer of XAcquisition. A sink keeps a frame beyond
+  OnFrameReady() without copying it by taking a lease with Lease(), the slot
+  comes back to the parser when the last lease is released. The parser reports drops to the sink with the SDK
+  events: XEVENT_IMG_PARSE_PAC_LOST with the missing packets and
+  XEVENT_IMG_PARSE_DATA_LOST for each incomplete frame,
+  XEVENT_IMG_TRANSFER_BUF_FULL for each frame without a free buffer and
+  XEVENT_IMG_PARSE_DM_DROP with the payloads that belong to no frame.
+  Incomplete frames are not delivered. The parser logs the receive time of
+  every packet to a XMetricsRing, which the transfer thread reads back for
+  the wire stage.
+ */
+class XBenchPipeline
+{
+public:
+     XBenchPipeline()
+          :_fd(-1)
+          ,_socket_buf_size(0)
+          ,_sink_(NULL)
+          ,_frame_bytes(0)
+          ,_recv_seq(0)
+          ,_parse_seq(0)
+          ,_cur(-1)
+          ,_frame_id(0)
+          ,_orphans(0)
+          ,_is_skip(0)
+          ,_last_err(0)
+     {
+          _stop_stage.store(XBENCH_THREAD_NUM);
+          _packets.store(0);
+          _frames.store(0);
+          memset(_cpu_ns, 0, sizeof(_cpu_ns));
+          memset(&_case, 0, sizeof(_case));
+     }
+     ~XBenchPipeline()
+     {
+          Close();
+     }
+
+     /*
+       Bind the image port and allocate the frame buffers for bench_case.
+      */
+     bool Open(const XBenchCase& bench_case, const char* local_ip_, uint16_t local_port,
+               IXImgSink* sink_)
+     {
+          Close();
+          _last_err = 0;
+          _case = bench_case;
+          _sink_ = sink_;
+          uint32_t pixel_byte = (_case._pixel_depth > 16) ? 4 : 2;
+          _frame_bytes = (size_t)_case._width * _case._height * pixel_byte;
+          if(!_sink_ || 0 == _frame_bytes || 0 == _case._frame_buf_num
+             || !_placer.Open(_case._width, _case._height, pixel_byte, _case._payload_size)
+             || !_pool.Initialize())
+          {
+               _last_err = EINVAL;
+               return 0;
+          }
+          if(!OpenSocket(local_ip_, local_port))
+          {
+               Close();
+               return 0;
+          }
+          _pool.SetWaitTime(XBENCH_WAIT_TIME);
+          if(!_frame_pool.Open(_case._width, _case._height, _case._pixel_depth,
+                               _case._frame_buf_num))
+          {
+               _last_err = ENOMEM;
+               Close();
+               return 0;
+          }
+          //Fault the pages in before the clock starts
+          for(uint32_t i = 0; i < _case._frame_buf_num; i++)
+               memset(_frame_pool.GetImage(i)->_data_, 0, _frame_bytes);
+          _stamps.assign(XPAC_NUM, 0);
+          //Sized for the packets of a frame plus duplicates
+          if(!_metrics.Open(_placer.GetPacketNum() * 2, _case._frame_buf_num + 2))
+          {
+               _last_err = ENOMEM;
+               Close();
+               return 0;
+          }
+          return 1;
+     }
+     void Close()
+     {
+          Stop();
+          if(_fd >= 0)
+               close(_fd);
+          _fd = -1;
+          _recv.Close();
+          _frame_pool.Close();
+          _metrics.Close();
+     }
+     /*
+       Start the three threads, pinned round robin to the CPUs of the
+       affinity mask.
+      */
+     bool Start()
+     {
+          if(_fd < 0 || 0 == _frame_pool.GetSlotNum() || _stop_stage.load() < XBENCH_THREAD_NUM)
+               return 0;
+          _pool.Reset();
+          _metrics.Reset();
+          _ready.clear();
+          size_t frame_packets = _frame_bytes / XPAC_SIZE + 2;
+          for(uint32_t s = 0; s < XBENCH_STAGE_NUM; s++)
+          {
+               _latency[s].Clear();
+               _latency[s].Reserve((s < XBENCH_STAGE_TRANSFER)
+                                   ? frame_packets * _case._frame_num : _case._frame_num);
+          }
+          memset(_cpu_ns, 0, sizeof(_cpu_ns));
+          _recv_seq = 0;
+          _parse_seq = 0;
+          _cur = -1;
+          _orphans = 0;
+          _is_skip = 0;
+          _packets.store(0);
+          _frames.store(0);
+          _stop_stage.store(0);
+          _threads[XBENCH_THREAD_TRANSFER] = std::thread(&XBenchPipeline::TransferProc, this);
+          _threads[XBENCH_THREAD_PARSE] = std::thread(&XBenchPipeline::ParseProc, this);
+          _threads[XBENCH_THREAD_ENGINE] = std::thread(&XBenchPipeline::EngineProc, this);
+          return 1;
+     }
+     /*
+       Stop the threads front to back, so that every packet already
+       received is parsed and every complete frame reaches the sink.
+      */
+     void Stop()
+     {
+          for(uint32_t t = 0; t < XBENCH_THREAD_NUM; t++)
+          {
+               _stop_stage.store(t + 1);
+               if(XBENCH_THREAD_TRANSFER == t)
+               {
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    _ready_cond.notify_all();
+               }
+               if(_threads[t].joinable())
+                    _threads[t].join();
+          }
+     }
+     /*
+       Keep a frame passed to OnFrameReady() after the callback returns.
+       Release the lease from any thread when done with the frame. Frames
+       which arrive while every slot is leased are dropped with
+       XEVENT_IMG_TRANSFER_BUF_FULL.
+      */
+     XFrameLease Lease(XImage* image_)
+     {
+          return _frame_pool.Lease(image_);
+     }
+     uint64_t GetPackets()
+     {
+          return _packets.load(std::memory_order_relaxed);
+     }
+     uint64_t GetFrames()
+     {
+          return _frames.load(std::memory_order_relaxed);
+     }
+     /*
+       SO_RCVBUF granted by the kernel, which may cap the request.
+      */
+     uint32_t GetSocketBufSize()
+     {
+          return _socket_buf_size;
+     }
+     /*
+       Fill the packet count, the latencies of the stages the pipeline
+       measures and the CPU load of its threads over seconds. Only call
+       after Stop().
+      */
+     void GetResult(XBenchResult& result, double seconds)
+     {
+          result._socket_buf_actual = _socket_buf_size;
+          result._packets = _packets.load();
+          for(uint32_t s = 0; s < XBENCH_STAGE_NUM; s++)
+               if(_latency[s].GetCount())
+                    _latency[s].GetSummary(result._latency[s]);
+          for(uint32_t t = 0; t < XBENCH_THREAD_NUM; t++)
+               result._cpu[t] = (seconds > 0) ? _cpu_ns[t] / (seconds * 1e7) : 0;
+     }
+     int32_t GetLastError()
+     {
+          return _last_err;
+     }
+
+private:
+     XBenchPipeline(const XBenchPipeline&);
+     XBenchPipeline& operator = (const XBenchPipeline&);
+
+     struct XBenchFrame
+     {
+          uint32_t _index;
+          uint32_t _metrics_seq;   //Sequence of the frame in _metrics
+          uint64_t _recv_ns;       //Last packet of the frame received
+          uint64_t _done_ns;       //Queued to the transfer thread
+     };
+
+     bool OpenSocket(const char* local_ip_, uint16_t local_port)
+     {
+          _fd = socket(AF_INET, SOCK_DGRAM, 0);
+          if(_fd < 0)
+          {
+               _last_err = errno;
+               return 0;
+          }
+          int32_t size = (int32_t)_case._socket_buf_size;
+          //SO_RCVBUFFORCE passes net.core.rmem_max when we may
+          if(size > 0 && setsockopt(_fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) < 0)
+               setsockopt(_fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+          socklen_t len = sizeof(size);
+          if(0 == getsockopt(_fd, SOL_SOCKET, SO_RCVBUF, &size, &len))
+               _socket_buf_size = (uint32_t)size / 2;   //The kernel reports it doubled
+          sockaddr_in addr;
+          memset(&addr, 0, sizeof(addr));
+          addr.sin_family = AF_INET;
+          addr.sin_port = htons(local_port);
+          if(1 != inet_pton(AF_INET, local_ip_, &addr.sin_addr)
+             || bind(_fd, (sockaddr*)&addr, sizeof(addr)) < 0)
+          {
+               _last_err = errno ? errno : EINVAL;
+               return 0;
+          }
+          return _recv.Open(_fd);
+     }
+     void SetAffinity(uint32_t thread)
+     {
+          std::vector<uint32_t> list = XBenchAffinityList(_case._affinity_mask);
+          if(list.empty())
+               return;
+          cpu_set_t set;
+          CPU_ZERO(&set);
+          CPU_SET(list[thread % list.size()], &set);
+          pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+     }
+     bool IsStopped(uint32_t thread)
+     {
+          return _stop_stage.load() > thread;
+     }
+     /*
+       Receive batches into free packets. Free packets the last batch left
+       over stay here, only the parse thread pushes to the free ring.
+      */
+     void EngineProc()
+     {
+          SetAffinity(XBENCH_THREAD_ENGINE);
+          XTraceSetThreadName("engine");
+          uint64_t cpu = XThreadCpuNs();
+          XPacket* packets_[XUDP_MMSG_BATCH];
+          uint32_t free_num = 0;
+          while(!IsStopped(XBENCH_THREAD_ENGINE))
+          {
+               if(free_num < XUDP_MMSG_BATCH)
+                    free_num += _pool.GetFreePackets(packets_ + free_num,
+                                                     XUDP_MMSG_BATCH - free_num);
+               if(0 == free_num)
+                    continue;
+               int32_t num = _recv.Recv(packets_, free_num, XBENCH_WAIT_TIME);
+               if(num <= 0)
+                    continue;
+               //The rings keep FIFO order, so packet n of the used ring
+               //finds its time at _stamps[n]
+               uint64_t now = XBenchNow();
+               for(int32_t i = 0; i < num; i++)
+                    _stamps[(_recv_seq + i) & (XPAC_NUM - 1)] = now;
+               _recv_seq += num;
+               _pool.PushUsedPackets(packets_, num);
+               free_num -= num;
+               memmove(packets_, packets_ + num, free_num * sizeof(XPacket*));
+               _packets.fetch_add(num, std::memory_order_relaxed);
+          }
+          _cpu_ns[XBENCH_THREAD_ENGINE] = XThreadCpuNs() - cpu;
+     }
+     void ParseProc()
+     {
+          SetAffinity(XBENCH_THREAD_PARSE);
+          XTraceSetThreadName("parse");
+          uint64_t cpu = XThreadCpuNs();
+          XPacket* packets_[XUDP_MMSG_BATCH];
+          while(1)
+          {
+               uint32_t num = _pool.GetUsedPackets(packets_, XUDP_MMSG_BATCH);
+               if(0 == num)
+               {
+                    if(IsStopped(XBENCH_THREAD_PARSE))
+                         break;
+                    continue;
+               }
+               uint64_t start = XBenchNow();
+               for(uint32_t i = 0; i < num; i++)
+               {
+                    uint64_t recv_ns = _stamps[_parse_seq++ & (XPAC_NUM - 1)];
+                    _latency[XBENCH_STAGE_POOL].Add(start - recv_ns);
+                    Parse(packets_[i], recv_ns);
+                    uint64_t now = XBenchNow();
+                    _latency[XBENCH_STAGE_PARSE].Add(now - start);
+                    start = now;
+               }
+               _pool.PushFreePackets(packets_, num);
+          }
+          EndFrame();
+          _cpu_ns[XBENCH_THREAD_PARSE] = XThreadCpuNs() - cpu;
+     }
+     void Parse(const XPacket* packet_, uint64_t recv_ns)
+     {
+          XHeader header;
+          if(!XParseImgPacket(packet_, header))
+          {
+               _orphans++;
+               return;
+          }
+          if(header._isHeader)
+          {
+               EndFrame();
+               BeginFrame(packet_, header, recv_ns);
+               return;
+          }
+          //A payload of a later frame means its header was lost
+          if((_cur >= 0 || _is_skip) && header._frame_id != _frame_id)
+          {
+               EndFrame();
+               _is_skip = 0;
+          }
+          if(_cur < 0)
+          {
+               if(!_is_skip)
+                    _orphans++;
+               return;
+          }
+          int32_t ret = _placer.Place(header, packet_->data_ + PAYLOAD);
+          if(XPLACE_ERROR != ret)
+               _metrics.PutFrameLines(recv_ns, &header);
+          if(XPLACE_FRAME_DONE == ret)
+          {
+               _metrics.PushMetrics();
+               XBenchFrame frame;
+               frame._index = (uint32_t)_cur;
+               frame._metrics_seq = _metrics.GetPublished();
+               frame._recv_ns = recv_ns;
+               frame._done_ns = XBenchNow();
+               _cur = -1;
+               XTraceInstant(XTRACE_FRAME_READY, frame._index);
+               std::lock_guard<std::mutex> lock(_mutex);
+               _ready.push_back(frame);
+               _ready_cond.notify_one();
+          }
+     }
+     void BeginFrame(const XPacket* header_, const XHeader& header, uint64_t recv_ns)
+     {
+          XImage* image_ = _frame_pool.AcquireFree();
+          if(image_)
+               _cur = _frame_pool.GetSlot(image_);
+          _frame_id = XGetBE16(header_->data_ + FRAME_ID);
+          _is_skip = (_cur < 0);
+          if(_is_skip)
+          {
+               _sink_->OnXEvent(XEVENT_IMG_TRANSFER_BUF_FULL, 1);
+               return;
+          }
+          _placer.SetFrame(image_->_data_);
+          _placer.Put(header_);     //Resets the frame counters
+          _metrics.PutFrameHeader(recv_ns, &header);
+     }
+     /*
+       Close the frame in progress when the next header or the stop comes
+       before its last payload.
+      */
+     void EndFrame()
+     {
+          if(_orphans)
+               _sink_->OnXEvent(XEVENT_IMG_PARSE_DM_DROP, _orphans);
+          _orphans = 0;
+          if(_cur < 0)
+               return;
+          uint32_t missing = _placer.GetMissingPackets();
+          if(missing)
+          {
+               _sink_->OnXEvent(XEVENT_IMG_PARSE_PAC_LOST, missing);
+               _sink_->OnXEvent(XEVENT_IMG_PARSE_DATA_LOST, 1);
+          }
+          _frame_pool.Recycle(_frame_pool.GetImage((uint32_t)_cur));
+          _cur = -1;
+     }
+     void TransferProc()
+     {
+          SetAffinity(XBENCH_THREAD_TRANSFER);
+          XTraceSetThreadName("transfer");
+          uint64_t cpu = XThreadCpuNs();
+          while(1)
+          {
+               XBenchFrame frame;
+               {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    while(_ready.empty() && !IsStopped(XBENCH_THREAD_TRANSFER))
+                         _ready_cond.wait_for(lock, std::chrono::milliseconds(XBENCH_WAIT_TIME));
+                    if(_ready.empty())
+                         break;
+                    frame = _ready.front();
+                    _ready.pop_front();
+               }
+               _latency[XBENCH_STAGE_TRANSFER].Add(XBenchNow() - frame._done_ns);
+               //The slot is only lost if the parser got _frame_buf_num frames ahead
+               if(_metrics.GetFrame(frame._metrics_seq, _frame_metrics))
+                    _latency[XBENCH_STAGE_WIRE].Add(WireTime(_frame_metrics));
+               {
+                    XTraceScope scope(XTRACE_SINK, frame._index);
+                    _sink_->OnFrameReady(_frame_pool.GetImage(frame._index));
+               }
+               _latency[XBENCH_STAGE_TOTAL].Add(XBenchNow() - frame._recv_ns);
+               _frames.fetch_add(1, std::memory_order_relaxed);
+               //The slot stays out while the sink holds leases on it
+               _frame_pool.Recycle(_frame_pool.GetImage(frame._index));
+          }
+          _cpu_ns[XBENCH_THREAD_TRANSFER] = XThreadCpuNs() - cpu;
+     }
+     static uint64_t WireTime(const XFrameMetrics& metrics)
+     {
+          uint64_t last = metrics.HeaderTimeNs;
+          for(uint32_t i = 0; i < metrics.LineNum; i++)
+               if(metrics.Lines[i].TimeNs > last)
+                    last = metrics.Lines[i].TimeNs;
+          return last - metrics.HeaderTimeNs;
+     }
+
+     int32_t _fd;
+     uint32_t _socket_buf_size;
+     XBenchCase _case;
+     IXImgSink* _sink_;
+     XFrameLeasePool _frame_pool;
+     size_t _frame_bytes;
+     XUDPMmsgRecv _recv;
+     XPacketRingPool _pool;
+     XLinePlacer _placer;
+     std::vector<uint64_t> _stamps;      //Receive time per packet, by ring order
+     XMetricsRing _metrics;              //Written by the parse thread
+     XFrameMetrics _frame_metrics;       //Transfer thread only
+
+     uint64_t _recv_seq;                 //Engine thread only
+
+     //Parse thread only
+     uint64_t _parse_seq;
+     int32_t _cur;                       //Frame buffer being filled, -1 none
+     uint16_t _frame_id;                 //FRAME_ID of the current frame
+     uint32_t _orphans;
+     bool _is_skip;                      //Current frame had no free buffer
+
+     std::mutex _mutex;                  //Guards _ready
+     std::condition_variable _ready_cond;
+     std::deque<XBenchFrame> _ready;
+
+     std::atomic<uint32_t> _stop_stage;  //Threads below it keep running
+     std::atomic<uint64_t> _packets;
+     std::atomic<uint64_t> _frames;
+     uint64_t _cpu_ns[XBENCH_THREAD_NUM];
+     XLatencyStat _latency[XBENCH_STAGE_NUM];
+     std::thread _threads[XBENCH_THREAD_NUM];
+     int32_t _last_err;
+};
+#endif //__linux__
+#endif //XBENCH_H
@@ -0,0 +1,280 @@
+/*
+  Copyright (c), Detection Technology Inc.
+  All right reserved.
+
+ */
+
+#ifndef XCALIB_STREAM_H
+#define XCALIB_STREAM_H
+#include "xconfigure.h"
+#include "ximage.h"
+#include "xraw_file.h"
+#include "xcorrect_kernel.h"
+#include <math.h>
+#include <string.h>
+
+//Flags of XCalibStream::Begin()
+#define XCALIB_MEAN       0x0
+#define XCALIB_VARIANCE   0x1   //Also keep a Welford variance per pixel
+
+//Frames a 32 bit sum of 16 bit pixels can hold
+#define XCALIB_MAX_FRAME_32 65537
+
+/*
+  XCalibStream calibrates offset or gain one frame at a time. Each frame is
+  added to per pixel running sums and may be dropped right after, so memory
+  stays at a few frames whatever the number of dark or flat frames.
+  Up to 16 bit depth the sums are 32 bit, deeper frames use 64 bit sums.
+  With XCALIB_VARIANCE a per pixel Welford mean and M2 are kept too, for
+  noise maps.
+  Frames come from AddFrame(), e.g. called in IXImgSink::OnFrameReady()
+  during a live grab, or from AddFile() which streams a .dat file. Add
+  frames from one thread only, and call Finish() once they are all added.
+  The mean frame then feeds XCorrection::CalculateOffset(XImage*) /
+  CalculateGain(XImage*, target) or XCorrectKernel.
+ */
+class XCalibStream
+{
+public:
+     XCalibStream()
+          :_width(0)
+          ,_height(0)
+          ,_pixel_depth(0)
+          ,_flags(0)
+          ,_frame_num(0)
+          ,_sum32_(NULL)
+          ,_sum64_(NULL)
+          ,_mean_(NULL)
+          ,_m2_(NULL)
+          ,_avg_(NULL)
+     {}
+     ~XCalibStream()
+     {
+          Release();
+     }
+
+     bool Begin(uint32_t width, uint32_t height, uint32_t pixel_depth,
+                uint32_t flags = XCALIB_MEAN)
+     {
+          Release();
+          if(0 == width || 0 == height || 0 == pixel_depth)
+               return 0;
+          size_t count = (size_t)width * height;
+          uint32_t pixel_byte = (pixel_depth > 16) ? 4 : 2;
+          if(pixel_byte == 2)
+               _sum32_ = (uint32_t*)calloc(count, sizeof(uint32_t));
+          else
+               _sum64_ = (uint64_t*)calloc(count, sizeof(uint64_t));
+          _avg_ = (uint8_t*)_aligned_malloc(XAlignSize(count * pixel_byte),
+                                            SSE_ALIGN_BYTE);
+          if(flags & XCALIB_VARIANCE)
+          {
+               _mean_ = (double*)calloc(count, sizeof(double));
+               _m2_ = (double*)calloc(count, sizeof(double));
+          }
+          if((!_sum32_ && !_sum64_) || !_avg_
+             || ((flags & XCALIB_VARIANCE) && (!_mean_ || !_m2_)))
+          {
+               Release();
+               return 0;
+          }
+          _width = width;
+          _height = height;
+          _pixel_depth = pixel_depth;
+          _flags = flags;
+          _frame_num = 0;
+          _avg_image._width = width;
+          _avg_image._height = height;
+          _avg_image._pixel_depth = pixel_depth;
+          _avg_image._data_offset = 0;
+          _avg_image._size = count * pixel_byte;
+          _avg_image._data_ = _avg_;
+          _avg_image._device_ = NULL;
+          return 1;
+     }
+     /*
+       Add one frame of the geometry given to Begin().
+      */
+     bool AddFrame(XImage* image_)
+     {
+          if(!image_ || !image_->_data_ || image_->_width != _width
+             || image_->_height != _height
+             || image_->_pixel_depth != _pixel_depth)
+               return 0;
+          if(_sum32_ && _frame_num >= XCALIB_MAX_FRAME_32)
+               return 0;
+          uint32_t n = _frame_num + 1;
+          for(uint32_t row = 0; row < _height; row++)
+          {
+               size_t pos = (size_t)row * _width;
+               if(_sum32_)
+               {
+                    const uint16_t* line_ = image_->GetView<uint16_t>().Row(row);
+                    uint32_t* sum_ = _sum32_ + pos;
+                    for(uint32_t col = 0; col < _width; col++)
+                         sum_[col] += line_[col];
+                    if(_m2_)
+                         AddVariance(line_, pos, n);
+               }
+               else
+               {
+                    const uint32_t* line_ = image_->GetView<uint32_t>().Row(row);
+                    uint64_t* sum_ = _sum64_ + pos;
+                    for(uint32_t col = 0; col < _width; col++)
+                         sum_[col] += line_[col];
+                    if(_m2_)
+                         AddVariance(line_, pos, n);
+               }
+          }
+          _frame_num = n;
+          return 1;
+     }
+     /*
+       Stream the frames of a raw .dat file through one frame buffer. Return
+       the number of frames added.
+      */
+     uint32_t AddFile(const char* dat_file_)
+     {
+          XRawInfo info;
+          if(!XReadRawInfo(dat_file_, info) || info._width != _width
+             || info._height != _height || info._pixel_depth != _pixel_depth)
+               return 0;
+          FILE* file_ = fopen(dat_file_, "rb");
+          if(!file_)
+               return 0;
+          size_t size = XRawFrameSize(info);
+          uint8_t* buf_ = (uint8_t*)_aligned_malloc(XAlignSize(size), SSE_ALIGN_BYTE);
+          XImage image;
+          image._width = _width;
+          image._height = _height;
+          image._pixel_depth = _pixel_depth;
+          image._size = size;
+          image._data_ = buf_;
+          uint32_t num = 0;
+          while(buf_ && fread(buf_, 1, size, file_) == size)
+          {
+               if(!AddFrame(&image))
+                    break;
+               num++;
+          }
+          fclose(file_);
+          if(buf_)
+               _aligned_free(buf_);
+          image._data_ = NULL;
+          return num;
+     }
+     /*
+       Compute the mean frame. More frames may be added afterwards and
+       Finish() called again.
+      */
+     bool Finish()
+     {
+          if(0 == _frame_num)
+               return 0;
+          size_t count = (size_t)_width * _height;
+          uint32_t half = _frame_num / 2;
+          if(_sum32_)
+          {
+               uint16_t* avg_ = (uint16_t*)_avg_;
+               for(size_t i = 0; i < count; i++)
+                    avg_[i] = (uint16_t)((_sum32_[i] + half) / _frame_num);
+          }
+          else
+          {
+               uint32_t* avg_ = (uint32_t*)_avg_;
+               for(size_t i = 0; i < count; i++)
+                    avg_[i] = (uint32_t)((_sum64_[i] + half) / _frame_num);
+          }
+          return 1;
+     }
+     /*
+       Load the mean frame into the kernel as offset, or as gain scaled to
+       target (0 = frame mean), after Finish().
+      */
+     bool FinishOffset(XCorrectKernel* kernel_)
+     {
+          if(!kernel_ || !_sum32_ || !Finish())
+               return 0;
+          return kernel_->SetOffset(&_avg_image);
+     }
+     bool FinishGain(XCorrectKernel* kernel_, uint32_t target)
+     {
+          if(!kernel_ || !_sum32_ || !Finish())
+               return 0;
+          return kernel_->CalculateGain(&_avg_image, target);
+     }
+     /*
+       Mean frame of the last Finish().
+      */
+     XImage* GetMeanImage()
+     {
+          return &_avg_image;
+     }
+     /*
+       Per pixel sample variance (or standard deviation) of the added
+       frames into out_[width * height]. Needs XCALIB_VARIANCE and at least
+       two frames.
+      */
+     bool GetVariance(float* out_, bool std_dev = 0)
+     {
+          if(!_m2_ || !out_ || _frame_num < 2)
+               return 0;
+          size_t count = (size_t)_width * _height;
+          for(size_t i = 0; i < count; i++)
+          {
+               double var = _m2_[i] / (_frame_num - 1);
+               out_[i] = (float)(std_dev ? sqrt(var) : var);
+          }
+          return 1;
+     }
+     uint32_t GetFrameNum()
+     {
+          return _frame_num;
+     }
+     void Release()
+     {
+          free(_sum32_);
+          free(_sum64_);
+          free(_mean_);
+          free(_m2_);
+          if(_avg_)
+               _aligned_free(_avg_);
+          _sum32_ = NULL;
+          _sum64_ = NULL;
+          _mean_ = NULL;
+          _m2_ = NULL;
+          _avg_ = NULL;
+          _avg_image._data_ = NULL;
+          _frame_num = 0;
+     }
+
+private:
+     XCalibStream(const XCalibStream&);
+     XCalibStream& operator = (const XCalibStream&);
+
+     template <typename T>
+     void AddVariance(const T* line_, size_t pos, uint32_t n)
+     {
+          double* mean_ = _mean_ + pos;
+          double* m2_ = _m2_ + pos;
+          for(uint32_t col = 0; col < _width; col++)
+          {
+               double delta = line_[col] - mean_[col];
+               mean_[col] += delta / n;
+               m2_[col] += delta * (line_[col] - mean_[col]);
+          }
+     }
+
+     uint32_t _width;
+     uint32_t _height;
+     uint32_t _pixel_depth;
+     uint32_t _flags;
+     uint32_t _frame_num;
+     uint32_t* _sum32_;
+     uint64_t* _sum64_;
+     double*   _mean_;         //Welford running mean
+     double*   _m2_;           //Welford sum of squared deviations
+     uint8_t*  _avg_;
+     XImage    _avg_image;
+};
+#endif //XCALIB_STREAM_H
@@ -0,0 +1,228 @@
+/*
+  Copyright (c), Detection Technology Inc.
+  All right reserved.
+
+ */
+
+#ifndef XCORRECT_BATCH_H
+#define XCORRECT_BATCH_H
+#include "xcorrect_kernel.h"
+#include "xworker_pool.h"
+#include <vector>
+
+#define XCOR_BAND_ROWS 64     //Rows per task
+
+/*
+  XCorrectBatch runs XCorrectKernel over a vector of frames on a persistent
+  XWorkerPool. Each frame is split into bands of XCOR_BAND_ROWS rows and
+  every (frame, band) pair is one task, so a single large frame and a long
+  scan (e.g. the 200 projections of a tomography run) both use all threads.
+  Offset and gain calibration average their frames the same way, then load
+  the result into the kernel.
+ */
+class XCorrectBatch
+{
+public:
+     XCorrectBatch()
+          :_kernel_(NULL)
+          ,_band_rows(XCOR_BAND_ROWS)
+          ,_sum_(NULL)
+          ,_avg_(NULL)
+     {}
+     ~XCorrectBatch()
+     {
+          Close();
+     }
+
+     /*
+       The kernel must be opened first and outlive the batch. thread_num 0
+       uses every hardware thread, affinity_mask 0 leaves the threads
+       unpinned.
+      */
+     bool Open(XCorrectKernel* kernel_, uint32_t thread_num = 0,
+               uint64_t affinity_mask = 0)
+     {
+          Close();
+          if(!kernel_ || !kernel_->IsOpen())
+               return 0;
+          size_t count = (size_t)kernel_->GetWidth() * kernel_->GetHeight();
+          _sum_ = (uint32_t*)_aligned_malloc(XAlignSize(count * sizeof(uint32_t)),
+                                             SSE_ALIGN_BYTE);
+          _avg_ = (uint16_t*)_aligned_malloc(XAlignSize(count * sizeof(uint16_t)),
+                                             SSE_ALIGN_BYTE);
+          if(!_sum_ || !_avg_)
+          {
+               Close();
+               return 0;
+          }
+          _avg_image._width = kernel_->GetWidth();
+          _avg_image._height = kernel_->GetHeight();
+          _avg_image._pixel_depth = 16;
+          _avg_image._data_offset = 0;
+          _avg_image._size = count * sizeof(uint16_t);
+          _avg_image._data_ = (uint8_t*)_avg_;
+          _kernel_ = kernel_;
+          return _pool.Open(thread_num, affinity_mask);
+     }
+     void Close()
+     {
+          _pool.Close();
+          if(_sum_)
+               _aligned_free(_sum_);
+          if(_avg_)
+               _aligned_free(_avg_);
+          _sum_ = NULL;
+          _avg_ = NULL;
+          _avg_image._data_ = NULL;
+          _kernel_ = NULL;
+     }
+     void SetBandRows(uint32_t rows)
+     {
+          _band_rows = rows ? rows : 1;
+     }
+     uint32_t GetThreadNum()
+     {
+          return _pool.GetThreadNum();
+     }
+
+     /*
+       Correct every frame in place.
+      */
+     bool DoCorrect(std::vector<XImage*>* images_)
+     {
+          return DoCorrect(images_, images_);
+     }
+     /*
+       Correct src_[i] into dst_[i], the vectors have the same size.
+      */
+     bool DoCorrect(std::vector<XImage*>* src_, std::vector<XImage*>* dst_)
+     {
+          if(!_kernel_ || !src_ || !dst_ || src_->size() != dst_->size())
+               return 0;
+          for(size_t i = 0; i < src_->size(); i++)
+               if(!_kernel_->CheckImage((*src_)[i]) || !_kernel_->CheckImage((*dst_)[i]))
+                    return 0;
+          XBatchJob job;
+          job._batch_ = this;
+          job._src_ = src_;
+          job._dst_ = dst_;
+          job._band_num = GetBandNum();
+          uint32_t task_num = (uint32_t)src_->size() * job._band_num;
+          _pool.Run(CorrectTask, &job, task_num);
+          //Defect pixels read their neighbours, so they go after all bands
+          if(_kernel_->GetDefectNum())
+          {
+               _kernel_->CompileDefects();
+               _pool.Run(DefectTask, &job, task_num);
+          }
+          return 1;
+     }
+     /*
+       Offset from the mean of dark frames.
+      */
+     bool CalculateOffset(std::vector<XImage*>* images_)
+     {
+          if(!Average(images_))
+               return 0;
+          return _kernel_->SetOffset(_avg_);
+     }
+     /*
+       Gain from the mean of bright frames, see XCorrectKernel::CalculateGain.
+      */
+     bool CalculateGain(std::vector<XImage*>* images_, uint32_t target)
+     {
+          if(!Average(images_))
+               return 0;
+          return _kernel_->CalculateGain(&_avg_image, target);
+     }
+     /*
+       Mean frame of the last calibration.
+      */
+     XImage* GetAverageImage()
+     {
+          return &_avg_image;
+     }
+
+private:
+     XCorrectBatch(const XCorrectBatch&);
+     XCorrectBatch& operator = (const XCorrectBatch&);
+
+     struct XBatchJob
+     {
+          XCorrectBatch* _batch_;
+          std::vector<XImage*>* _src_;
+          std::vector<XImage*>* _dst_;
+          uint32_t _band_num;
+     };
+
+     uint32_t GetBandNum()
+     {
+          return (_kernel_->GetHeight() + _band_rows - 1) / _band_rows;
+     }
+     static void CorrectTask(void* arg_, uint32_t task)
+     {
+          XBatchJob* job_ = (XBatchJob*)arg_;
+          uint32_t frame = task / job_->_band_num;
+          uint32_t row = (task % job_->_band_num) * job_->_batch_->_band_rows;
+          job_->_batch_->_kernel_->CorrectLines((*job_->_src_)[frame],
+                                                (*job_->_dst_)[frame],
+                                                row, row + job_->_batch_->_band_rows);
+     }
+     static void DefectTask(void* arg_, uint32_t task)
+     {
+          XBatchJob* job_ = (XBatchJob*)arg_;
+          uint32_t frame = task / job_->_band_num;
+          uint32_t row = (task % job_->_band_num) * job_->_batch_->_band_rows;
+          job_->_batch_->_kernel_->CorrectDefects((*job_->_dst_)[frame],
+                                                  row, row + job_->_batch_->_band_rows);
+     }
+     static void AverageTask(void* arg_, uint32_t task)
+     {
+          XBatchJob* job_ = (XBatchJob*)arg_;
+          XCorrectBatch* batch_ = job_->_batch_;
+          uint32_t width = batch_->_kernel_->GetWidth();
+          uint32_t height = batch_->_kernel_->GetHeight();
+          uint32_t row_begin = task * batch_->_band_rows;
+          uint32_t row_end = row_begin + batch_->_band_rows;
+          if(row_end > height)
+               row_end = height;
+          uint32_t frame_num = (uint32_t)job_->_src_->size();
+          for(uint32_t row = row_begin; row < row_end; row++)
+          {
+               uint32_t* sum_ = batch_->_sum_ + (size_t)row * width;
+               uint16_t* avg_ = batch_->_avg_ + (size_t)row * width;
+               memset(sum_, 0, width * sizeof(uint32_t));
+               for(uint32_t i = 0; i < frame_num; i++)
+               {
+                    const uint16_t* line_ = (*job_->_src_)[i]->GetView<uint16_t>().Row(row);
+                    for(uint32_t col = 0; col < width; col++)
+                         sum_[col] += line_[col];
+               }
+               for(uint32_t col = 0; col < width; col++)
+                    avg_[col] = (uint16_t)((sum_[col] + frame_num / 2) / frame_num);
+          }
+     }
+     bool Average(std::vector<XImage*>* images_)
+     {
+          if(!_kernel_ || !images_ || images_->empty())
+               return 0;
+          for(size_t i = 0; i < images_->size(); i++)
+               if(!_kernel_->CheckImage((*images_)[i]))
+                    return 0;
+          XBatchJob job;
+          job._batch_ = this;
+          job._src_ = images_;
+          job._dst_ = NULL;
+          job._band_num = GetBandNum();
+          _pool.Run(AverageTask, &job, job._band_num);
+          return 1;
+     }
+
+     XCorrectKernel* _kernel_;
+     XWorkerPool _pool;
+     uint32_t _band_rows;
+     uint32_t* _sum_;
+     uint16_t* _avg_;
+     XImage _avg_image;
+};
+#endif //XCORRECT_BATCH_H
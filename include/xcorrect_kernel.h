@@ -0,0 +1,700 @@
+/*
+  Copyright (c), Detection Technology Inc.
+  All right reserved.
+
+ */
+
+#ifndef XCORRECT_KERNEL_H
+#define XCORRECT_KERNEL_H
+#include "xconfigure.h"
+#include "ximage.h"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define XCOR_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define XCOR_TARGET_SSE41
+#define XCOR_TARGET_AVX2
+#else
+#include <cpuid.h>
+#define XCOR_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define XCOR_TARGET_AVX2  __attribute__((target("avx2")))
+#endif
+#endif
+
+//Kernel selected by XCorrectKernel
+#define XCOR_ISA_SCALAR   0
+#define XCOR_ISA_SSE41    1
+#define XCOR_ISA_AVX2     2
+#define XCOR_ISA_AUTO     0xFF
+
+//Gain is unsigned fixed point with XCOR_GAIN_SHIFT fraction bits. It is
+//limited to XCOR_GAIN_MAX so (pixel - offset) * gain fits in int32.
+#define XCOR_GAIN_SHIFT   12
+#define XCOR_GAIN_ONE     (1 << XCOR_GAIN_SHIFT)
+#define XCOR_GAIN_MAX     0x7FFF
+
+//Compiled defect list file
+#define XCOR_DEFECT_MAGIC   0x46454458   //"XDEF"
+#define XCOR_DEFECT_VERSION 1
+
+//Good neighbours of a defect pixel, see XDefectPixel
+#define XCOR_NB_LEFT      0x1
+#define XCOR_NB_RIGHT     0x2
+#define XCOR_NB_UP        0x4
+#define XCOR_NB_DOWN      0x8
+
+/*
+  One entry of the compiled defect list. The pixel is replaced by the mean
+  of the neighbours flagged in _nb, each weighted 1/_nb_num.
+ */
+struct XDefectPixel
+{
+     uint32_t _row;
+     uint32_t _col;
+     uint8_t  _nb;
+     uint8_t  _nb_num;
+     uint16_t _reserved;
+};
+
+/*
+  Round an allocation up to SSE_ALIGN_BYTE, aligned_alloc() needs a size
+  which is a multiple of the alignment.
+ */
+inline size_t XAlignSize(size_t size)
+{
+     return (size + SSE_ALIGN_BYTE - 1) & ~((size_t)SSE_ALIGN_BYTE - 1);
+}
+
+/*
+  out = clamp(((in - offset) * gain + round) >> XCOR_GAIN_SHIFT + baseline)
+  All kernels use the same integer steps, so their output is bit-identical.
+ */
+typedef void (*XCorrectLineFunc)(const uint16_t* in_, const uint16_t* offset_,
+                                 const uint16_t* gain_, uint16_t* out_,
+                                 uint32_t count, int32_t baseline);
+
+inline void XCorrectLineScalar(const uint16_t* in_, const uint16_t* offset_,
+                               const uint16_t* gain_, uint16_t* out_,
+                               uint32_t count, int32_t baseline)
+{
+     for(uint32_t i = 0; i < count; i++)
+     {
+          int32_t val = ((int32_t)in_[i] - (int32_t)offset_[i]) * (int32_t)gain_[i];
+          val = ((val + (XCOR_GAIN_ONE >> 1)) >> XCOR_GAIN_SHIFT) + baseline;
+          if(val < 0)
+               val = 0;
+          else if(val > 0xFFFF)
+               val = 0xFFFF;
+          out_[i] = (uint16_t)val;
+     }
+}
+
+#ifdef XCOR_X86
+XCOR_TARGET_SSE41
+inline __m128i XCorrect4Sse41(__m128i in, __m128i offset, __m128i gain,
+                              __m128i round, __m128i baseline)
+{
+     __m128i val = _mm_mullo_epi32(_mm_sub_epi32(in, offset), gain);
+     val = _mm_srai_epi32(_mm_add_epi32(val, round), XCOR_GAIN_SHIFT);
+     return _mm_add_epi32(val, baseline);
+}
+
+XCOR_TARGET_SSE41
+inline void XCorrectLineSse41(const uint16_t* in_, const uint16_t* offset_,
+                              const uint16_t* gain_, uint16_t* out_,
+                              uint32_t count, int32_t baseline)
+{
+     const __m128i round = _mm_set1_epi32(XCOR_GAIN_ONE >> 1);
+     const __m128i base = _mm_set1_epi32(baseline);
+     uint32_t i = 0;
+     for(; i + 8 <= count; i += 8)
+     {
+          __m128i in = _mm_loadu_si128((const __m128i*)(in_ + i));
+          __m128i off = _mm_loadu_si128((const __m128i*)(offset_ + i));
+          __m128i gain = _mm_loadu_si128((const __m128i*)(gain_ + i));
+          __m128i zero = _mm_setzero_si128();
+          __m128i lo = XCorrect4Sse41(_mm_unpacklo_epi16(in, zero),
+                                      _mm_unpacklo_epi16(off, zero),
+                                      _mm_unpacklo_epi16(gain, zero),
+                                      round, base);
+          __m128i hi = XCorrect4Sse41(_mm_unpackhi_epi16(in, zero),
+                                      _mm_unpackhi_epi16(off, zero),
+                                      _mm_unpackhi_epi16(gain, zero),
+                                      round, base);
+          //Unsigned saturation is the clamp to [0, 0xFFFF]
+          _mm_storeu_si128((__m128i*)(out_ + i), _mm_packus_epi32(lo, hi));
+     }
+     XCorrectLineScalar(in_ + i, offset_ + i, gain_ + i, out_ + i,
+                        count - i, baseline);
+}
+
+XCOR_TARGET_AVX2
+inline __m256i XCorrect8Avx2(const uint16_t* in_, const uint16_t* offset_,
+                             const uint16_t* gain_, __m256i round,
+                             __m256i baseline)
+{
+     __m256i in = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)in_));
+     __m256i off = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)offset_));
+     __m256i gain = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)gain_));
+     __m256i val = _mm256_mullo_epi32(_mm256_sub_epi32(in, off), gain);
+     val = _mm256_srai_epi32(_mm256_add_epi32(val, round), XCOR_GAIN_SHIFT);
+     return _mm256_add_epi32(val, baseline);
+}
+
+XCOR_TARGET_AVX2
+inline void XCorrectLineAvx2(const uint16_t* in_, const uint16_t* offset_,
+                             const uint16_t* gain_, uint16_t* out_,
+                             uint32_t count, int32_t baseline)
+{
+     const __m256i round = _mm256_set1_epi32(XCOR_GAIN_ONE >> 1);
+     const __m256i base = _mm256_set1_epi32(baseline);
+     uint32_t i = 0;
+     for(; i + 16 <= count; i += 16)
+     {
+          __m256i lo = XCorrect8Avx2(in_ + i, offset_ + i, gain_ + i, round, base);
+          __m256i hi = XCorrect8Avx2(in_ + i + 8, offset_ + i + 8, gain_ + i + 8,
+                                     round, base);
+          //packus works per 128 bit lane, put the quadwords back in order
+          __m256i val = _mm256_permute4x64_epi64(_mm256_packus_epi32(lo, hi), 0xD8);
+          _mm256_storeu_si256((__m256i*)(out_ + i), val);
+     }
+     XCorrectLineScalar(in_ + i, offset_ + i, gain_ + i, out_ + i,
+                        count - i, baseline);
+}
+#endif //XCOR_X86
+
+/*
+  Best kernel the CPU and OS support.
+ */
+inline uint32_t XCorrectDetectIsa()
+{
+#ifdef XCOR_X86
+#ifdef _MSC_VER
+     int32_t info[4];
+     __cpuid(info, 0);
+     int32_t max_leaf = info[0];
+     __cpuid(info, 1);
+     bool sse41 = (info[2] & (1 << 19)) != 0;
+     bool osxsave = (info[2] & (1 << 27)) != 0;
+     bool avx = (info[2] & (1 << 28)) != 0;
+     bool avx2 = 0;
+     if(max_leaf >= 7 && osxsave && avx
+        && (_xgetbv(0) & 0x6) == 0x6)
+     {
+          __cpuidex(info, 7, 0);
+          avx2 = (info[1] & (1 << 5)) != 0;
+     }
+     if(avx2)
+          return XCOR_ISA_AVX2;
+     if(sse41)
+          return XCOR_ISA_SSE41;
+#else
+     __builtin_cpu_init();
+     if(__builtin_cpu_supports("avx2"))
+          return XCOR_ISA_AVX2;
+     if(__builtin_cpu_supports("sse4.1"))
+          return XCOR_ISA_SSE41;
+#endif
+#endif
+     return XCOR_ISA_SCALAR;
+}
+
+/*
+  XCorrectKernel applies offset, gain and baseline to 16 bit frames in one
+  pass over memory, then replaces the pixels of a defect mask. It keeps its
+  own 16 bit offset and fixed point gain tables, built once from dark and
+  bright images or from float gains, and is meant for the per frame path
+  (e.g. every frame of a tomography run) where XCorrection::DoCorrect is
+  too slow. Frames deeper than 16 bit are left to XCorrection.
+ */
+class XCorrectKernel
+{
+public:
+     XCorrectKernel()
+          :_width(0)
+          ,_height(0)
+          ,_baseline(0)
+          ,_isa(XCOR_ISA_SCALAR)
+          ,_line_func(XCorrectLineScalar)
+          ,_offset_(NULL)
+          ,_gain_(NULL)
+          ,_defect_(NULL)
+          ,_defect_num(0)
+          ,_is_compiled(0)
+     {
+          SetIsa(XCOR_ISA_AUTO);
+     }
+     ~XCorrectKernel()
+     {
+          Close();
+     }
+
+     /*
+       Allocate the tables, offset 0, gain 1.0 and no defects.
+      */
+     bool Open(uint32_t width, uint32_t height)
+     {
+          Close();
+          if(0 == width || 0 == height)
+               return 0;
+          size_t size = XAlignSize((size_t)width * height * sizeof(uint16_t));
+          _offset_ = (uint16_t*)_aligned_malloc(size, SSE_ALIGN_BYTE);
+          _gain_ = (uint16_t*)_aligned_malloc(size, SSE_ALIGN_BYTE);
+          _defect_ = (uint8_t*)_aligned_malloc(XAlignSize((size_t)width * height),
+                                               SSE_ALIGN_BYTE);
+          if(!_offset_ || !_gain_ || !_defect_)
+          {
+               Close();
+               return 0;
+          }
+          _width = width;
+          _height = height;
+          ResetTables();
+          return 1;
+     }
+     void Close()
+     {
+          if(_offset_)
+               _aligned_free(_offset_);
+          if(_gain_)
+               _aligned_free(_gain_);
+          if(_defect_)
+               _aligned_free(_defect_);
+          _offset_ = NULL;
+          _gain_ = NULL;
+          _defect_ = NULL;
+          _width = 0;
+          _height = 0;
+          _defect_num = 0;
+          _defect_list.clear();
+          _is_compiled = 0;
+     }
+     bool IsOpen()
+     {
+          return NULL != _offset_;
+     }
+     void ResetTables()
+     {
+          uint32_t count = _width * _height;
+          memset(_offset_, 0, (size_t)count * sizeof(uint16_t));
+          for(uint32_t i = 0; i < count; i++)
+               _gain_[i] = XCOR_GAIN_ONE;
+          memset(_defect_, 0, count);
+          _defect_num = 0;
+          _defect_list.clear();
+          _is_compiled = 1;
+     }
+     /*
+       XCOR_ISA_AUTO picks the best supported kernel. A kernel the CPU
+       doesn't support falls back to the next lower one. Return the kernel
+       in use.
+      */
+     uint32_t SetIsa(uint32_t isa)
+     {
+          uint32_t best = XCorrectDetectIsa();
+          if(XCOR_ISA_AUTO == isa || isa > best)
+               isa = best;
+          _isa = isa;
+          _line_func = XCorrectLineScalar;
+#ifdef XCOR_X86
+          if(XCOR_ISA_AVX2 == isa)
+               _line_func = XCorrectLineAvx2;
+          else if(XCOR_ISA_SSE41 == isa)
+               _line_func = XCorrectLineSse41;
+#endif
+          return _isa;
+     }
+     uint32_t GetIsa()
+     {
+          return _isa;
+     }
+     void SetBaseline(uint16_t baseline)
+     {
+          _baseline = baseline;
+     }
+     uint16_t GetBaseline()
+     {
+          return _baseline;
+     }
+
+     /*
+       Offset (dark) frame, width x height pixels.
+      */
+     bool SetOffset(const uint16_t* offset_)
+     {
+          if(!_offset_ || !offset_)
+               return 0;
+          memcpy(_offset_, offset_, (size_t)_width * _height * sizeof(uint16_t));
+          return 1;
+     }
+     bool SetOffset(XImage* image_)
+     {
+          if(!CheckImage(image_))
+               return 0;
+          XImageView<uint16_t> view = image_->GetView<uint16_t>();
+          for(uint32_t row = 0; row < _height; row++)
+               memcpy(_offset_ + (size_t)row * _width, view.Row(row),
+                      _width * sizeof(uint16_t));
+          return 1;
+     }
+     /*
+       Per pixel gain factors, converted to fixed point and limited to
+       [0, XCOR_GAIN_MAX].
+      */
+     bool SetGain(const float* gain_)
+     {
+          if(!_gain_ || !gain_)
+               return 0;
+          uint32_t count = _width * _height;
+          for(uint32_t i = 0; i < count; i++)
+               _gain_[i] = ToGain(gain_[i]);
+          return 1;
+     }
+     /*
+       Gain from a bright frame, taken after SetOffset(). Each pixel is
+       scaled to target, or to the mean of the offset corrected frame when
+       target is 0. Pixels at or below offset keep gain 1.0.
+      */
+     bool CalculateGain(XImage* image_, uint32_t target)
+     {
+          if(!CheckImage(image_))
+               return 0;
+          XImageView<uint16_t> view = image_->GetView<uint16_t>();
+          if(0 == target)
+          {
+               uint64_t sum = 0;
+               for(uint32_t row = 0; row < _height; row++)
+               {
+                    const uint16_t* line_ = view.Row(row);
+                    const uint16_t* offset_ = _offset_ + (size_t)row * _width;
+                    for(uint32_t col = 0; col < _width; col++)
+                         if(line_[col] > offset_[col])
+                              sum += line_[col] - offset_[col];
+               }
+               target = (uint32_t)(sum / ((uint64_t)_width * _height));
+          }
+          for(uint32_t row = 0; row < _height; row++)
+          {
+               const uint16_t* line_ = view.Row(row);
+               const uint16_t* offset_ = _offset_ + (size_t)row * _width;
+               uint16_t* gain_ = _gain_ + (size_t)row * _width;
+               for(uint32_t col = 0; col < _width; col++)
+               {
+                    if(line_[col] > offset_[col])
+                         gain_[col] = ToGain((float)target
+                                             / (line_[col] - offset_[col]));
+                    else
+                         gain_[col] = XCOR_GAIN_ONE;
+               }
+          }
+          return 1;
+     }
+     /*
+       Mark a defect pixel, it is replaced by the mean of its good
+       4-neighbours after the gain step.
+      */
+     bool SetDefect(uint32_t row, uint32_t col, bool defect = 1)
+     {
+          if(!_defect_ || row >= _height || col >= _width)
+               return 0;
+          uint8_t& flag = _defect_[(size_t)row * _width + col];
+          if(flag != (uint8_t)defect)
+          {
+               _defect_num += defect ? 1 : -1;
+               _is_compiled = 0;
+          }
+          flag = defect;
+          return 1;
+     }
+     /*
+       Mark a whole defect row or column.
+      */
+     bool SetDefectRow(uint32_t row)
+     {
+          if(row >= _height)
+               return 0;
+          for(uint32_t col = 0; col < _width; col++)
+               SetDefect(row, col);
+          return 1;
+     }
+     bool SetDefectColumn(uint32_t col)
+     {
+          if(col >= _width)
+               return 0;
+          for(uint32_t row = 0; row < _height; row++)
+               SetDefect(row, col);
+          return 1;
+     }
+     /*
+       Merge a defect bitmap of width x height bytes, non-zero marks a
+       defect, e.g. one of the maps of a defect file.
+      */
+     bool SetDefectMap(const uint8_t* map_, uint32_t width, uint32_t height)
+     {
+          if(!_defect_ || !map_ || width != _width || height != _height)
+               return 0;
+          size_t count = (size_t)width * height;
+          for(size_t i = 0; i < count; i++)
+               if(map_[i] && !_defect_[i])
+               {
+                    _defect_[i] = 1;
+                    _defect_num++;
+               }
+          _is_compiled = 0;
+          return 1;
+     }
+     uint32_t GetDefectNum()
+     {
+          return _defect_num;
+     }
+     /*
+       Turn the defect mask into the sorted defect list with the good
+       neighbours of every pixel, so correction only touches defect pixels.
+       Correct() compiles on demand, call it before CorrectDefects().
+      */
+     void CompileDefects()
+     {
+          if(_is_compiled)
+               return;
+          _defect_list.clear();
+          _defect_list.reserve(_defect_num);
+          for(uint32_t row = 0; row < _height; row++)
+          {
+               const uint8_t* defect_ = _defect_ + (size_t)row * _width;
+               const uint8_t* end_ = defect_ + _width;
+               const uint8_t* pos_ = defect_;
+               //Rows are mostly good, skip them a word at a time
+               while(pos_ < end_)
+               {
+                    if(pos_ + sizeof(uint64_t) <= end_)
+                    {
+                         uint64_t word;
+                         memcpy(&word, pos_, sizeof(word));
+                         if(0 == word)
+                         {
+                              pos_ += sizeof(word);
+                              continue;
+                         }
+                    }
+                    if(*pos_)
+                         _defect_list.push_back(MakeDefect(row, (uint32_t)(pos_ - defect_)));
+                    pos_++;
+               }
+          }
+          _is_compiled = 1;
+     }
+     /*
+       Save the compiled defect list, LoadDefects() restores it without
+       scanning the mask again.
+       Only the positions of the file are used: the list must be sorted by
+       row and column without duplicates, the neighbours are recomputed
+       from the restored mask, so a damaged file cannot send
+       CorrectDefects() out of the frame.
+      */
+     bool SaveDefects(const char* file_)
+     {
+          if(!_defect_)
+               return 0;
+          CompileDefects();
+          FILE* fp_ = fopen(file_, "wb");
+          if(!fp_)
+               return 0;
+          uint32_t head[5] = {XCOR_DEFECT_MAGIC, XCOR_DEFECT_VERSION, _width,
+                              _height, (uint32_t)_defect_list.size()};
+          bool ret = (fwrite(head, sizeof(head), 1, fp_) == 1);
+          if(ret && !_defect_list.empty())
+               ret = (fwrite(&_defect_list[0], sizeof(XDefectPixel),
+                             _defect_list.size(), fp_) == _defect_list.size());
+          fclose(fp_);
+          return ret;
+     }
+     bool LoadDefects(const char* file_)
+     {
+          if(!_defect_)
+               return 0;
+          FILE* fp_ = fopen(file_, "rb");
+          if(!fp_)
+               return 0;
+          uint32_t head[5];
+          std::vector<XDefectPixel> list;
+          bool ret = (fread(head, sizeof(head), 1, fp_) == 1)
+               && XCOR_DEFECT_MAGIC == head[0] && XCOR_DEFECT_VERSION == head[1]
+               && _width == head[2] && _height == head[3]
+               && head[4] <= (uint64_t)_width * _height;
+          if(ret && head[4])
+          {
+               list.resize(head[4]);
+               ret = (fread(&list[0], sizeof(XDefectPixel), head[4], fp_) == head[4]);
+          }
+          fclose(fp_);
+          for(size_t i = 0; ret && i < list.size(); i++)
+               if(list[i]._row >= _height || list[i]._col >= _width
+                  || (i && !DefectLess(list[i - 1], list[i])))
+                    ret = 0;
+          if(!ret)
+               return 0;
+          memset(_defect_, 0, (size_t)_width * _height);
+          for(size_t i = 0; i < list.size(); i++)
+               _defect_[(size_t)list[i]._row * _width + list[i]._col] = 1;
+          for(size_t i = 0; i < list.size(); i++)
+               list[i] = MakeDefect(list[i]._row, list[i]._col);
+          _defect_num = (uint32_t)list.size();
+          _defect_list.swap(list);
+          _is_compiled = 1;
+          return 1;
+     }
+
+     /*
+       Correct src_ into dst_, both 16 bit frames of the opened size. dst_
+       may be src_. The line data offset bytes of dst_ are left as they are.
+      */
+     bool Correct(XImage* src_, XImage* dst_)
+     {
+          if(!CheckImage(src_) || !CheckImage(dst_))
+               return 0;
+          CorrectLines(src_, dst_, 0, _height);
+          if(_defect_num)
+          {
+               CompileDefects();
+               CorrectDefects(dst_, 0, _height);
+          }
+          return 1;
+     }
+     bool Correct(XImage* image_)
+     {
+          return Correct(image_, image_);
+     }
+     /*
+       Offset, gain and baseline for rows [row_begin, row_end) only, so row
+       bands of one frame can run on different threads. The images must
+       pass CheckImage().
+      */
+     void CorrectLines(XImage* src_, XImage* dst_, uint32_t row_begin,
+                       uint32_t row_end)
+     {
+          XImageView<uint16_t> src = src_->GetView<uint16_t>();
+          XImageView<uint16_t> dst = dst_->GetView<uint16_t>();
+          for(uint32_t row = row_begin; row < row_end && row < _height; row++)
+          {
+               size_t pos = (size_t)row * _width;
+               _line_func(src.Row(row), _offset_ + pos, _gain_ + pos,
+                          dst.Row(row), _width, _baseline);
+          }
+     }
+     /*
+       Defect replacement for rows [row_begin, row_end), after CorrectLines()
+       has finished for the whole frame and CompileDefects() was called.
+       Only good pixels are read and only defect pixels are written, so
+       bands may run in parallel.
+      */
+     void CorrectDefects(XImage* image_, uint32_t row_begin, uint32_t row_end)
+     {
+          XImageView<uint16_t> view = image_->GetView<uint16_t>();
+          XDefectPixel first;
+          first._row = row_begin;
+          std::vector<XDefectPixel>::const_iterator it =
+               std::lower_bound(_defect_list.begin(), _defect_list.end(),
+                                first, DefectRowLess);
+          for(; it != _defect_list.end() && it->_row < row_end; ++it)
+          {
+               if(0 == it->_nb_num)
+                    continue;
+               uint16_t* line_ = view.Row(it->_row);
+               uint32_t col = it->_col;
+               uint32_t sum = 0;
+               if(it->_nb & XCOR_NB_LEFT)
+                    sum += line_[col - 1];
+               if(it->_nb & XCOR_NB_RIGHT)
+                    sum += line_[col + 1];
+               if(it->_nb & XCOR_NB_UP)
+                    sum += view.Row(it->_row - 1)[col];
+               if(it->_nb & XCOR_NB_DOWN)
+                    sum += view.Row(it->_row + 1)[col];
+               line_[col] = (uint16_t)((sum + it->_nb_num / 2) / it->_nb_num);
+          }
+     }
+     /*
+       A 16 bit frame of the opened size.
+      */
+     bool CheckImage(XImage* image_)
+     {
+          return _offset_ && image_ && image_->_data_
+               && image_->_width == _width && image_->_height == _height
+               && image_->IsPixelType<uint16_t>();
+     }
+     uint32_t GetWidth()
+     {
+          return _width;
+     }
+     uint32_t GetHeight()
+     {
+          return _height;
+     }
+
+private:
+     XCorrectKernel(const XCorrectKernel&);
+     XCorrectKernel& operator = (const XCorrectKernel&);
+
+     static bool DefectRowLess(const XDefectPixel& a, const XDefectPixel& b)
+     {
+          return a._row < b._row;
+     }
+     static bool DefectLess(const XDefectPixel& a, const XDefectPixel& b)
+     {
+          return a._row < b._row || (a._row == b._row && a._col < b._col);
+     }
+     /*
+       List entry of the defect at (row, col) with its good 4-neighbours in
+       the mask.
+      */
+     XDefectPixel MakeDefect(uint32_t row, uint32_t col)
+     {
+          const uint8_t* defect_ = _defect_ + (size_t)row * _width;
+          XDefectPixel pixel;
+          pixel._row = row;
+          pixel._col = col;
+          pixel._nb = 0;
+          pixel._reserved = 0;
+          if(col > 0 && !defect_[col - 1])
+               pixel._nb |= XCOR_NB_LEFT;
+          if(col + 1 < _width && !defect_[col + 1])
+               pixel._nb |= XCOR_NB_RIGHT;
+          if(row > 0 && !(defect_ - _width)[col])
+               pixel._nb |= XCOR_NB_UP;
+          if(row + 1 < _height && !(defect_ + _width)[col])
+               pixel._nb |= XCOR_NB_DOWN;
+          pixel._nb_num = (uint8_t)(((pixel._nb >> 0) & 1)
+                                    + ((pixel._nb >> 1) & 1)
+                                    + ((pixel._nb >> 2) & 1)
+                                    + ((pixel._nb >> 3) & 1));
+          return pixel;
+     }
+     static uint16_t ToGain(float gain)
+     {
+          float val = gain * XCOR_GAIN_ONE + 0.5f;
+          if(!(val > 0))
+               return 0;
+          if(val > XCOR_GAIN_MAX)
+               return XCOR_GAIN_MAX;
+          return (uint16_t)val;
+     }
+
+     uint32_t _width;
+     uint32_t _height;
+     uint16_t _baseline;
+     uint32_t _isa;
+     XCorrectLineFunc _line_func;
+     uint16_t* _offset_;
+     uint16_t* _gain_;
+     uint8_t*  _defect_;
+     uint32_t  _defect_num;
+     std::vector<XDefectPixel> _defect_list;     //Sorted by row, then column
+     bool      _is_compiled;
+};
+#endif //XCORRECT_KERNEL_H
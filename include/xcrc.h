@@ -1,10 +1,183 @@
 #ifndef XCRC_H
 #define XCRC_H
 #include <cassert>
+#include <stddef.h>
 #include <stdint.h>
+#include <string.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define XCRC_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define XCRC_TARGET_PCLMUL
+#else
+#define XCRC_TARGET_PCLMUL __attribute__((target("pclmul,ssse3")))
+#endif
+#endif
+
+//Tables built by the compiler from C++14 on, at first use before
+#if __cplusplus >= 201402L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201402L)
+#define XCRC_CONSTEXPR_TABLE 1
+#define XCRC_CONSTEXPR constexpr
+#else
+#define XCRC_CONSTEXPR
+#endif
 
 #define XCRC32_KEY	0x04c11db7
 
+/*
+  Slicing by 8 tables of the XCRC32_KEY CRC, MSB first. _table[k][b] is the
+  CRC of byte b followed by k zero bytes, _table[0] is the classic table.
+ */
+struct XCrcTables
+{
+     uint32_t _table[8][256];
+};
+
+inline XCRC_CONSTEXPR XCrcTables XMakeCrcTables()
+{
+     XCrcTables tables = {};
+     for(uint32_t i = 0; i < 256; i++)
+     {
+          uint32_t crc = i << 24;
+          for(uint32_t j = 0; j < 8; j++)
+               crc = (crc << 1) ^ ((crc & 0x80000000) ? XCRC32_KEY : 0);
+          tables._table[0][i] = crc;
+     }
+     for(uint32_t k = 1; k < 8; k++)
+          for(uint32_t i = 0; i < 256; i++)
+          {
+               uint32_t prev = tables._table[k - 1][i];
+               tables._table[k][i] = (prev << 8) ^ tables._table[0][prev >> 24];
+          }
+     return tables;
+}
+
+#ifdef XCRC_CONSTEXPR_TABLE
+template <typename T = void>
+struct XCrcTableHolder
+{
+     static constexpr XCrcTables _tables = XMakeCrcTables();
+};
+template <typename T>
+constexpr XCrcTables XCrcTableHolder<T>::_tables;
+
+inline const XCrcTables& XGetCrcTables()
+{
+     return XCrcTableHolder<>::_tables;
+}
+#else
+inline const XCrcTables& XGetCrcTables()
+{
+     static const XCrcTables tables = XMakeCrcTables();
+     return tables;
+}
+#endif
+
+/*
+  Continue the CRC register crc over size bytes, 8 bytes per step.
+ */
+inline uint32_t XCrcUpdateSlice8(uint32_t crc, const uint8_t* data_, size_t size)
+{
+     const XCrcTables& tables = XGetCrcTables();
+     const uint32_t (*t_)[256] = tables._table;
+     for(; size >= 8; size -= 8, data_ += 8)
+     {
+          uint32_t word = crc ^ (((uint32_t)data_[0] << 24) | ((uint32_t)data_[1] << 16)
+                                 | ((uint32_t)data_[2] << 8) | data_[3]);
+          crc = t_[7][word >> 24] ^ t_[6][(word >> 16) & 0xFF]
+               ^ t_[5][(word >> 8) & 0xFF] ^ t_[4][word & 0xFF]
+               ^ t_[3][data_[4]] ^ t_[2][data_[5]]
+               ^ t_[1][data_[6]] ^ t_[0][data_[7]];
+     }
+     for(; size; size--)
+          crc = (crc << 8) ^ t_[0][((crc >> 24) ^ *data_++) & 0xFF];
+     return crc;
+}
+
+#ifdef XCRC_X86
+/*
+  x^(n + 64) mod P and x^n mod P for folding 128 bit blocks n bits ahead.
+ */
+#define XCRC_FOLD_128_HI  0xC5B9CD4C
+#define XCRC_FOLD_128_LO  0xE8A45605
+#define XCRC_FOLD_512_HI  0x8833794C
+#define XCRC_FOLD_512_LO  0xE6228B11
+
+XCRC_TARGET_PCLMUL
+inline __m128i XCrcFold(__m128i acc, __m128i key, __m128i block)
+{
+     return _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(acc, key, 0x11),
+                                        _mm_clmulepi64_si128(acc, key, 0x00)), block);
+}
+
+/*
+  Carry-less multiply folding. Blocks are byte swapped so that bit i of a
+  lane is the coefficient of x^i, four accumulators are folded 512 bits at
+  a time and then into one, whose 16 bytes leave the same remainder as the
+  data and finish in XCrcUpdateSlice8(). size must be at least 64.
+ */
+XCRC_TARGET_PCLMUL
+inline uint32_t XCrcUpdatePclmul(uint32_t crc, const uint8_t* data_, size_t size)
+{
+     const __m128i swap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+     const __m128i key_512 = _mm_set_epi64x(XCRC_FOLD_512_HI, XCRC_FOLD_512_LO);
+     const __m128i key_128 = _mm_set_epi64x(XCRC_FOLD_128_HI, XCRC_FOLD_128_LO);
+     const __m128i* in_ = (const __m128i*)data_;
+     __m128i x0 = _mm_shuffle_epi8(_mm_loadu_si128(in_), swap);
+     __m128i x1 = _mm_shuffle_epi8(_mm_loadu_si128(in_ + 1), swap);
+     __m128i x2 = _mm_shuffle_epi8(_mm_loadu_si128(in_ + 2), swap);
+     __m128i x3 = _mm_shuffle_epi8(_mm_loadu_si128(in_ + 3), swap);
+     //The register acts as the first 32 bits of the data
+     x0 = _mm_xor_si128(x0, _mm_set_epi32((int32_t)crc, 0, 0, 0));
+     in_ += 4;
+     size -= 64;
+     for(; size >= 64; size -= 64, in_ += 4)
+     {
+          x0 = XCrcFold(x0, key_512, _mm_shuffle_epi8(_mm_loadu_si128(in_), swap));
+          x1 = XCrcFold(x1, key_512, _mm_shuffle_epi8(_mm_loadu_si128(in_ + 1), swap));
+          x2 = XCrcFold(x2, key_512, _mm_shuffle_epi8(_mm_loadu_si128(in_ + 2), swap));
+          x3 = XCrcFold(x3, key_512, _mm_shuffle_epi8(_mm_loadu_si128(in_ + 3), swap));
+     }
+     x1 = XCrcFold(x0, key_128, x1);
+     x2 = XCrcFold(x1, key_128, x2);
+     x3 = XCrcFold(x2, key_128, x3);
+     for(; size >= 16; size -= 16, in_++)
+          x3 = XCrcFold(x3, key_128, _mm_shuffle_epi8(_mm_loadu_si128(in_), swap));
+     uint8_t rest[16];
+     _mm_storeu_si128((__m128i*)rest, _mm_shuffle_epi8(x3, swap));
+     crc = XCrcUpdateSlice8(0, rest, sizeof(rest));
+     return XCrcUpdateSlice8(crc, (const uint8_t*)in_, size);
+}
+
+inline bool XCrcHasPclmul()
+{
+#ifdef _MSC_VER
+     int32_t info[4];
+     __cpuid(info, 1);
+     return (info[2] & (1 << 1)) && (info[2] & (1 << 9));
+#else
+     __builtin_cpu_init();
+     return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("ssse3");
+#endif
+}
+#endif //XCRC_X86
+
+/*
+  Continue the XCRC32_KEY register crc over size bytes with the fastest
+  path of the CPU.
+ */
+inline uint32_t XCrcUpdate(uint32_t crc, const uint8_t* data_, size_t size)
+{
+#ifdef XCRC_X86
+     static const bool has_pclmul = XCrcHasPclmul();
+     if(size >= 64 && has_pclmul)
+          return XCrcUpdatePclmul(crc, data_, size);
+#endif
+     return XCrcUpdateSlice8(crc, data_, size);
+}
+
 class XCrc
 {
 public:
@@ -72,6 +245,14 @@ public:
 	  _register = (_register << 8) ^
 	       _table[((_register >> 24) ^ byte) & 0xff];
      };
+     /*
+       Same as PutByte() on each of size bytes, 8 bytes per step or with
+       PCLMULQDQ folding.
+      */
+     void Update (const uint8_t* data_, size_t size)
+     {
+	  _register = XCrcUpdate(_register, data_, size);
+     }
 private:
      class Table
      {
@@ -84,17 +265,8 @@ private:
 	       if (key == _key)
 		    return;
 	       _key = key;
-		
-	       unsigned int  i, j, k;
-
-	       for( i = 0; i < 256; i++ )
-	       {
-		    k = 0;
-		    for( j = (i << 24) | 0x800000; j != 0x80000000; j <<= 1 )
-			 k = (k << 1) ^ (((k ^ j) & 0x80000000)
-					 ? 0x04c11db7 : 0);
-		    _table[i] = k;
-	       }
+	       //Copy of the shared table, PutByte() stays a member lookup
+	       memcpy(_table, XGetCrcTables()._table[0], sizeof(_table));
 	  };
 	  XCrc::Type operator [] (unsigned i)
 	  {
@@ -0,0 +1,193 @@
+/*
+  Copyright (c), Detection Technology Inc.
+  All right reserved.
+
+ */
+
+#ifndef XCRC_FILE_H
+#define XCRC_FILE_H
+#include "xconfigure.h"
+#include "ximage.h"
+#include "xcrc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+//Result of XCheckFileCrc()
+#define XCRC_FILE_OK        0
+#define XCRC_FILE_MISSING   1   //No readable .crc file, nothing was checked
+#define XCRC_FILE_SIZE      2   //The file is shorter or longer than recorded
+#define XCRC_FILE_MISMATCH  3   //The file or a frame does not match its CRC
+#define XCRC_FILE_ERROR     4   //The file cannot be read
+
+#define XCRC_READ_SIZE      0x100000
+
+/*
+  CRC32 of a file as written by XWriteCrcFile(). The CRCs are XFastCrc
+  registers over the bytes, XCRC32_KEY without final xor. _frame_crcs holds
+  one CRC per frame of _frame_size bytes for .dat files, empty for other
+  files such as the gain and offset files.
+ */
+struct XCrcInfo
+{
+     uint64_t _size;
+     uint32_t _crc;
+     uint64_t _frame_size;
+     std::vector<uint32_t> _frame_crcs;
+};
+
+inline void XClearCrcInfo(XCrcInfo& info)
+{
+     info._size = 0;
+     info._crc = 0xFFFFFFFF;
+     info._frame_size = 0;
+     info._frame_crcs.clear();
+}
+/*
+  Continue crc over the pixels of image_ as a .dat file stores them, the
+  line info in front of each line is left out.
+ */
+inline void XImageCrc(XImage* image_, XFastCrc& crc)
+{
+     uint32_t line_size = image_->_width * ((image_->_pixel_depth > 16) ? 4 : 2);
+     if(0 == image_->_data_offset)
+     {
+          crc.Update(image_->_data_, (size_t)line_size * image_->_height);
+          return;
+     }
+     for(uint32_t row = 0; row < image_->_height; row++)
+          crc.Update(image_->GetLineAddr(row) + image_->_data_offset, line_size);
+}
+/*
+  Name of the CRC file of file_, "dir/gain.dat" -> "dir/gain.dat.crc".
+ */
+inline std::string XCrcFileName(const char* file_)
+{
+     return std::string(file_) + ".crc";
+}
+/*
+  Read file_ and compute its CRC, and the CRC of each frame when
+  frame_size is not 0.
+ */
+inline bool XComputeFileCrc(const char* file_, XCrcInfo& info, uint64_t frame_size = 0)
+{
+     XClearCrcInfo(info);
+     info._frame_size = frame_size;
+     FILE* in_ = fopen(file_, "rb");
+     if(!in_)
+          return 0;
+     std::vector<uint8_t> buf(XCRC_READ_SIZE);
+     XFastCrc file_crc(XCRC32_KEY);
+     XFastCrc frame_crc(XCRC32_KEY);
+     uint64_t frame_left = frame_size;
+     size_t size;
+     while((size = fread(&buf[0], 1, buf.size(), in_)) > 0)
+     {
+          file_crc.Update(&buf[0], size);
+          info._size += size;
+          for(size_t pos = 0; frame_size && pos < size; )
+          {
+               size_t part = (size_t)((frame_left < size - pos) ? frame_left : size - pos);
+               frame_crc.Update(&buf[pos], part);
+               pos += part;
+               frame_left -= part;
+               if(0 == frame_left)
+               {
+                    info._frame_crcs.push_back(frame_crc.Done());
+                    frame_left = frame_size;
+               }
+          }
+     }
+     bool ret = !ferror(in_);
+     fclose(in_);
+     info._crc = file_crc.Done();
+     return ret;
+}
+/*
+  Write the CRC file of file_ in the key=value layout of the .txt header
+  files, the frame CRCs one per line.
+ */
+inline bool XWriteCrcFile(const char* file_, const XCrcInfo& info)
+{
+     FILE* out_ = fopen(XCrcFileName(file_).c_str(), "w");
+     if(!out_)
+          return 0;
+     fprintf(out_, "Size=%llu\n", (unsigned long long)info._size);
+     fprintf(out_, "CRC32=%08X\n", info._crc);
+     if(!info._frame_crcs.empty())
+     {
+          fprintf(out_, "FrameSize=%llu\n", (unsigned long long)info._frame_size);
+          for(size_t i = 0; i < info._frame_crcs.size(); i++)
+               fprintf(out_, "Frame=%08X\n", info._frame_crcs[i]);
+     }
+     return 0 == fclose(out_);
+}
+/*
+  Compute and record the CRC of a file already written, e.g. right after
+  XCorrection::SaveGainFile() / SaveOffsetFile().
+ */
+inline bool XWriteFileCrc(const char* file_, uint64_t frame_size = 0)
+{
+     XCrcInfo info;
+     return XComputeFileCrc(file_, info, frame_size) && XWriteCrcFile(file_, info);
+}
+inline bool XReadCrcFile(const char* file_, XCrcInfo& info)
+{
+     XClearCrcInfo(info);
+     FILE* in_ = fopen(XCrcFileName(file_).c_str(), "r");
+     if(!in_)
+          return 0;
+     bool has_crc = 0;
+     char line[256];
+     while(fgets(line, sizeof(line), in_))
+     {
+          char* value_ = strchr(line, '=');
+          if(!value_)
+               continue;
+          *value_++ = 0;
+          if(0 == strcmp(line, "Size"))
+               info._size = strtoull(value_, NULL, 10);
+          else if(0 == strcmp(line, "CRC32"))
+          {
+               info._crc = (uint32_t)strtoul(value_, NULL, 16);
+               has_crc = 1;
+          }
+          else if(0 == strcmp(line, "FrameSize"))
+               info._frame_size = strtoull(value_, NULL, 10);
+          else if(0 == strcmp(line, "Frame"))
+               info._frame_crcs.push_back((uint32_t)strtoul(value_, NULL, 16));
+     }
+     fclose(in_);
+     return has_crc;
+}
+/*
+  Check file_ against its CRC file, e.g. before
+  XCorrection::LoadGainFile(). On XCRC_FILE_MISMATCH bad_frame_ gets the
+  first frame that differs, or the frame number if only the whole file
+  CRC differs.
+ */
+inline uint32_t XCheckFileCrc(const char* file_, uint32_t* bad_frame_ = NULL)
+{
+     XCrcInfo expect;
+     XCrcInfo info;
+     if(!XReadCrcFile(file_, expect))
+          return XCRC_FILE_MISSING;
+     if(!XComputeFileCrc(file_, info, expect._frame_size))
+          return XCRC_FILE_ERROR;
+     if(info._size != expect._size)
+          return XCRC_FILE_SIZE;
+     if(info._crc == expect._crc && info._frame_crcs == expect._frame_crcs)
+          return XCRC_FILE_OK;
+     if(bad_frame_)
+     {
+          size_t i = 0;
+          while(i < info._frame_crcs.size() && i < expect._frame_crcs.size()
+                && info._frame_crcs[i] == expect._frame_crcs[i])
+               i++;
+          *bad_frame_ = (uint32_t)i;
+     }
+     return XCRC_FILE_MISMATCH;
+}
+#endif //XCRC_FILE_H
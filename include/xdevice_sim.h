@@ -0,0 +1,708 @@
+/*
+  Copyright (c), Detection Technology Inc.
+  All right reserved.
+
+ */
+
+#ifndef XDEVICE_SIM_H
+#define XDEVICE_SIM_H
+#ifdef __linux__
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+#include "xconfigure.h"
+#include "xcrc.h"
+#include "xudpimg_parse.h"
+
+#define XSIM_DEVICE_IP      "127.0.0.2"  //The SDK binds the same ports on the host
+#define XSIM_BROAD_PORT     7000
+#define XSIM_CMD_PORT       3000
+#define XSIM_IMG_PORT       4001
+
+//Command codes
+#define XSIM_CMD_BROADCAST  0x01         //Discovery, answered on XSIM_BROAD_PORT
+#define XSIM_CMD_GRAB       0x60         //Written non zero on open, zero on close
+#define XSIM_CMD_GEOMETRY   0x64         //Rows and columns, BE16 each
+#define XSIM_CMD_HEALTH     0xFF         //Sent by the device every heartbeat
+
+#define XSIM_OP_WRITE       0x01
+#define XSIM_OP_READ        0x02
+
+//CMD byte of the image packets
+#define XSIM_IMG_HEADER     0x00
+#define XSIM_IMG_PAYLOAD    0x01
+
+#define XSIM_CMD_OVERHEAD   12           //Command frame without data
+#define XSIM_SERIAL_SIZE    32
+#define XSIM_HEALTH_SIZE    24
+#define XSIM_SEND_BATCH     64           //Packets per sendmmsg()
+#define XSIM_PAYLOAD_SIZE   8192         //Image payload bytes per packet, jumbo frames
+
+/*
+  Settings of XDeviceSim, see XInitSimConfig() for the defaults. The
+  impairments are per packet probabilities between 0 and 1.
+ */
+struct XSimConfig
+{
+     char     _device_ip[16];
+     char     _host_ip[16];     //Image target, "" to take the command sender
+     uint16_t _broad_port;
+     uint16_t _cmd_port;
+     uint16_t _img_port;        //Host port the image packets go to
+     uint32_t _width;
+     uint32_t _height;
+     uint32_t _pixel_depth;
+     uint32_t _payload_size;    //Whole lines are packed up to this size
+     double   _frame_rate;      //Frames per second, 0 as fast as possible
+     uint32_t _frame_num;       //Frames per grab, 0 until stopped
+     double   _loss;
+     double   _reorder;         //Packet swapped with the next one
+     double   _duplicate;
+     uint32_t _seed;
+     bool     _is_auto_start;   //Stream without waiting for XSIM_CMD_GRAB
+     char     _serial[XSIM_SERIAL_SIZE];
+};
+
+inline void XInitSimConfig(XSimConfig& config)
+{
+     memset(&config, 0, sizeof(config));
+     strcpy(config._device_ip, XSIM_DEVICE_IP);
+     config._broad_port = XSIM_BROAD_PORT;
+     config._cmd_port = XSIM_CMD_PORT;
+     config._img_port = XSIM_IMG_PORT;
+     config._width = 1400;
+     config._height = 1200;
+     config._pixel_depth = 16;
+     config._payload_size = XSIM_PAYLOAD_SIZE;
+     config._frame_rate = 10;
+     config._seed = 1;
+     strcpy(config._serial, "3000030367-SIM00001");
+}
+
+/*
+  Counters of XDeviceSim. _lost, _reordered and _duplicated are the
+  injected impairments.
+ */
+struct XSimStats
+{
+     uint64_t _frames;
+     uint64_t _packets;
+     uint64_t _bytes;
+     uint64_t _lost;
+     uint64_t _reordered;
+     uint64_t _duplicated;
+     uint64_t _commands;
+     uint64_t _bad_commands;    //Framing or CRC errors, not answered
+     uint64_t _discoveries;
+};
+
+/*
+  XDeviceSim plays an X-Panel on the loopback so that XSystem, XCommand,
+  XAcquisition and the image parsers can be driven without the detector.
+  It answers the discovery broadcast, the command channel and sends the
+  health packet every XCMD_HEARTBEAT_INTERVAL_SECONDS, like the captures
+  in network/. The command frame is
+    XCMD_START_CODE x2, cmd, operation / error code, BE16 data size, data,
+    BE32 XFastCrc over cmd..data, XCMD_END_CODE x2.
+  Reads return the register values the 1412i gave in the captures, writes
+  are stored and read back.
+  Frames are streamed while XSIM_CMD_GRAB holds a non zero value: one
+  HEADER_SIZE header packet with FRAME_ID, LINE_STAMP and FRAME_SIZE (in
+  lines), then payload packets with LINE_ID, PACKET_ID and PAYLOAD_SIZE.
+  Multi byte fields are big endian, the pixels little endian as in .dat
+  files. Lines longer than _payload_size are split, shorter ones packed
+  whole into one packet. The pixel is (row + col + frame id) masked to the
+  pixel depth, so a receiver can check every frame.
+ */
+class XDeviceSim
+{
+public:
+     XDeviceSim()
+          :_broad_fd(-1)
+          ,_cmd_fd(-1)
+          ,_img_fd(-1)
+          ,_is_stop(0)
+          ,_is_host_set(0)
+          ,_is_grab(0)
+          ,_frame_id(0)
+          ,_line_stamp(0)
+          ,_last_err(0)
+          ,_crc(XCRC32_KEY)
+     {
+          memset(&_config, 0, sizeof(_config));
+          memset(&_stats, 0, sizeof(_stats));
+          memset(&_host, 0, sizeof(_host));
+          memset(&_cmd_peer, 0, sizeof(_cmd_peer));
+     }
+     ~XDeviceSim()
+     {
+          Close();
+     }
+
+     bool Open(const XSimConfig& config)
+     {
+          Close();
+          uint32_t pixel_byte = (config._pixel_depth > 16) ? 4 : 2;
+          uint32_t line_bytes = config._width * pixel_byte;
+          //PACKET_ID is one byte, PAYLOAD_SIZE two
+          if(0 == config._width || 0 == config._height || 0 == config._pixel_depth
+             || config._pixel_depth > 32 || config._height > MAX_LINE_NUM
+             || config._payload_size < 2 || config._payload_size > 0xFFFF
+             || (line_bytes + config._payload_size - 1) / config._payload_size > 256)
+          {
+               _last_err = EINVAL;
+               return 0;
+          }
+          _config = config;
+          memset(&_stats, 0, sizeof(_stats));
+          _frame_id = 0;
+          _line_stamp = 0;
+          _is_stop = 0;
+          _is_host_set = 0;
+          InitRegisters();
+          if(_config._host_ip[0])
+          {
+               _host.sin_family = AF_INET;
+               _host.sin_port = htons(_config._img_port);
+               _is_host_set = (1 == inet_pton(AF_INET, _config._host_ip, &_host.sin_addr));
+          }
+          _is_grab = _config._is_auto_start && _is_host_set;
+          _broad_fd = OpenSocket("0.0.0.0", _config._broad_port);
+          _cmd_fd = OpenSocket(_config._device_ip, _config._cmd_port);
+          _img_fd = OpenSocket(_config._device_ip, _config._img_port);
+          if(_broad_fd < 0 || _cmd_fd < 0 || _img_fd < 0)
+          {
+               Close();
+               return 0;
+          }
+          _cmd_thread = std::thread(&XDeviceSim::CmdProc, this);
+          _img_thread = std::thread(&XDeviceSim::ImgProc, this);
+          return 1;
+     }
+     void Close()
+     {
+          {
+               std::lock_guard<std::mutex> lock(_mutex);
+               _is_stop = 1;
+          }
+          _grab_cond.notify_all();
+          if(_cmd_thread.joinable())
+               _cmd_thread.join();
+          if(_img_thread.joinable())
+               _img_thread.join();
+          if(_broad_fd >= 0)
+               close(_broad_fd);
+          if(_cmd_fd >= 0)
+               close(_cmd_fd);
+          if(_img_fd >= 0)
+               close(_img_fd);
+          _broad_fd = -1;
+          _cmd_fd = -1;
+          _img_fd = -1;
+     }
+     /*
+       Start or stop streaming as a write to XSIM_CMD_GRAB does. Return 0
+       while no host is known.
+      */
+     bool SetGrab(bool is_grab)
+     {
+          std::lock_guard<std::mutex> lock(_mutex);
+          if(is_grab && !_is_host_set)
+               return 0;
+          _is_grab = is_grab;
+          _grab_cond.notify_all();
+          return 1;
+     }
+     bool IsGrabbing()
+     {
+          std::lock_guard<std::mutex> lock(_mutex);
+          return _is_grab;
+     }
+     void GetStats(XSimStats& stats)
+     {
+          std::lock_guard<std::mutex> lock(_mutex);
+          stats = _stats;
+     }
+     /*
+       Set the value read back for command code cmd.
+      */
+     void SetRegister(uint8_t cmd, const uint8_t* data_, uint16_t size)
+     {
+          std::lock_guard<std::mutex> lock(_mutex);
+          _regs[cmd].assign(data_, data_ + size);
+     }
+     int32_t GetLastError()
+     {
+          return _last_err;
+     }
+
+private:
+     XDeviceSim(const XDeviceSim&);
+     XDeviceSim& operator = (const XDeviceSim&);
+
+     /*
+       One image packet, the payload is sent from the frame buffer.
+      */
+     struct XSimPacket
+     {
+          uint8_t  _head[HEADER_SIZE];
+          uint32_t _head_size;
+          uint32_t _offset;       //Payload position in the frame
+          uint32_t _size;
+     };
+
+     static void PutBE16(uint8_t* data_, uint16_t value)
+     {
+          data_[0] = (uint8_t)(value >> 8);
+          data_[1] = (uint8_t)value;
+     }
+     static void PutBE32(uint8_t* data_, uint32_t value)
+     {
+          PutBE16(data_, (uint16_t)(value >> 16));
+          PutBE16(data_ + 2, (uint16_t)value);
+     }
+     int32_t OpenSocket(const char* ip_, uint16_t port)
+     {
+          int32_t fd = socket(AF_INET, SOCK_DGRAM, 0);
+          if(fd < 0)
+          {
+               _last_err = errno;
+               return -1;
+          }
+          int32_t on = 1;
+          int32_t buf_size = 8 * 1024 * 1024;
+          setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+          setsockopt(fd, SOL_SOCKET, SO_BROADCAST, &on, sizeof(on));
+          setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &buf_size, sizeof(buf_size));
+          sockaddr_in addr;
+          memset(&addr, 0, sizeof(addr));
+          addr.sin_family = AF_INET;
+          addr.sin_port = htons(port);
+          if(1 != inet_pton(AF_INET, ip_, &addr.sin_addr)
+             || bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0)
+          {
+               _last_err = errno ? errno : EINVAL;
+               close(fd);
+               return -1;
+          }
+          return fd;
+     }
+     void InitRegisters()
+     {
+          //Replies of an X-Panel 1412i, network/findDevices_imgCmdChannel.pcapng
+          static const struct
+          {
+               uint8_t _cmd;
+               uint8_t _size;
+               uint8_t _data[8];
+          } defaults[] = {
+               {0x22, 1, {0x00}},
+               {0x23, 2, {0x00, 0x01}},
+               {0x40, 1, {0x00}},
+               {0x43, 1, {0x02}},
+               {0x68, 2, {0x02, 0x01}},
+               {0x6F, 4, {0x00, 0x02, 0x00, 0x02}},
+               {0x78, 4, {0x00, 0x00, 0x0A, 0xBB}},
+               {0xB0, 1, {0x00}},
+               {0xB1, 8, {0x00, 0x03, 0x04, 0xAE, 0x00, 0x01, 0x05, 0x78}}};
+          for(uint32_t i = 0; i < 256; i++)
+               _regs[i].clear();
+          for(size_t i = 0; i < sizeof(defaults) / sizeof(defaults[0]); i++)
+               _regs[defaults[i]._cmd].assign(defaults[i]._data,
+                                              defaults[i]._data + defaults[i]._size);
+          uint8_t geometry[4];
+          PutBE16(geometry, (uint16_t)_config._height);
+          PutBE16(geometry + 2, (uint16_t)_config._width);
+          _regs[XSIM_CMD_GEOMETRY].assign(geometry, geometry + 4);
+     }
+     size_t MakeCmdFrame(uint8_t* buf_, uint8_t cmd, uint8_t code,
+                         const uint8_t* data_, uint16_t size)
+     {
+          buf_[0] = XCMD_START_CODE;
+          buf_[1] = XCMD_START_CODE;
+          buf_[2] = cmd;
+          buf_[3] = code;
+          PutBE16(buf_ + 4, size);
+          if(size)
+               memcpy(buf_ + 6, data_, size);
+          _crc.Update(buf_ + 2, 4u + size);
+          PutBE32(buf_ + 6 + size, _crc.Done());
+          buf_[10 + size] = XCMD_END_CODE;
+          buf_[11 + size] = XCMD_END_CODE;
+          return XSIM_CMD_OVERHEAD + size;
+     }
+     /*
+       Check framing and CRC of a received command, return its data size
+       or -1.
+      */
+     int32_t CheckCmdFrame(const uint8_t* buf_, size_t len)
+     {
+          if(len < XSIM_CMD_OVERHEAD || XCMD_START_CODE != buf_[0]
+             || XCMD_START_CODE != buf_[1])
+               return -1;
+          uint16_t size = (uint16_t)((buf_[4] << 8) | buf_[5]);
+          if(XSIM_CMD_OVERHEAD + (size_t)size > len || XCMD_END_CODE != buf_[10 + size]
+             || XCMD_END_CODE != buf_[11 + size])
+               return -1;
+          _crc.Update(buf_ + 2, 4u + size);
+          uint32_t crc = ((uint32_t)buf_[6 + size] << 24) | ((uint32_t)buf_[7 + size] << 16)
+               | ((uint32_t)buf_[8 + size] << 8) | buf_[9 + size];
+          return (_crc.Done() == crc) ? size : -1;
+     }
+     void OnBroadcast()
+     {
+          uint8_t buf[XCMD_BUF_SIZE];
+          sockaddr_in from;
+          socklen_t from_len = sizeof(from);
+          ssize_t len = recvfrom(_broad_fd, buf, sizeof(buf), 0, (sockaddr*)&from, &from_len);
+          if(len <= 0)
+               return;
+          if(CheckCmdFrame(buf, (size_t)len) < 0 || XSIM_CMD_BROADCAST != buf[2])
+          {
+               std::lock_guard<std::mutex> lock(_mutex);
+               _stats._bad_commands++;
+               return;
+          }
+          //Serial, IP, MAC, command port, image port
+          uint8_t info[XSIM_SERIAL_SIZE + 14];
+          memset(info, 0, sizeof(info));
+          memcpy(info, _config._serial, strnlen(_config._serial, XSIM_SERIAL_SIZE));
+          in_addr ip;
+          inet_pton(AF_INET, _config._device_ip, &ip);
+          memcpy(info + XSIM_SERIAL_SIZE, &ip, 4);
+          static const uint8_t mac[6] = {0x00, 0x52, 0xC2, 0x53, 0x90, 0x00};
+          memcpy(info + XSIM_SERIAL_SIZE + 4, mac, 6);
+          PutBE16(info + XSIM_SERIAL_SIZE + 10, _config._cmd_port);
+          PutBE16(info + XSIM_SERIAL_SIZE + 12, _config._img_port);
+          uint8_t reply[XSIM_CMD_OVERHEAD + sizeof(info)];
+          size_t size = MakeCmdFrame(reply, XSIM_CMD_BROADCAST, 0, info, sizeof(info));
+          sendto(_broad_fd, reply, size, 0, (sockaddr*)&from, from_len);
+          std::lock_guard<std::mutex> lock(_mutex);
+          _stats._discoveries++;
+     }
+     void OnCommand()
+     {
+          uint8_t buf[XCMD_BUF_SIZE];
+          sockaddr_in from;
+          socklen_t from_len = sizeof(from);
+          ssize_t len = recvfrom(_cmd_fd, buf, sizeof(buf), 0, (sockaddr*)&from, &from_len);
+          if(len <= 0)
+               return;
+          int32_t size = CheckCmdFrame(buf, (size_t)len);
+          std::unique_lock<std::mutex> lock(_mutex);
+          if(size < 0)
+          {
+               _stats._bad_commands++;
+               return;
+          }
+          _stats._commands++;
+          _cmd_peer = from;
+          if(!_config._host_ip[0])
+          {
+               _host = from;
+               _host.sin_port = htons(_config._img_port);
+               _is_host_set = 1;
+          }
+          uint8_t cmd = buf[2];
+          std::vector<uint8_t> data;
+          if(XSIM_OP_WRITE == buf[3])
+          {
+               _regs[cmd].assign(buf + 6, buf + 6 + size);
+               if(XSIM_CMD_GRAB == cmd)
+               {
+                    bool is_grab = 0;
+                    for(int32_t i = 0; i < size; i++)
+                         is_grab |= (0 != buf[6 + i]);
+                    _is_grab = is_grab;
+                    _grab_cond.notify_all();
+               }
+          }
+          else
+          {
+               data = _regs[cmd];
+               //Unknown registers read as zero
+               if(data.empty())
+                    data.assign(4, 0);
+          }
+          lock.unlock();
+          uint8_t reply[XCMD_BUF_SIZE];
+          size_t reply_size = MakeCmdFrame(reply, cmd, 0, data.empty() ? NULL : &data[0],
+                                           (uint16_t)data.size());
+          sendto(_cmd_fd, reply, reply_size, 0, (sockaddr*)&from, from_len);
+     }
+     void SendHealth()
+     {
+          sockaddr_in peer;
+          {
+               std::lock_guard<std::mutex> lock(_mutex);
+               if(0 == _stats._commands)
+                    return;
+               peer = _cmd_peer;
+          }
+          //Health of the 1412i from the captures
+          static const uint8_t health[XSIM_HEALTH_SIZE] = {
+               0x03, 0x0B, 0x07, 0x73, 0x04, 0xDC, 0x02, 0x79, 0x00, 0x00, 0x00, 0x00,
+               0x00, 0x00, 0x00, 0x00, 0x6B, 0x5D, 0x89, 0x3F, 0x00, 0xE7, 0x00, 0x00};
+          uint8_t buf[XSIM_CMD_OVERHEAD + XSIM_HEALTH_SIZE];
+          size_t size = MakeCmdFrame(buf, XSIM_CMD_HEALTH, 0, health, XSIM_HEALTH_SIZE);
+          sendto(_cmd_fd, buf, size, 0, (sockaddr*)&peer, sizeof(peer));
+     }
+     /*
+       Command and discovery replies, and the heartbeat.
+      */
+     void CmdProc()
+     {
+          std::chrono::steady_clock::time_point next_health = std::chrono::steady_clock::now()
+               + std::chrono::seconds(XCMD_HEARTBEAT_INTERVAL_SECONDS);
+          while(1)
+          {
+               {
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    if(_is_stop)
+                         return;
+               }
+               pollfd fds[2];
+               fds[0].fd = _broad_fd;
+               fds[0].events = POLLIN;
+               fds[1].fd = _cmd_fd;
+               fds[1].events = POLLIN;
+               if(poll(fds, 2, 50) > 0)
+               {
+                    if(fds[0].revents & POLLIN)
+                         OnBroadcast();
+                    if(fds[1].revents & POLLIN)
+                         OnCommand();
+               }
+               if(std::chrono::steady_clock::now() >= next_health)
+               {
+                    SendHealth();
+                    next_health += std::chrono::seconds(XCMD_HEARTBEAT_INTERVAL_SECONDS);
+               }
+          }
+     }
+     /*
+       Cut a frame into packets, the payloads point into _frame.
+      */
+     void BuildPackets()
+     {
+          uint32_t pixel_byte = (_config._pixel_depth > 16) ? 4 : 2;
+          uint32_t line_bytes = _config._width * pixel_byte;
+          _frame.resize((size_t)line_bytes * _config._height);
+          _packets.clear();
+          XSimPacket packet;
+          memset(&packet, 0, sizeof(packet));
+          packet._head_size = HEADER_SIZE;
+          _packets.push_back(packet);
+          packet._head_size = PAYLOAD;
+          if(_config._payload_size >= line_bytes)
+          {
+               uint32_t line_num = _config._payload_size / line_bytes;
+               for(uint32_t line = 0; line < _config._height; line += line_num)
+               {
+                    uint32_t num = (_config._height - line < line_num) ? _config._height - line : line_num;
+                    PutBE16(packet._head + LINE_ID, (uint16_t)line);
+                    packet._head[PACKET_ID] = 0;
+                    packet._offset = line * line_bytes;
+                    packet._size = num * line_bytes;
+                    _packets.push_back(packet);
+               }
+          }
+          else
+          {
+               for(uint32_t line = 0; line < _config._height; line++)
+                    for(uint32_t pos = 0, id = 0; pos < line_bytes;
+                        pos += _config._payload_size, id++)
+                    {
+                         PutBE16(packet._head + LINE_ID, (uint16_t)line);
+                         packet._head[PACKET_ID] = (uint8_t)id;
+                         packet._offset = line * line_bytes + pos;
+                         packet._size = (line_bytes - pos < _config._payload_size)
+                              ? line_bytes - pos : _config._payload_size;
+                         _packets.push_back(packet);
+                    }
+          }
+          for(size_t i = 1; i < _packets.size(); i++)
+          {
+               _packets[i]._head[0] = XCMD_START_CODE;
+               _packets[i]._head[1] = XCMD_START_CODE;
+               _packets[i]._head[CMD] = XSIM_IMG_PAYLOAD;
+               PutBE16(_packets[i]._head + PAYLOAD_SIZE, (uint16_t)_packets[i]._size);
+          }
+          _packets[0]._head[0] = XCMD_START_CODE;
+          _packets[0]._head[1] = XCMD_START_CODE;
+          _packets[0]._head[CMD] = XSIM_IMG_HEADER;
+          PutBE32(_packets[0]._head + FRAME_SIZE, _config._height);
+     }
+     template <typename T>
+     void FillFrame(uint16_t frame_id)
+     {
+          T mask = (T)((_config._pixel_depth >= 32) ? 0xFFFFFFFFu
+                       : (1u << _config._pixel_depth) - 1);
+          T* pixel_ = (T*)&_frame[0];
+          for(uint32_t row = 0; row < _config._height; row++)
+               for(uint32_t col = 0; col < _config._width; col++)
+                    *pixel_++ = (T)((row + col + frame_id) & mask);
+     }
+     /*
+       Send the packets of one frame in the impaired order.
+      */
+     void SendFrame(const sockaddr_in& host, std::mt19937& rand, XSimStats& stats)
+     {
+          std::uniform_real_distribution<double> uniform(0.0, 1.0);
+          _order.clear();
+          for(uint32_t i = 0; i < (uint32_t)_packets.size(); i++)
+          {
+               if(_config._loss > 0 && uniform(rand) < _config._loss)
+               {
+                    stats._lost++;
+                    continue;
+               }
+               _order.push_back(i);
+               if(_config._duplicate > 0 && uniform(rand) < _config._duplicate)
+               {
+                    _order.push_back(i);
+                    stats._duplicated++;
+               }
+          }
+          if(_config._reorder > 0)
+               for(size_t i = 0; i + 1 < _order.size(); i++)
+                    if(uniform(rand) < _config._reorder)
+                    {
+                         std::swap(_order[i], _order[i + 1]);
+                         stats._reordered++;
+                         i++;
+                    }
+          mmsghdr msgs[XSIM_SEND_BATCH];
+          iovec iovs[XSIM_SEND_BATCH][2];
+          for(size_t start = 0; start < _order.size(); start += XSIM_SEND_BATCH)
+          {
+               uint32_t num = 0;
+               for(size_t i = start; i < _order.size() && num < XSIM_SEND_BATCH; i++, num++)
+               {
+                    XSimPacket& packet = _packets[_order[i]];
+                    iovs[num][0].iov_base = packet._head;
+                    iovs[num][0].iov_len = packet._head_size;
+                    iovs[num][1].iov_base = &_frame[0] + packet._offset;
+                    iovs[num][1].iov_len = packet._size;
+                    memset(&msgs[num], 0, sizeof(msgs[num]));
+                    msgs[num].msg_hdr.msg_name = (void*)&host;
+                    msgs[num].msg_hdr.msg_namelen = sizeof(host);
+                    msgs[num].msg_hdr.msg_iov = iovs[num];
+                    msgs[num].msg_hdr.msg_iovlen = packet._size ? 2 : 1;
+                    stats._bytes += packet._head_size + packet._size;
+               }
+               uint32_t sent = 0;
+               while(sent < num)
+               {
+                    int32_t ret = sendmmsg(_img_fd, msgs + sent, num - sent, 0);
+                    if(ret < 0)
+                    {
+                         //Loopback ran out of buffer, give the receiver a moment
+                         if(ENOBUFS == errno || EAGAIN == errno)
+                         {
+                              std::this_thread::yield();
+                              continue;
+                         }
+                         break;
+                    }
+                    sent += (uint32_t)ret;
+               }
+               stats._packets += sent;
+          }
+     }
+     /*
+       Stream frames at _frame_rate while grabbing.
+      */
+     void ImgProc()
+     {
+          std::mt19937 rand(_config._seed);
+          BuildPackets();
+          std::chrono::steady_clock::duration period = std::chrono::steady_clock::duration::zero();
+          if(_config._frame_rate > 0)
+               period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                    std::chrono::duration<double>(1.0 / _config._frame_rate));
+          std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+          uint32_t grab_frames = 0;
+          while(1)
+          {
+               sockaddr_in host;
+               {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    if(!_is_grab)
+                         grab_frames = 0;
+                    while(!_is_stop && !_is_grab)
+                         _grab_cond.wait(lock);
+                    if(_is_stop)
+                         return;
+                    host = _host;
+               }
+               if(0 == grab_frames)
+                    next = std::chrono::steady_clock::now();
+               if(_config._pixel_depth > 16)
+                    FillFrame<uint32_t>(_frame_id);
+               else
+                    FillFrame<uint16_t>(_frame_id);
+               for(size_t i = 0; i < _packets.size(); i++)
+                    PutBE16(_packets[i]._head + FRAME_ID, _frame_id);
+               PutBE32(_packets[0]._head + LINE_STAMP, _line_stamp);
+
+               XSimStats stats;
+               memset(&stats, 0, sizeof(stats));
+               SendFrame(host, rand, stats);
+               _frame_id++;
+               _line_stamp += _config._height;
+               grab_frames++;
+               {
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    _stats._frames++;
+                    _stats._packets += stats._packets;
+                    _stats._bytes += stats._bytes;
+                    _stats._lost += stats._lost;
+                    _stats._reordered += stats._reordered;
+                    _stats._duplicated += stats._duplicated;
+                    if(_config._frame_num && grab_frames >= _config._frame_num)
+                         _is_grab = 0;
+               }
+               if(period != std::chrono::steady_clock::duration::zero())
+               {
+                    next += period;
+                    std::this_thread::sleep_until(next);
+               }
+          }
+     }
+
+     XSimConfig _config;
+     int32_t _broad_fd;
+     int32_t _cmd_fd;
+     int32_t _img_fd;
+     bool _is_stop;
+     bool _is_host_set;
+     bool _is_grab;
+     uint16_t _frame_id;
+     uint32_t _line_stamp;
+     int32_t _last_err;
+     XFastCrc _crc;                      //Only used by the command thread
+     sockaddr_in _host;                  //Image target
+     sockaddr_in _cmd_peer;              //Last command sender, gets the heartbeat
+     std::vector<uint8_t> _regs[256];
+     std::vector<uint8_t> _frame;        //Only used by the image thread
+     std::vector<XSimPacket> _packets;
+     std::vector<uint32_t> _order;
+     XSimStats _stats;
+     std::mutex _mutex;
+     std::condition_variable _grab_cond;
+     std::thread _cmd_thread;
+     std::thread _img_thread;
+};
+#endif //__linux__
+#endif //XDEVICE_SIM_H
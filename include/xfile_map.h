@@ -0,0 +1,196 @@
+/*
+  Copyright (c), Detection Technology Inc.
+  All right reserved.
+
+ */
+
+#ifndef XFILE_MAP_H
+#define XFILE_MAP_H
+#include "xconfigure.h"
+#include <string.h>
+#ifndef _MSC_VER
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//Access of XFileMap::Open()
+#define XMAP_READ         0   //Read only, the data must not be written
+#define XMAP_COPY         1   //Copy on write, changes stay in memory
+#define XMAP_WRITE        2   //Shared, changes go back to the file
+
+//Hints of XFileMap::Advise()
+#define XMAP_WILLNEED     0   //Start reading the range
+#define XMAP_DONTNEED     1   //Drop the pages of the range
+
+/*
+  XFileMap maps a whole file into memory, mmap() on gcc and a file mapping
+  on VS C++. The mapping is advised sequential.
+ */
+class XFileMap
+{
+public:
+     XFileMap()
+          :_data_(NULL)
+          ,_size(0)
+#ifdef _MSC_VER
+          ,_file(INVALID_HANDLE_VALUE)
+          ,_mapping(NULL)
+#endif
+     {}
+     ~XFileMap()
+     {
+          Close();
+     }
+
+     /*
+       Return 0 if the file is missing or empty.
+      */
+     bool Open(const char* file_, uint32_t access = XMAP_READ)
+     {
+          Close();
+#ifdef _MSC_VER
+          DWORD file_access = GENERIC_READ;
+          DWORD page = PAGE_READONLY;
+          DWORD view = FILE_MAP_READ;
+          if(XMAP_COPY == access)
+          {
+               page = PAGE_WRITECOPY;
+               view = FILE_MAP_COPY;
+          }
+          else if(XMAP_WRITE == access)
+          {
+               file_access |= GENERIC_WRITE;
+               page = PAGE_READWRITE;
+               view = FILE_MAP_WRITE;
+          }
+          _file = CreateFileA(file_, file_access, FILE_SHARE_READ, NULL,
+                              OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+          LARGE_INTEGER size;
+          if(INVALID_HANDLE_VALUE == _file || !GetFileSizeEx(_file, &size)
+             || 0 == size.QuadPart)
+          {
+               Close();
+               return 0;
+          }
+          _mapping = CreateFileMappingA(_file, NULL, page, 0, 0, NULL);
+          if(_mapping)
+               _data_ = (uint8_t*)MapViewOfFile(_mapping, view, 0, 0, 0);
+          if(!_data_)
+          {
+               Close();
+               return 0;
+          }
+          _size = (size_t)size.QuadPart;
+#else
+          int32_t fd = open(file_, (XMAP_WRITE == access) ? O_RDWR : O_RDONLY);
+          if(fd < 0)
+               return 0;
+          struct stat st;
+          if(fstat(fd, &st) != 0 || 0 == st.st_size)
+          {
+               close(fd);
+               return 0;
+          }
+          int32_t prot = PROT_READ;
+          int32_t flags = MAP_SHARED;
+          if(XMAP_COPY == access)
+          {
+               prot |= PROT_WRITE;
+               flags = MAP_PRIVATE;
+          }
+          else if(XMAP_WRITE == access)
+               prot |= PROT_WRITE;
+          void* data_ = mmap(NULL, (size_t)st.st_size, prot, flags, fd, 0);
+          //The mapping keeps the file referenced
+          close(fd);
+          if(MAP_FAILED == data_)
+               return 0;
+          _data_ = (uint8_t*)data_;
+          _size = (size_t)st.st_size;
+          madvise(_data_, _size, MADV_SEQUENTIAL);
+#endif
+          return 1;
+     }
+     void Close()
+     {
+#ifdef _MSC_VER
+          if(_data_)
+               UnmapViewOfFile(_data_);
+          if(_mapping)
+               CloseHandle(_mapping);
+          if(INVALID_HANDLE_VALUE != _file)
+               CloseHandle(_file);
+          _mapping = NULL;
+          _file = INVALID_HANDLE_VALUE;
+#else
+          if(_data_)
+               munmap(_data_, _size);
+#endif
+          _data_ = NULL;
+          _size = 0;
+     }
+     bool IsOpen()
+     {
+          return NULL != _data_;
+     }
+     uint8_t* GetData()
+     {
+          return _data_;
+     }
+     size_t GetSize()
+     {
+          return _size;
+     }
+     /*
+       Apply an XMAP_* hint to size bytes at offset. XMAP_DONTNEED leaves
+       the pages partly outside the range alone.
+      */
+     void Advise(size_t offset, size_t size, uint32_t hint)
+     {
+          if(!_data_ || offset >= _size)
+               return;
+          if(size > _size - offset)
+               size = _size - offset;
+          size_t end = offset + size;
+#ifdef _MSC_VER
+          if(XMAP_WILLNEED == hint)
+          {
+               //PrefetchVirtualMemory() needs Windows 8, touch a byte per page
+               volatile uint8_t sink = 0;
+               for(size_t pos = offset; pos < end; pos += 4096)
+                    sink ^= _data_[pos];
+               (void)sink;
+          }
+#else
+          size_t page = (size_t)sysconf(_SC_PAGESIZE);
+          if(XMAP_DONTNEED == hint)
+          {
+               offset = (offset + page - 1) & ~(page - 1);
+               if(end < _size)
+                    end &= ~(page - 1);
+               if(end <= offset)
+                    return;
+               madvise(_data_ + offset, end - offset, MADV_DONTNEED);
+          }
+          else
+          {
+               offset &= ~(page - 1);
+               madvise(_data_ + offset, end - offset, MADV_WILLNEED);
+          }
+#endif
+     }
+
+private:
+     XFileMap(const XFileMap&);
+     XFileMap& operator = (const XFileMap&);
+
+     uint8_t* _data_;
+     size_t   _size;
+#ifdef _MSC_VER
+     HANDLE   _file;
+     HANDLE   _mapping;
+#endif
+};
+#endif //XFILE_MAP_H
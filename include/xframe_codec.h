@@ -0,0 +1,362 @@
+/*
+  Copyright (c), Detection Technology Inc.
+  All right reserved.
+
+ */
+
+#ifndef XFRAME_CODEC_H
+#define XFRAME_CODEC_H
+#include "xconfigure.h"
+#include "ximage.h"
+#include "xworker_pool.h"
+#include <string.h>
+#include <vector>
+
+//Codec ids, stored by XFrameFile
+#define XCODEC_NONE        0
+#define XCODEC_DELTA_PACK  1
+
+#define XCODEC_MAGIC       0x31444358   //"XCD1"
+#define XCODEC_BLOCK       16           //Pixels per bit packed block
+#define XCODEC_BAND_ROWS   64           //Rows per independently coded band
+
+/*
+  Layout of a frame coded by XFrameCodec, little endian:
+    XCodecHeader
+    uint32_t band_size[band_num]
+    band data
+  Each band holds, per line, the data_offset line info bytes as they are,
+  then the pixels in blocks of XCODEC_BLOCK: one byte with the bit width
+  followed by the packed residuals.
+ */
+struct XCodecHeader
+{
+     uint32_t _magic;
+     uint32_t _width;
+     uint32_t _height;
+     uint32_t _data_offset;
+     uint32_t _band_rows;
+     uint32_t _band_num;
+};
+
+/*
+  XFrameCodec is a lossless coder for 16 bit frames. Each pixel is
+  predicted from its left neighbour (the first one of a line from the
+  pixel above), the residual is zigzag mapped, and blocks of 16 residuals
+  are bit packed at the width of the largest one. 14 bit detector noise
+  gives residuals of a few bits, so frames shrink to about half with
+  only shifts and adds per pixel.
+  Bands of XCODEC_BAND_ROWS lines are coded independently, in parallel
+  when Open() is given more than one thread.
+ */
+class XFrameCodec
+{
+public:
+     XFrameCodec()
+     {
+          _bands.resize(1);
+     }
+     ~XFrameCodec()
+     {
+          Close();
+     }
+
+     /*
+       thread_num 1 codes on the caller's thread, 0 uses every hardware
+       thread.
+      */
+     bool Open(uint32_t thread_num = 1, uint64_t affinity_mask = 0)
+     {
+          Close();
+          if(1 != thread_num && !_pool.Open(thread_num, affinity_mask))
+               return 0;
+          return 1;
+     }
+     void Close()
+     {
+          _pool.Close();
+     }
+     /*
+       Largest coded size of a frame.
+      */
+     static size_t GetBound(uint32_t width, uint32_t height, uint32_t data_offset)
+     {
+          uint32_t band_num = (height + XCODEC_BAND_ROWS - 1) / XCODEC_BAND_ROWS;
+          size_t block_num = (width + XCODEC_BLOCK - 1) / XCODEC_BLOCK;
+          return sizeof(XCodecHeader) + band_num * sizeof(uint32_t)
+               + (size_t)height * (data_offset + block_num * (1 + XCODEC_BLOCK * 2));
+     }
+     /*
+       Code image_ into out. Return the coded size, 0 if the frame is not
+       16 bit.
+      */
+     size_t Encode(XImage* image_, std::vector<uint8_t>& out)
+     {
+          if(!image_ || !image_->_data_ || !image_->IsPixelType<uint16_t>()
+             || 0 == image_->_width || 0 == image_->_height)
+               return 0;
+          XCodecHeader header;
+          header._magic = XCODEC_MAGIC;
+          header._width = image_->_width;
+          header._height = image_->_height;
+          header._data_offset = image_->_data_offset;
+          header._band_rows = XCODEC_BAND_ROWS;
+          header._band_num = (header._height + XCODEC_BAND_ROWS - 1) / XCODEC_BAND_ROWS;
+          if(_bands.size() < header._band_num)
+               _bands.resize(header._band_num);
+
+          XCodecJob job;
+          job._codec_ = this;
+          job._image_ = image_;
+          job._header = header;
+          _pool.Run(EncodeTask, &job, header._band_num);
+
+          size_t size = sizeof(header) + header._band_num * sizeof(uint32_t);
+          for(uint32_t i = 0; i < header._band_num; i++)
+               size += _bands[i]._size;
+          out.resize(size);
+          uint8_t* out_ = &out[0];
+          memcpy(out_, &header, sizeof(header));
+          out_ += sizeof(header);
+          for(uint32_t i = 0; i < header._band_num; i++, out_ += sizeof(uint32_t))
+          {
+               uint32_t band_size = (uint32_t)_bands[i]._size;
+               memcpy(out_, &band_size, sizeof(band_size));
+          }
+          for(uint32_t i = 0; i < header._band_num; i++)
+          {
+               memcpy(out_, &_bands[i]._buf[0], _bands[i]._size);
+               out_ += _bands[i]._size;
+          }
+          return size;
+     }
+     /*
+       Geometry of a coded frame, 0 if data_ does not start with a valid
+       header.
+      */
+     static bool GetHeader(const uint8_t* data_, size_t size, XCodecHeader& header)
+     {
+          if(!data_ || size < sizeof(header))
+               return 0;
+          memcpy(&header, data_, sizeof(header));
+          return XCODEC_MAGIC == header._magic && 0 != header._width
+               && 0 != header._height && 0 != header._band_rows
+               && header._band_num == (header._height - 1) / header._band_rows + 1;
+     }
+     /*
+       Decode size bytes into image_, whose _data_ holds capacity bytes. A
+       frame that needs more is rejected before anything is written. The
+       geometry of image_ is set, the pixel depth is left to the caller.
+      */
+     bool Decode(const uint8_t* data_, size_t size, XImage* image_, size_t capacity)
+     {
+          XCodecHeader header;
+          if(!image_ || !image_->_data_ || !GetHeader(data_, size, header))
+               return 0;
+          uint64_t line_size = (uint64_t)header._width * 2 + header._data_offset;
+          if(line_size > capacity / header._height)
+               return 0;
+          size_t pos = sizeof(header) + (size_t)header._band_num * sizeof(uint32_t);
+          if(pos > size)
+               return 0;
+          _band_pos.resize(header._band_num + 1);
+          for(uint32_t i = 0; i < header._band_num; i++)
+          {
+               uint32_t band_size;
+               memcpy(&band_size, data_ + sizeof(header) + i * sizeof(uint32_t),
+                      sizeof(band_size));
+               _band_pos[i] = pos;
+               pos += band_size;
+          }
+          _band_pos[header._band_num] = pos;
+          if(pos > size)
+               return 0;
+          image_->_width = header._width;
+          image_->_height = header._height;
+          image_->_data_offset = header._data_offset;
+          image_->_size = ((size_t)header._width * 2 + header._data_offset) * header._height;
+
+          XCodecJob job;
+          job._codec_ = this;
+          job._image_ = image_;
+          job._header = header;
+          job._data_ = data_;
+          if(_bands.size() < header._band_num)
+               _bands.resize(header._band_num);
+          _pool.Run(DecodeTask, &job, header._band_num);
+          for(uint32_t i = 0; i < header._band_num; i++)
+               if(!_bands[i]._is_ok)
+                    return 0;
+          return 1;
+     }
+
+private:
+     XFrameCodec(const XFrameCodec&);
+     XFrameCodec& operator = (const XFrameCodec&);
+
+     struct XBand
+     {
+          XBand()
+               :_size(0)
+               ,_is_ok(1)
+          {}
+          std::vector<uint8_t> _buf;
+          size_t _size;
+          bool   _is_ok;            //Band decoded
+     };
+     struct XCodecJob
+     {
+          XFrameCodec* _codec_;
+          XImage* _image_;
+          XCodecHeader _header;
+          const uint8_t* _data_;
+     };
+
+     static void EncodeTask(void* arg_, uint32_t task)
+     {
+          XCodecJob* job_ = (XCodecJob*)arg_;
+          const XCodecHeader& header = job_->_header;
+          XBand& band = job_->_codec_->_bands[task];
+          uint32_t row_begin = task * header._band_rows;
+          uint32_t row_end = row_begin + header._band_rows;
+          if(row_end > header._height)
+               row_end = header._height;
+          size_t bound = (row_end - row_begin) * (header._data_offset
+               + (size_t)(header._width + XCODEC_BLOCK - 1) / XCODEC_BLOCK * (1 + XCODEC_BLOCK * 2));
+          if(band._buf.size() < bound)
+               band._buf.resize(bound);
+          uint8_t* out_ = &band._buf[0];
+          uint8_t* begin_ = out_;
+          uint16_t res[XCODEC_BLOCK];
+          for(uint32_t row = row_begin; row < row_end; row++)
+          {
+               const uint8_t* line_ = job_->_image_->GetLineAddr(row);
+               memcpy(out_, line_, header._data_offset);
+               out_ += header._data_offset;
+               const uint16_t* pixel_ = (const uint16_t*)(line_ + header._data_offset);
+               uint16_t pred = (row > row_begin)
+                    ? *(const uint16_t*)(job_->_image_->GetLineAddr(row - 1) + header._data_offset)
+                    : 0;
+               for(uint32_t col = 0; col < header._width; col += XCODEC_BLOCK)
+               {
+                    uint32_t count = header._width - col;
+                    if(count > XCODEC_BLOCK)
+                         count = XCODEC_BLOCK;
+                    uint16_t bits_or = 0;
+                    for(uint32_t i = 0; i < count; i++)
+                    {
+                         int16_t delta = (int16_t)(uint16_t)(pixel_[col + i] - pred);
+                         pred = pixel_[col + i];
+                         res[i] = (uint16_t)(((uint16_t)delta << 1) ^ (uint16_t)(delta >> 15));
+                         bits_or |= res[i];
+                    }
+                    uint32_t bits = 0;
+                    while(bits_or >> bits)
+                         bits++;
+                    *out_++ = (uint8_t)bits;
+                    out_ = Pack(res, count, bits, out_);
+               }
+          }
+          band._size = out_ - begin_;
+     }
+     static void DecodeTask(void* arg_, uint32_t task)
+     {
+          XCodecJob* job_ = (XCodecJob*)arg_;
+          const XCodecHeader& header = job_->_header;
+          XFrameCodec* codec_ = job_->_codec_;
+          const uint8_t* in_ = job_->_data_ + codec_->_band_pos[task];
+          const uint8_t* end_ = job_->_data_ + codec_->_band_pos[task + 1];
+          uint32_t row_begin = task * header._band_rows;
+          uint32_t row_end = row_begin + header._band_rows;
+          if(row_end > header._height)
+               row_end = header._height;
+          bool& is_ok = codec_->_bands[task]._is_ok;
+          is_ok = 0;
+          uint16_t res[XCODEC_BLOCK];
+          for(uint32_t row = row_begin; row < row_end; row++)
+          {
+               uint8_t* line_ = job_->_image_->GetLineAddr(row);
+               if(in_ + header._data_offset > end_)
+                    return;
+               memcpy(line_, in_, header._data_offset);
+               in_ += header._data_offset;
+               uint16_t* pixel_ = (uint16_t*)(line_ + header._data_offset);
+               uint16_t pred = (row > row_begin)
+                    ? *(const uint16_t*)(job_->_image_->GetLineAddr(row - 1) + header._data_offset)
+                    : 0;
+               for(uint32_t col = 0; col < header._width; col += XCODEC_BLOCK)
+               {
+                    uint32_t count = header._width - col;
+                    if(count > XCODEC_BLOCK)
+                         count = XCODEC_BLOCK;
+                    if(in_ >= end_)
+                         return;
+                    uint32_t bits = *in_++;
+                    if(bits > 16 || in_ + (count * bits + 7) / 8 > end_)
+                         return;
+                    in_ = Unpack(in_, count, bits, res);
+                    for(uint32_t i = 0; i < count; i++)
+                    {
+                         int16_t delta = (int16_t)((res[i] >> 1) ^ (uint16_t)-(int16_t)(res[i] & 1));
+                         pred = (uint16_t)(pred + delta);
+                         pixel_[col + i] = pred;
+                    }
+               }
+          }
+          is_ok = 1;
+     }
+     /*
+       count values of bits bits each, LSB first, into (count * bits + 7) / 8
+       bytes.
+      */
+     static uint8_t* Pack(const uint16_t* res_, uint32_t count, uint32_t bits, uint8_t* out_)
+     {
+          if(0 == bits)
+               return out_;
+          uint64_t acc = 0;
+          uint32_t acc_bits = 0;
+          for(uint32_t i = 0; i < count; i++)
+          {
+               acc |= (uint64_t)res_[i] << acc_bits;
+               acc_bits += bits;
+               while(acc_bits >= 8)
+               {
+                    *out_++ = (uint8_t)acc;
+                    acc >>= 8;
+                    acc_bits -= 8;
+               }
+          }
+          if(acc_bits)
+               *out_++ = (uint8_t)acc;
+          return out_;
+     }
+     static const uint8_t* Unpack(const uint8_t* in_, uint32_t count, uint32_t bits,
+                                  uint16_t* res_)
+     {
+          if(0 == bits)
+          {
+               memset(res_, 0, count * sizeof(uint16_t));
+               return in_;
+          }
+          uint64_t acc = 0;
+          uint32_t acc_bits = 0;
+          uint32_t mask = (1u << bits) - 1;
+          for(uint32_t i = 0; i < count; i++)
+          {
+               while(acc_bits < bits)
+               {
+                    acc |= (uint64_t)*in_++ << acc_bits;
+                    acc_bits += 8;
+               }
+               res_[i] = (uint16_t)(acc & mask);
+               acc >>= bits;
+               acc_bits -= bits;
+          }
+          return in_;
+     }
+
+     XWorkerPool _pool;
+     std::vector<XBand> _bands;
+     std::vector<size_t> _band_pos;
+};
+#endif //XFRAME_CODEC_H
@@ -0,0 +1,544 @@
+/*
+  Copyright (c), Detection Technology Inc.
+  All right reserved.
+
+ */
+
+#ifndef XFRAME_FILE_H
+#define XFRAME_FILE_H
+#include "xconfigure.h"
+#include "ximage.h"
+#include "xraw_file.h"
+#include "xframe_codec.h"
+#include "xcrc.h"
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#define XFRAME_FILE_MAGIC    0x4D524658   //"XFRM"
+#define XFRAME_RECORD_MAGIC  0x41524658   //"XFRA"
+#define XFRAME_INDEX_MAGIC   0x58445849   //"IXDX"
+#define XFRAME_FILE_VERSION  2      //1 had no frame checksums
+
+/*
+  Metadata stored with each frame. _frame_id is the detector frame id (16
+  bit on the wire), _timestamp is in ns since the epoch, _int_time in us.
+ */
+struct XFrameMeta
+{
+     uint32_t _frame_id;
+     uint32_t _lost_packets;
+     uint64_t _timestamp;
+     uint32_t _int_time;
+};
+
+/*
+  On disk layout, all fields little endian:
+    XFrameFileHeader
+    XFrameRecord + frame data        repeated for every frame
+    XFrameEntry[frame_num]           index, written by Close()
+    XFrameTrailer
+  The header points at the index once the file is closed. A file cut short
+  by a crash has no index, it is rebuilt from the records on Open() as each
+  record repeats its index entry.
+ */
+struct XFrameFileHeader
+{
+     uint32_t _magic;
+     uint32_t _version;
+     uint32_t _width;
+     uint32_t _height;
+     uint32_t _pixel_depth;
+     uint32_t _data_offset;   //Line info bytes kept in front of each line
+     uint64_t _frame_size;
+     uint64_t _index_offset;  //0 until Close()
+     uint32_t _frame_num;
+     uint32_t _codec;         //XCODEC_*
+     uint32_t _reserved[4];
+};
+
+struct XFrameRecord
+{
+     uint32_t _magic;
+     uint32_t _index;
+     uint32_t _frame_id;
+     uint32_t _lost_packets;
+     uint64_t _timestamp;
+     uint32_t _int_time;
+     uint32_t _checksum;      //XFastCrc of the stored data, from version 2
+     uint64_t _size;          //Stored size, coded size with a codec
+};
+
+struct XFrameEntry
+{
+     uint64_t _offset;        //File offset of the frame data
+     uint64_t _size;
+     uint64_t _timestamp;
+     uint32_t _frame_id;
+     uint32_t _lost_packets;
+     uint32_t _int_time;
+     uint32_t _checksum;
+};
+
+struct XFrameTrailer
+{
+     uint32_t _magic;
+     uint32_t _frame_num;
+     uint64_t _index_offset;
+};
+
+/*
+  XFrameFile is an indexed multi frame container. Unlike the .dat + .txt
+  pair of XImageHandler it keeps the geometry in a binary header, stores
+  frame id, timestamp, lost packet count and integration time with every
+  frame, and ends with a frame index, so ReadFrame(n) is one seek.
+  Frames are only appended. After a crash Open() rebuilds the index from
+  the records and Append() cuts a torn last frame and carries on.
+  Frames are stored with their line info (_data_offset) as given, or
+  coded by XFrameCodec after SetCodec(). Each record carries the CRC32 of
+  its stored bytes, ReadFrame() fails on a frame that does not match.
+ */
+class XFrameFile
+{
+public:
+     XFrameFile()
+          :_crc(XCRC32_KEY)
+          ,_file_(NULL)
+          ,_is_write(0)
+          ,_is_recovered(0)
+          ,_codec_id(XCODEC_NONE)
+          ,_end(0)
+     {
+          memset(&_header, 0, sizeof(_header));
+     }
+     ~XFrameFile()
+     {
+          Close();
+     }
+
+     /*
+       Create a new file for writing. The geometry is taken from the first
+       frame.
+      */
+     bool Create(const char* file_)
+     {
+          Close();
+          _file_ = fopen(file_, "wb+");
+          if(!_file_)
+               return 0;
+          _is_write = 1;
+          _end = 0;
+          return 1;
+     }
+     /*
+       Open a file for reading.
+      */
+     bool Open(const char* file_)
+     {
+          Close();
+          _file_ = fopen(file_, "rb");
+          if(!_file_ || !Load())
+          {
+               Close();
+               return 0;
+          }
+          return 1;
+     }
+     /*
+       Open a file to add more frames, e.g. one left by a crashed grab.
+      */
+     bool Append(const char* file_)
+     {
+          Close();
+          _file_ = fopen(file_, "rb+");
+          if(!_file_ || !Load())
+          {
+               Close();
+               return 0;
+          }
+          //Drop the old index and any torn record, Close() writes a new one
+          _header._index_offset = 0;
+          _header._frame_num = 0;
+          if(!XFileTruncate(_file_, _end) || !WriteHeader())
+          {
+               Close();
+               return 0;
+          }
+          _is_write = 1;
+          return 1;
+     }
+     /*
+       Code the frames of a new file with codec, on thread_num threads.
+       Call after Create() and before the first Write(). Frames deeper than
+       16 bit are stored as they are.
+      */
+     bool SetCodec(uint32_t codec, uint32_t thread_num = 1)
+     {
+          if(!_file_ || !_is_write || _header._magic || codec > XCODEC_DELTA_PACK)
+               return 0;
+          if(XCODEC_NONE != codec && !_codec.Open(thread_num))
+               return 0;
+          _codec_id = codec;
+          return 1;
+     }
+     /*
+       Append image_. Without meta_ only the timestamp is set.
+      */
+     bool Write(XImage* image_, const XFrameMeta* meta_ = NULL)
+     {
+          if(!_file_ || !_is_write || !image_ || !image_->_data_)
+               return 0;
+          uint64_t size = GetImageSize(image_);
+          if(0 == _header._magic)
+          {
+               _header._magic = XFRAME_FILE_MAGIC;
+               _header._version = XFRAME_FILE_VERSION;
+               _header._width = image_->_width;
+               _header._height = image_->_height;
+               _header._pixel_depth = image_->_pixel_depth;
+               _header._data_offset = image_->_data_offset;
+               _header._frame_size = size;
+               _header._codec = image_->IsPixelType<uint16_t>() ? _codec_id : XCODEC_NONE;
+               if(!WriteHeader())
+                    return 0;
+               _end = sizeof(_header);
+          }
+          else if(image_->_width != _header._width || image_->_height != _header._height
+                  || image_->_pixel_depth != _header._pixel_depth
+                  || image_->_data_offset != _header._data_offset)
+               return 0;
+
+          XFrameRecord record;
+          memset(&record, 0, sizeof(record));
+          record._magic = XFRAME_RECORD_MAGIC;
+          record._index = (uint32_t)_index.size();
+          const uint8_t* data_ = image_->_data_;
+          if(XCODEC_NONE != _header._codec)
+          {
+               size = _codec.Encode(image_, _coded);
+               if(0 == size)
+                    return 0;
+               data_ = &_coded[0];
+          }
+          record._size = size;
+          _crc.Update(data_, (size_t)size);
+          record._checksum = _crc.Done();
+          if(meta_)
+          {
+               record._frame_id = meta_->_frame_id;
+               record._lost_packets = meta_->_lost_packets;
+               record._timestamp = meta_->_timestamp;
+               record._int_time = meta_->_int_time;
+          }
+          if(0 == record._timestamp)
+               record._timestamp = GetTimeNs();
+          if(!XFileSeek(_file_, _end)
+             || fwrite(&record, sizeof(record), 1, _file_) != 1
+             || fwrite(data_, 1, (size_t)size, _file_) != size)
+               return 0;
+          _index.push_back(ToEntry(record, _end + sizeof(record)));
+          _end += sizeof(record) + size;
+          return 1;
+     }
+     /*
+       Hand the written frames to the OS.
+      */
+     bool Flush()
+     {
+          if(!_file_)
+               return 0;
+          return 0 == fflush(_file_);
+     }
+     /*
+       Write the index and trailer when writing, then close.
+      */
+     bool Close()
+     {
+          if(!_file_)
+               return 1;
+          bool ret = 1;
+          if(_is_write && _header._magic)
+          {
+               XFrameTrailer trailer;
+               trailer._magic = XFRAME_INDEX_MAGIC;
+               trailer._frame_num = (uint32_t)_index.size();
+               trailer._index_offset = _end;
+               ret = XFileSeek(_file_, _end)
+                    && (_index.empty() || fwrite(&_index[0], sizeof(XFrameEntry),
+                                                 _index.size(), _file_) == _index.size())
+                    && fwrite(&trailer, sizeof(trailer), 1, _file_) == 1;
+               //The header points at the index only once it is complete
+               if(ret)
+               {
+                    fflush(_file_);
+                    _header._index_offset = _end;
+                    _header._frame_num = trailer._frame_num;
+                    ret = WriteHeader();
+               }
+          }
+          if(0 != fclose(_file_))
+               ret = 0;
+          _file_ = NULL;
+          _is_write = 0;
+          _is_recovered = 0;
+          _codec_id = XCODEC_NONE;
+          _end = 0;
+          _index.clear();
+          memset(&_header, 0, sizeof(_header));
+          return ret;
+     }
+     bool IsOpen()
+     {
+          return NULL != _file_;
+     }
+     /*
+       1 if the last Open() / Append() rebuilt the index from the records.
+      */
+     bool IsRecovered()
+     {
+          return _is_recovered;
+     }
+     const XFrameFileHeader& GetHeader()
+     {
+          return _header;
+     }
+     uint32_t GetFrameNum()
+     {
+          return (uint32_t)_index.size();
+     }
+     const XFrameEntry* GetEntry(uint32_t index)
+     {
+          if(index >= _index.size())
+               return NULL;
+          return &_index[index];
+     }
+     /*
+       Read frame index into image_, whose _data_ holds at least
+       GetHeader()._frame_size bytes. The geometry of image_ is set.
+       Return 0 as well if the frame does not match its checksum.
+      */
+     bool ReadFrame(uint32_t index, XImage* image_)
+     {
+          if(!_file_ || index >= _index.size() || !image_ || !image_->_data_)
+               return 0;
+          const XFrameEntry& entry = _index[index];
+          if(XCODEC_NONE == _header._codec)
+          {
+               if(!XFileSeek(_file_, entry._offset)
+                  || fread(image_->_data_, 1, (size_t)entry._size, _file_) != entry._size
+                  || !IsChecksumOk(entry, image_->_data_))
+                    return 0;
+          }
+          else
+          {
+               _coded.resize((size_t)entry._size);
+               image_->_pixel_depth = _header._pixel_depth;
+               XCodecHeader coded;
+               if(!XFileSeek(_file_, entry._offset)
+                  || fread(&_coded[0], 1, _coded.size(), _file_) != entry._size
+                  || !IsChecksumOk(entry, &_coded[0])
+                  || !XFrameCodec::GetHeader(&_coded[0], _coded.size(), coded)
+                  || coded._width != _header._width || coded._height != _header._height
+                  || coded._data_offset != _header._data_offset
+                  || !_codec.Decode(&_coded[0], _coded.size(), image_,
+                                    (size_t)_header._frame_size))
+                    return 0;
+          }
+          image_->_width = _header._width;
+          image_->_height = _header._height;
+          image_->_pixel_depth = _header._pixel_depth;
+          image_->_data_offset = _header._data_offset;
+          image_->_size = (size_t)_header._frame_size;
+          return 1;
+     }
+     /*
+       Read every frame back and return the number that do not match their
+       checksum or cannot be read. Version 1 files have none to check.
+      */
+     uint32_t Verify()
+     {
+          uint32_t bad = 0;
+          for(size_t i = 0; i < _index.size(); i++)
+          {
+               _coded.resize((size_t)_index[i]._size);
+               if(_coded.empty())
+                    continue;
+               if(!XFileSeek(_file_, _index[i]._offset)
+                  || fread(&_coded[0], 1, _coded.size(), _file_) != _coded.size()
+                  || !IsChecksumOk(_index[i], &_coded[0]))
+                    bad++;
+          }
+          return bad;
+     }
+     /*
+       Frames missing from the 16 bit detector frame id sequence, the
+       check of a scan without reading any pixel.
+      */
+     uint32_t GetMissingFrameNum()
+     {
+          uint32_t missing = 0;
+          for(size_t i = 1; i < _index.size(); i++)
+          {
+               uint16_t step = (uint16_t)(_index[i]._frame_id - _index[i - 1]._frame_id);
+               if(step > 1)
+                    missing += step - 1u;
+          }
+          return missing;
+     }
+     uint64_t GetLostPacketNum()
+     {
+          uint64_t lost = 0;
+          for(size_t i = 0; i < _index.size(); i++)
+               lost += _index[i]._lost_packets;
+          return lost;
+     }
+
+private:
+     XFrameFile(const XFrameFile&);
+     XFrameFile& operator = (const XFrameFile&);
+
+     static uint64_t GetImageSize(XImage* image_)
+     {
+          uint32_t pixel_byte = (image_->_pixel_depth > 16) ? 4 : 2;
+          return ((uint64_t)image_->_width * pixel_byte + image_->_data_offset)
+               * image_->_height;
+     }
+     /*
+       Frame size of the header geometry, 0 if it does not fit 64 bits.
+      */
+     static uint64_t GetFrameSize(const XFrameFileHeader& header)
+     {
+          uint32_t pixel_byte = (header._pixel_depth > 16) ? 4 : 2;
+          uint64_t line_size = (uint64_t)header._width * pixel_byte + header._data_offset;
+          if(0 == header._height || line_size > UINT64_MAX / header._height)
+               return 0;
+          return line_size * header._height;
+     }
+     /*
+       Largest stored size of a frame, the frame size itself without codec.
+      */
+     uint64_t GetMaxSize()
+     {
+          if(XCODEC_NONE == _header._codec)
+               return _header._frame_size;
+          return XFrameCodec::GetBound(_header._width, _header._height, _header._data_offset);
+     }
+     static uint64_t GetTimeNs()
+     {
+          return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::system_clock::now().time_since_epoch()).count();
+     }
+     static XFrameEntry ToEntry(const XFrameRecord& record, uint64_t offset)
+     {
+          XFrameEntry entry;
+          entry._offset = offset;
+          entry._size = record._size;
+          entry._timestamp = record._timestamp;
+          entry._frame_id = record._frame_id;
+          entry._lost_packets = record._lost_packets;
+          entry._int_time = record._int_time;
+          entry._checksum = record._checksum;
+          return entry;
+     }
+     bool IsChecksumOk(const XFrameEntry& entry, const uint8_t* data_)
+     {
+          if(_header._version < 2)
+               return 1;
+          _crc.Update(data_, (size_t)entry._size);
+          return _crc.Done() == entry._checksum;
+     }
+     bool WriteHeader()
+     {
+          return XFileSeek(_file_, 0)
+               && fwrite(&_header, sizeof(_header), 1, _file_) == 1
+               && 0 == fflush(_file_);
+     }
+     /*
+       Read the header and the index, or rebuild the index from the records.
+       _end is left at the end of the last whole record.
+      */
+     bool Load()
+     {
+          uint64_t file_size = XFileSize(_file_);
+          //ReadFrame() callers size their buffers by _frame_size, so it
+          //must be what the geometry needs
+          if(!XFileSeek(_file_, 0) || fread(&_header, sizeof(_header), 1, _file_) != 1
+             || XFRAME_FILE_MAGIC != _header._magic
+             || _header._version > XFRAME_FILE_VERSION
+             || _header._codec > XCODEC_DELTA_PACK
+             || 0 == _header._width || 0 == GetFrameSize(_header)
+             || _header._frame_size != GetFrameSize(_header))
+               return 0;
+          _index.clear();
+          if(_header._index_offset && LoadIndex(file_size))
+          {
+               _end = _header._index_offset;
+               _is_recovered = 0;
+               return 1;
+          }
+          _index.clear();
+          _is_recovered = 1;
+          uint64_t pos = sizeof(_header);
+          uint64_t max_size = GetMaxSize();
+          XFrameRecord record;
+          while(pos + sizeof(record) <= file_size)
+          {
+               if(!XFileSeek(_file_, pos) || fread(&record, sizeof(record), 1, _file_) != 1
+                  || XFRAME_RECORD_MAGIC != record._magic
+                  || record._index != _index.size()
+                  || record._size > max_size
+                  || (XCODEC_NONE == _header._codec && record._size != max_size)
+                  || pos + sizeof(record) + record._size > file_size)
+                    break;
+               _index.push_back(ToEntry(record, pos + sizeof(record)));
+               pos += sizeof(record) + record._size;
+          }
+          _end = pos;
+          return 1;
+     }
+     bool LoadIndex(uint64_t file_size)
+     {
+          uint64_t index_size = (uint64_t)_header._frame_num * sizeof(XFrameEntry);
+          XFrameTrailer trailer;
+          if(_header._index_offset + index_size + sizeof(trailer) != file_size
+             || !XFileSeek(_file_, _header._index_offset + index_size)
+             || fread(&trailer, sizeof(trailer), 1, _file_) != 1
+             || XFRAME_INDEX_MAGIC != trailer._magic
+             || trailer._frame_num != _header._frame_num
+             || trailer._index_offset != _header._index_offset)
+               return 0;
+          _index.resize(_header._frame_num);
+          if(_index.empty())
+               return 1;
+          if(!XFileSeek(_file_, _header._index_offset)
+             || fread(&_index[0], sizeof(XFrameEntry), _index.size(), _file_) != _index.size())
+               return 0;
+          //Every frame must lie between the header and the index and fit
+          //the buffer ReadFrame() reads it into, else Load() scans the records
+          uint64_t max_size = GetMaxSize();
+          uint64_t begin = sizeof(_header) + sizeof(XFrameRecord);
+          for(size_t i = 0; i < _index.size(); i++)
+          {
+               const XFrameEntry& entry = _index[i];
+               if(entry._offset < begin || entry._size > max_size
+                  || (XCODEC_NONE == _header._codec && entry._size != max_size)
+                  || entry._size > _header._index_offset
+                  || entry._offset > _header._index_offset - entry._size)
+                    return 0;
+          }
+          return 1;
+     }
+
+     XFastCrc _crc;
+     FILE* _file_;
+     bool  _is_write;
+     bool  _is_recovered;
+     uint32_t _codec_id;      //Codec set by SetCodec()
+     uint64_t _end;           //End of the last frame record
+     XFrameFileHeader _header;
+     std::vector<XFrameEntry> _index;
+     XFrameCodec _codec;
+     std::vector<uint8_t> _coded;
+};
+#endif //XFRAME_FILE_H
@@ -0,0 +1,251 @@
+/*
+  Copyright (c), Detection Technology Inc.
+  All right reserved.
+
+ */
+
+#ifndef XFRAME_LEASE_H
+#define XFRAME_LEASE_H
+#include "xconfigure.h"
+#include "ximage.h"
+#include <atomic>
+
+class XFrameLeasePool;
+
+/*
+  Reference counted handle to one slot of XFrameLeasePool. Copying a lease
+  adds a reference, destroying or releasing it drops one, from any thread.
+  The image stays valid and unchanged as long as one lease holds it.
+ */
+class XFrameLease
+{
+public:
+     XFrameLease()
+          :_pool_(NULL)
+          ,_slot(0)
+     {}
+     XFrameLease(const XFrameLease& lease);
+     XFrameLease& operator = (const XFrameLease& lease);
+     ~XFrameLease()
+     {
+          Release();
+     }
+
+     inline void Release();
+     inline XImage* GetImage() const;
+     bool IsValid() const
+     {
+          return NULL != _pool_;
+     }
+     uint32_t GetSlot() const
+     {
+          return _slot;
+     }
+
+private:
+     friend class XFrameLeasePool;
+     XFrameLease(XFrameLeasePool* pool_, uint32_t slot)
+          :_pool_(pool_)
+          ,_slot(slot)
+     {}
+
+     XFrameLeasePool* _pool_;
+     uint32_t _slot;
+};
+
+/*
+  XFrameLeasePool owns a fixed set of frame slots. The producer takes a free
+  slot with AcquireFree(), fills it and passes the image to the sinks. A sink
+  which needs the frame after OnFrameReady() returns takes a lease with
+  Lease(image_) instead of copying it, and drops the lease later from any
+  thread. A slot is only handed out again once its count is back to zero.
+  XBenchPipeline delivers its frames from this pool.
+ */
+class XFrameLeasePool
+{
+public:
+     XFrameLeasePool()
+          :_slot_num(0)
+          ,_frame_size(0)
+          ,_next(0)
+          ,_images_(NULL)
+          ,_counts_(NULL)
+          ,_mem_pool_(NULL)
+     {}
+     ~XFrameLeasePool()
+     {
+          Close();
+     }
+
+     bool Open(uint32_t width, uint32_t height, uint32_t pixel_depth,
+               uint32_t slot_num = XFRAME_NUM, uint32_t data_offset = 0)
+     {
+          Close();
+          if(0 == slot_num || 0 == width || 0 == height)
+               return 0;
+          uint32_t pixel_byte = (pixel_depth > 16) ? 4 : 2;
+          size_t line_size = (size_t)width * pixel_byte + data_offset;
+          _frame_size = line_size * height;
+          //Keep every slot SSE aligned
+          size_t pitch = (_frame_size + SSE_ALIGN_BYTE - 1)
+               & ~((size_t)SSE_ALIGN_BYTE - 1);
+          _mem_pool_ = (uint8_t*)_aligned_malloc(pitch * slot_num,
+                                                 SSE_ALIGN_BYTE);
+          if(!_mem_pool_)
+               return 0;
+          _images_ = new XImage[slot_num];
+          _counts_ = new std::atomic<int32_t>[slot_num];
+          for(uint32_t i = 0; i < slot_num; i++)
+          {
+               XImage* image_ = &_images_[i];
+               image_->_width = width;
+               image_->_height = height;
+               image_->_pixel_depth = pixel_depth;
+               image_->_data_offset = data_offset;
+               image_->_size = _frame_size;
+               image_->_data_ = _mem_pool_ + pitch * i;
+               image_->_device_ = NULL;
+               _counts_[i].store(0);
+          }
+          _slot_num = slot_num;
+          _next = 0;
+          return 1;
+     }
+     /*
+       All leases must be released before closing.
+      */
+     void Close()
+     {
+          delete [] _images_;
+          delete [] _counts_;
+          if(_mem_pool_)
+               _aligned_free(_mem_pool_);
+          _images_ = NULL;
+          _counts_ = NULL;
+          _mem_pool_ = NULL;
+          _slot_num = 0;
+     }
+     /*
+       Producer side. Take a free slot, the producer holds the first
+       reference. Return NULL when every slot is still leased.
+      */
+     XImage* AcquireFree()
+     {
+          for(uint32_t i = 0; i < _slot_num; i++)
+          {
+               uint32_t slot = _next;
+               _next = (_next + 1) % _slot_num;
+               int32_t expected = 0;
+               if(_counts_[slot].compare_exchange_strong(expected, 1,
+                                                         std::memory_order_acquire))
+                    return &_images_[slot];
+          }
+          return NULL;
+     }
+     /*
+       Drop the producer's reference once the sinks have been called.
+      */
+     void Recycle(XImage* image_)
+     {
+          int32_t slot = GetSlot(image_);
+          if(slot >= 0)
+               Unref((uint32_t)slot);
+     }
+     /*
+       Sink side. Add a reference to an image of this pool, return an
+       invalid lease for foreign images.
+      */
+     XFrameLease Lease(XImage* image_)
+     {
+          int32_t slot = GetSlot(image_);
+          if(slot < 0)
+               return XFrameLease();
+          _counts_[slot].fetch_add(1, std::memory_order_relaxed);
+          return XFrameLease(this, (uint32_t)slot);
+     }
+     int32_t GetSlot(XImage* image_)
+     {
+          if(!_images_ || image_ < _images_ || image_ >= _images_ + _slot_num)
+               return -1;
+          return (int32_t)(image_ - _images_);
+     }
+     XImage* GetImage(uint32_t slot)
+     {
+          if(slot >= _slot_num)
+               return NULL;
+          return &_images_[slot];
+     }
+     int32_t GetRefCount(uint32_t slot)
+     {
+          if(slot >= _slot_num)
+               return 0;
+          return _counts_[slot].load(std::memory_order_relaxed);
+     }
+     uint32_t GetFreeNum()
+     {
+          uint32_t num = 0;
+          for(uint32_t i = 0; i < _slot_num; i++)
+               if(0 == _counts_[i].load(std::memory_order_relaxed))
+                    num++;
+          return num;
+     }
+     uint32_t GetSlotNum()
+     {
+          return _slot_num;
+     }
+
+private:
+     friend class XFrameLease;
+     XFrameLeasePool(const XFrameLeasePool&);
+     XFrameLeasePool& operator = (const XFrameLeasePool&);
+
+     void Ref(uint32_t slot)
+     {
+          _counts_[slot].fetch_add(1, std::memory_order_relaxed);
+     }
+     void Unref(uint32_t slot)
+     {
+          //Release order: writes to the frame happen before reuse
+          _counts_[slot].fetch_sub(1, std::memory_order_release);
+     }
+
+     uint32_t _slot_num;
+     size_t   _frame_size;
+     uint32_t _next;
+     XImage*  _images_;
+     std::atomic<int32_t>* _counts_;
+     uint8_t* _mem_pool_;
+};
+
+inline XFrameLease::XFrameLease(const XFrameLease& lease)
+     :_pool_(lease._pool_)
+     ,_slot(lease._slot)
+{
+     if(_pool_)
+          _pool_->Ref(_slot);
+}
+inline XFrameLease& XFrameLease::operator = (const XFrameLease& lease)
+{
+     if(this != &lease)
+     {
+          if(lease._pool_)
+               lease._pool_->Ref(lease._slot);
+          Release();
+          _pool_ = lease._pool_;
+          _slot = lease._slot;
+     }
+     return *this;
+}
+inline void XFrameLease::Release()
+{
+     if(_pool_)
+          _pool_->Unref(_slot);
+     _pool_ = NULL;
+}
+inline XImage* XFrameLease::GetImage() const
+{
+     if(!_pool_)
+          return NULL;
+     return _pool_->GetImage(_slot);
+}
+#endif //XFRAME_LEASE_H
@@ -0,0 +1,317 @@
+/*
+  Copyright (c), Detection Technology Inc.
+  All right reserved.
+
+ */
+
+#ifndef XFRAME_STATS_H
+#define XFRAME_STATS_H
+#include "xcorrect_kernel.h"
+#include "xworker_pool.h"
+#include <vector>
+
+//What XFrameStats::Calc() computes, all in one pass over the frame
+#define XSTAT_MEAN        0x1
+#define XSTAT_MEDIAN      0x2
+#define XSTAT_ROW_MEANS   0x4
+#define XSTAT_COL_MEANS   0x8
+#define XSTAT_ALL         0xF
+
+#define XSTAT_HIST_SIZE   65536
+
+/*
+  Sum of count 16 bit pixels. Each 32 bit lane takes at most count/8
+  pixels, so count must stay below 512K.
+ */
+typedef uint64_t (*XSumLineFunc)(const uint16_t* data_, uint32_t count);
+
+inline uint64_t XSumLineScalar(const uint16_t* data_, uint32_t count)
+{
+     uint64_t sum = 0;
+     for(uint32_t i = 0; i < count; i++)
+          sum += data_[i];
+     return sum;
+}
+
+#ifdef XCOR_X86
+XCOR_TARGET_AVX2
+inline uint64_t XSumLineAvx2(const uint16_t* data_, uint32_t count)
+{
+     __m256i acc = _mm256_setzero_si256();
+     __m256i zero = _mm256_setzero_si256();
+     uint32_t i = 0;
+     for(; i + 16 <= count; i += 16)
+     {
+          __m256i val = _mm256_loadu_si256((const __m256i*)(data_ + i));
+          acc = _mm256_add_epi32(acc, _mm256_unpacklo_epi16(val, zero));
+          acc = _mm256_add_epi32(acc, _mm256_unpackhi_epi16(val, zero));
+     }
+     //Horizontal sum of the eight 32 bit lanes
+     __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(acc),
+                                 _mm256_extracti128_si256(acc, 1));
+     sum = _mm_add_epi64(_mm_unpacklo_epi32(sum, _mm_setzero_si128()),
+                         _mm_unpackhi_epi32(sum, _mm_setzero_si128()));
+     sum = _mm_add_epi64(sum, _mm_unpackhi_epi64(sum, sum));
+     uint64_t total;
+     _mm_storel_epi64((__m128i*)&total, sum);
+     return total + XSumLineScalar(data_ + i, count - i);
+}
+#endif
+
+/*
+  XFrameStats computes mean, median and per row / per column means of a
+  frame in a single pass over memory. The median comes from a 64K bin
+  counting histogram, so it is exact for frames up to 16 bit and costs one
+  increment per pixel instead of a sort. With more than one thread the
+  frame is cut into row bands, each with its own histogram and column sums,
+  which are merged at the end.
+  Results are also laid out like XAnalyze: _avg, _median and _avgs_ (the
+  row means).
+ */
+class XFrameStats
+{
+public:
+     XFrameStats()
+          :_avgs_(NULL)
+          ,_avg(0)
+          ,_median(0)
+          ,_mean(0)
+          ,_count(0)
+          ,_sum_func(XSumLineScalar)
+     {
+#ifdef XCOR_X86
+          if(XCOR_ISA_AVX2 == XCorrectDetectIsa())
+               _sum_func = XSumLineAvx2;
+#endif
+          _bands.resize(1);
+     }
+     ~XFrameStats()
+     {
+          Close();
+     }
+
+     /*
+       thread_num 1 runs on the caller's thread, 0 uses every hardware
+       thread.
+      */
+     bool Open(uint32_t thread_num = 1, uint64_t affinity_mask = 0)
+     {
+          Close();
+          if(1 != thread_num && !_pool.Open(thread_num, affinity_mask))
+               return 0;
+          _bands.resize(_pool.GetThreadNum());
+          return 1;
+     }
+     void Close()
+     {
+          _pool.Close();
+          _bands.resize(1);
+     }
+     uint32_t GetThreadNum()
+     {
+          return _pool.GetThreadNum();
+     }
+     /*
+       Compute the XSTAT_* values in flags. Frames deeper than 16 bit get
+       the means only.
+      */
+     bool Calc(XImage* image_, uint32_t flags = XSTAT_ALL)
+     {
+          if(!image_ || !image_->_data_ || 0 == image_->_width || 0 == image_->_height)
+               return 0;
+          bool is_16 = image_->IsPixelType<uint16_t>();
+          if(!is_16)
+               flags &= ~XSTAT_MEDIAN;
+          uint32_t width = image_->_width;
+          uint32_t height = image_->_height;
+          _row_sums.resize(height);
+          _row_means.resize(height);
+          _col_means.resize((flags & XSTAT_COL_MEANS) ? width : 0);
+
+          XStatsJob job;
+          job._stats_ = this;
+          job._image_ = image_;
+          job._flags = flags;
+          uint32_t band_num = (uint32_t)_bands.size();
+          if(band_num > height)
+               band_num = height;
+          job._band_rows = (height + band_num - 1) / band_num;
+          band_num = (height + job._band_rows - 1) / job._band_rows;
+          for(uint32_t i = 0; i < band_num; i++)
+          {
+               if(flags & XSTAT_MEDIAN)
+                    _bands[i]._hist.assign(XSTAT_HIST_SIZE, 0);
+               if(flags & XSTAT_COL_MEANS)
+                    _bands[i]._col_sums.assign(width, 0);
+          }
+          _pool.Run(BandTask, &job, band_num);
+
+          _count = (uint64_t)width * height;
+          uint64_t sum = 0;
+          for(uint32_t row = 0; row < height; row++)
+          {
+               sum += _row_sums[row];
+               _row_means[row] = (uint32_t)(_row_sums[row] / width);
+          }
+          _mean = (double)sum / _count;
+          _avg = (uint32_t)(sum / _count);
+          _avgs_ = &_row_means[0];
+          if(flags & XSTAT_COL_MEANS)
+          {
+               for(uint32_t col = 0; col < width; col++)
+               {
+                    uint64_t col_sum = 0;
+                    for(uint32_t i = 0; i < band_num; i++)
+                         col_sum += _bands[i]._col_sums[col];
+                    _col_means[col] = (uint32_t)(col_sum / height);
+               }
+          }
+          if(flags & XSTAT_MEDIAN)
+          {
+               _hist.assign(XSTAT_HIST_SIZE, 0);
+               for(uint32_t i = 0; i < band_num; i++)
+                    for(uint32_t val = 0; val < XSTAT_HIST_SIZE; val++)
+                         _hist[val] += _bands[i]._hist[val];
+               //Lower median, the value at sorted index (count - 1) / 2
+               uint64_t rank = (_count - 1) / 2;
+               uint64_t seen = 0;
+               for(uint32_t val = 0; val < XSTAT_HIST_SIZE; val++)
+               {
+                    seen += _hist[val];
+                    if(seen > rank)
+                    {
+                         _median = val;
+                         break;
+                    }
+               }
+          }
+          return 1;
+     }
+     /*
+       Mean only, e.g. the accept check after each projection.
+      */
+     double CalcMean(XImage* image_)
+     {
+          if(!Calc(image_, XSTAT_MEAN))
+               return 0;
+          return _mean;
+     }
+     double GetMean()
+     {
+          return _mean;
+     }
+     uint32_t GetMedian()
+     {
+          return _median;
+     }
+     const std::vector<uint32_t>& GetRowMeans()
+     {
+          return _row_means;
+     }
+     const std::vector<uint32_t>& GetColMeans()
+     {
+          return _col_means;
+     }
+     /*
+       Histogram of the last XSTAT_MEDIAN run, XSTAT_HIST_SIZE bins.
+      */
+     const std::vector<uint32_t>& GetHistogram()
+     {
+          return _hist;
+     }
+
+     uint32_t* _avgs_;        //Row means, like XAnalyze::_avgs_
+     uint32_t _avg;
+     uint32_t _median;
+
+private:
+     XFrameStats(const XFrameStats&);
+     XFrameStats& operator = (const XFrameStats&);
+
+     struct XBand
+     {
+          std::vector<uint32_t> _hist;
+          std::vector<uint64_t> _col_sums;
+     };
+     struct XStatsJob
+     {
+          XFrameStats* _stats_;
+          XImage* _image_;
+          uint32_t _flags;
+          uint32_t _band_rows;
+     };
+
+     static void BandTask(void* arg_, uint32_t task)
+     {
+          XStatsJob* job_ = (XStatsJob*)arg_;
+          XFrameStats* stats_ = job_->_stats_;
+          XImage* image_ = job_->_image_;
+          uint32_t row_begin = task * job_->_band_rows;
+          uint32_t row_end = row_begin + job_->_band_rows;
+          if(row_end > image_->_height)
+               row_end = image_->_height;
+          if(image_->IsPixelType<uint16_t>())
+               stats_->Band16(image_, job_->_flags, task, row_begin, row_end);
+          else
+               stats_->Band32(image_, job_->_flags, task, row_begin, row_end);
+     }
+     void Band16(XImage* image_, uint32_t flags, uint32_t band,
+                 uint32_t row_begin, uint32_t row_end)
+     {
+          XImageView<uint16_t> view = image_->GetView<uint16_t>();
+          uint32_t width = image_->_width;
+          uint32_t* hist_ = (flags & XSTAT_MEDIAN) ? &_bands[band]._hist[0] : NULL;
+          uint64_t* col_ = (flags & XSTAT_COL_MEANS) ? &_bands[band]._col_sums[0] : NULL;
+          for(uint32_t row = row_begin; row < row_end; row++)
+          {
+               const uint16_t* line_ = view.Row(row);
+               if(hist_ || col_)
+               {
+                    //One walk over the line feeds all the accumulators
+                    uint64_t sum = 0;
+                    for(uint32_t col = 0; col < width; col++)
+                    {
+                         uint16_t val = line_[col];
+                         sum += val;
+                         if(hist_)
+                              hist_[val]++;
+                         if(col_)
+                              col_[col] += val;
+                    }
+                    _row_sums[row] = sum;
+               }
+               else
+                    _row_sums[row] = _sum_func(line_, width);
+          }
+     }
+     void Band32(XImage* image_, uint32_t flags, uint32_t band,
+                 uint32_t row_begin, uint32_t row_end)
+     {
+          XImageView<uint32_t> view = image_->GetView<uint32_t>();
+          uint32_t width = image_->_width;
+          uint64_t* col_ = (flags & XSTAT_COL_MEANS) ? &_bands[band]._col_sums[0] : NULL;
+          for(uint32_t row = row_begin; row < row_end; row++)
+          {
+               const uint32_t* line_ = view.Row(row);
+               uint64_t sum = 0;
+               for(uint32_t col = 0; col < width; col++)
+               {
+                    sum += line_[col];
+                    if(col_)
+                         col_[col] += line_[col];
+               }
+               _row_sums[row] = sum;
+          }
+     }
+
+     double   _mean;
+     uint64_t _count;
+     XSumLineFunc _sum_func;
+     XWorkerPool _pool;
+     std::vector<XBand> _bands;
+     std::vector<uint64_t> _row_sums;
+     std::vector<uint32_t> _row_means;
+     std::vector<uint32_t> _col_means;
+     std::vector<uint32_t> _hist;
+};
+#endif //XFRAME_STATS_H
@@ -7,6 +7,7 @@
 #ifndef XGIG_FACTORY_H
 #define XGIG_FACTORY_H
 #include "ixfactory.h"
+#include "xpacket_ring.h"
 
 /*
   Gige objects factory
@@ -27,4 +28,25 @@ private:
 
 };
 
+/*
+  Gige factory which also hands out the lock-free packet pool. GetPacketPool()
+  still returns the mutex based XPacketPool for the engines built by the
+  library, GetPacketRing() returns the SPSC ring pool with the same API.
+  The caller owns the returned pool.
+ */
+class XRingFactory : public XGigFactory
+{
+public:
+     XPacketRingPool* GetPacketRing()
+     {
+          XPacketRingPool* pool_ = new XPacketRingPool;
+          if(!pool_->Initialize())
+          {
+               delete pool_;
+               return NULL;
+          }
+          return pool_;
+     }
+};
+
 #endif //XGIG_FACTORY_H
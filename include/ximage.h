@@ -9,6 +9,110 @@ Author: Zhang Xu, 2014-5-5
 #include "xconfigure.h"
 #include "xdevice.h"
 
+/*
+  Typed, unchecked view of XImage pixel data. Rows are pitch bytes apart and
+  the pixels of a row start data_offset bytes after the row, so a loop over
+  Row(r)[0..width) is a plain array loop the compiler can vectorize.
+  The view doesn't own the data.
+ */
+template <typename T>
+class XImageView
+{
+public:
+    /*
+      Walks all pixels row by row and skips the line data offset.
+     */
+    class Iterator
+    {
+    public:
+        Iterator(T* pos_, T* row_end_, uint32_t width, uint32_t pitch)
+            :_pos_(pos_)
+            ,_row_end_(row_end_)
+            ,_width(width)
+            ,_pitch(pitch)
+        {}
+        T& operator * () const
+        {
+            return *_pos_;
+        }
+        Iterator& operator ++ ()
+        {
+            if(++_pos_ == _row_end_)
+            {
+                _pos_ = (T*)((uint8_t*)_row_end_ - _width*sizeof(T) + _pitch);
+                _row_end_ = _pos_ + _width;
+            }
+            return *this;
+        }
+        bool operator == (const Iterator& it) const
+        {
+            return _pos_ == it._pos_;
+        }
+        bool operator != (const Iterator& it) const
+        {
+            return _pos_ != it._pos_;
+        }
+    private:
+        T* _pos_;
+        T* _row_end_;
+        uint32_t _width;
+        uint32_t _pitch;
+    };
+
+    XImageView()
+        :_data_(NULL)
+        ,_width(0)
+        ,_height(0)
+        ,_pitch(0)
+    {}
+    XImageView(uint8_t* data_, uint32_t width, uint32_t height,
+               uint32_t pitch, uint32_t data_offset = 0)
+        :_data_(data_ ? data_ + data_offset : NULL)
+        ,_width(width)
+        ,_height(height)
+        ,_pitch(pitch)
+    {}
+
+    inline T* Row(uint32_t row) const
+    {
+        return (T*)(_data_ + (size_t)_pitch*row);
+    }
+    inline T& At(uint32_t row, uint32_t col) const
+    {
+        return Row(row)[col];
+    }
+    Iterator begin() const
+    {
+        return Iterator(Row(0), Row(0) + _width, _width, _pitch);
+    }
+    Iterator end() const
+    {
+        return Iterator(Row(_height), Row(_height) + _width, _width, _pitch);
+    }
+    bool IsValid() const
+    {
+        return NULL != _data_;
+    }
+    uint32_t GetWidth() const
+    {
+        return _width;
+    }
+    uint32_t GetHeight() const
+    {
+        return _height;
+    }
+    //Bytes from one row to the next
+    uint32_t GetPitch() const
+    {
+        return _pitch;
+    }
+private:
+    uint8_t* _data_;
+    uint32_t _width;
+    uint32_t _height;
+    uint32_t _pitch;
+};
+
 class XDLL_EXPORT XImage
 {
 public:
@@ -34,35 +138,9 @@ public:
             return 0;
         if(!_data_)
             return 0;
-        uint32_t pixel_byte = 2;
         if(_pixel_depth > 16)
-            pixel_byte = 4;
-        //else if(_pixel_depth <= 8)
-        //pixel_byte = 1;
-
-        uint32_t line_size = _width*pixel_byte + _data_offset;
-        uint32_t pixel_value = 0;
-        switch(pixel_byte)
-        {
-        case 1:
-            pixel_value = *(uint8_t*)(_data_ + line_size*row +_data_offset
-                + col*pixel_byte);
-            break;
-        case 2:
-            pixel_value = *(uint16_t*)(_data_ + line_size*row +_data_offset
-                + col*pixel_byte);
-            break;
-        case 4:
-            pixel_value = *(uint32_t*)(_data_ + line_size*row + _data_offset
-                + col*pixel_byte);
-            break;
-        default:
-            pixel_value = *(uint16_t*)(_data_ + line_size*row +_data_offset
-                + col*pixel_byte);
-            break;
-        }
-
-        return pixel_value;
+            return GetView<uint32_t>().At(row, col);
+        return GetView<uint16_t>().At(row, col);
     }
     inline void SetPixelVal(uint32_t row, uint32_t col, uint32_t pixel_value)
     {
@@ -70,33 +148,26 @@ public:
             return;
         if(!_data_)
             return;
-        uint32_t pixel_byte = 2;
         if(_pixel_depth > 16)
-            pixel_byte = 4;
-        // else if(_pixel_depth <= 8)
-        //pixel_byte = 1;
-
-        uint32_t line_size = _width*pixel_byte + _data_offset;
-
-        switch(pixel_byte)
-        {
-        case 1:
-            *(uint8_t*)(_data_ + line_size*row +_data_offset
-                + col*pixel_byte) = pixel_value;
-            break;
-        case 2:
-            *(uint16_t*)(_data_ + line_size*row +_data_offset
-                + col*pixel_byte) = pixel_value;
-            break;
-        case 4:
-            *(uint32_t*)(_data_ + line_size*row + _data_offset
-                + col*pixel_byte) = pixel_value;
-            break;
-        default:
-            *(uint16_t*)(_data_ + line_size*row +_data_offset
-                + col*pixel_byte) = pixel_value;
-            break;
-        }
+            GetView<uint32_t>().At(row, col) = pixel_value;
+        else
+            GetView<uint16_t>().At(row, col) = (uint16_t)pixel_value;
+    }
+    /*
+      Typed view of the pixel data. T must match the pixel size, uint16_t up
+      to 16 bit depth and uint32_t above, see IsPixelType().
+     */
+    template <typename T>
+    inline XImageView<T> GetView()
+    {
+        return XImageView<T>(_data_, _width, _height,
+                             _width*(uint32_t)sizeof(T) + _data_offset,
+                             _data_offset);
+    }
+    template <typename T>
+    inline bool IsPixelType()
+    {
+        return sizeof(T) == ((_pixel_depth > 16) ? 4u : 2u);
     }
     inline uint8_t* GetLineAddr(uint32_t line_num)
     {
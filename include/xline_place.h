@@ -0,0 +1,306 @@
+/*
+  Copyright (c), Detection Technology Inc.
+  All right reserved.
+
+ */
+
+#ifndef XLINE_PLACE_H
+#define XLINE_PLACE_H
+#include "xudpimg_parse.h"
+#include "ximage.h"
+#include "xtrace.h"
+#include <string.h>
+#include <vector>
+
+//Result of XLinePlacer::Put()
+#define XPLACE_ERROR       -1  //Malformed packet or outside of the frame
+#define XPLACE_HEADER      0   //Frame header packet, a new frame starts
+#define XPLACE_PAYLOAD     1   //Payload placed into the frame
+#define XPLACE_FRAME_DONE  2   //Payload placed and the frame is complete
+
+/*
+  Image packet fields are big endian, like the command channel.
+ */
+inline uint16_t XGetBE16(const uint8_t* data_)
+{
+     return (uint16_t)((data_[0] << 8) | data_[1]);
+}
+inline uint32_t XGetBE32(const uint8_t* data_)
+{
+     return ((uint32_t)data_[0] << 24) | ((uint32_t)data_[1] << 16)
+          | ((uint32_t)data_[2] << 8) | data_[3];
+}
+
+/*
+  Decode the header of an image packet into XHeader. Frame header packets
+  are HEADER_SIZE bytes, every longer packet is a payload packet.
+ */
+inline bool XParseImgPacket(const XPacket* packet_, XHeader& header)
+{
+     const uint8_t* data_ = packet_->data_;
+     if(packet_->size < PAYLOAD)
+          return 0;
+     header._cmd_flag = data_[CMD];
+     header._frame_id = XGetBE16(data_ + FRAME_ID);
+     header._isHeader = (HEADER_SIZE == packet_->size);
+     if(header._isHeader)
+     {
+          header._line_stamp = XGetBE32(data_ + LINE_STAMP);
+          header._frame_size = XGetBE32(data_ + FRAME_SIZE);
+          header._line_id = 0;
+          header._packet_id = 0;
+          header._payload_size = 0;
+     }
+     else
+     {
+          header._line_stamp = 0;
+          header._frame_size = 0;
+          header._line_id = XGetBE16(data_ + LINE_ID);
+          header._packet_id = data_[PACKET_ID];
+          header._payload_size = XGetBE16(data_ + PAYLOAD_SIZE);
+          if((uint32_t)PAYLOAD + header._payload_size > (uint32_t)packet_->size)
+               return 0;
+     }
+     return 1;
+}
+
+/*
+  Per frame counters of XLinePlacer. With direct placement _bytes_copied
+  equals the frame size, the packet -> line buffer -> frame path copies the
+  same bytes twice more.
+ */
+struct XPlaceStats
+{
+     uint16_t _frame_id;
+     uint32_t _line_stamp;
+     uint32_t _packets;       //Distinct payload packets placed
+     uint32_t _duplicated;    //Payloads already placed, not copied again
+     uint32_t _dropped;       //Packets rejected by XPLACE_ERROR
+     uint64_t _bytes_copied;
+};
+
+/*
+  XLinePlacer copies each payload straight from the packet buffer into its
+  slot in the frame memory. LINE_ID and PACKET_ID pin every payload to a
+  fixed offset in the frame, so no line buffer is needed and packets may
+  arrive in any order.
+  The packet layout follows from the geometry and the payload size of the
+  detector: lines longer than payload_size are split into packets of
+  payload_size bytes with a shorter last one, shorter lines are packed
+  payload_size / line bytes to a packet. A payload whose size does not
+  match its slot is rejected. Each slot is marked in a bitmap when it
+  arrives, so duplicates are placed once and the frame is complete only
+  when every slot has arrived.
+  With a line data offset, the first data_offset bytes of each line are left
+  to the caller and payloads are split at line boundaries.
+ */
+class XLinePlacer
+{
+public:
+     XLinePlacer()
+          :_frame_(NULL)
+          ,_width(0)
+          ,_height(0)
+          ,_pixel_byte(0)
+          ,_data_offset(0)
+          ,_line_bytes(0)
+          ,_line_size(0)
+          ,_frame_bytes(0)
+          ,_payload_size(0)
+          ,_packet_per_line(0)
+          ,_line_per_packet(0)
+          ,_slot_num(0)
+     {
+          memset(&_stats, 0, sizeof(_stats));
+     }
+     ~XLinePlacer()
+     {}
+
+     bool Open(uint32_t width, uint32_t height, uint32_t pixel_byte,
+               uint32_t payload_size, uint32_t data_offset = 0)
+     {
+          if(0 == width || 0 == height || 0 == pixel_byte || 0 == payload_size)
+               return 0;
+          uint32_t line_bytes = width * pixel_byte;
+          uint32_t packet_per_line = 1;
+          uint32_t line_per_packet = 1;
+          if(payload_size < line_bytes)
+               packet_per_line = (line_bytes + payload_size - 1) / payload_size;
+          else
+               line_per_packet = payload_size / line_bytes;
+          //PACKET_ID is one byte
+          if(packet_per_line > 256)
+               return 0;
+          _width = width;
+          _height = height;
+          _pixel_byte = pixel_byte;
+          _data_offset = data_offset;
+          _line_bytes = line_bytes;
+          _line_size = _line_bytes + data_offset;
+          _frame_bytes = (uint64_t)_line_bytes * height;
+          _payload_size = payload_size;
+          _packet_per_line = packet_per_line;
+          _line_per_packet = line_per_packet;
+          _slot_num = (height + line_per_packet - 1) / line_per_packet * packet_per_line;
+          _arrived.assign((_slot_num + 63) / 64, 0);
+          ResetFrame();
+          return 1;
+     }
+     bool Open(XImage* image_, uint32_t payload_size)
+     {
+          uint32_t pixel_byte = (image_->_pixel_depth > 16) ? 4 : 2;
+          return Open(image_->_width, image_->_height, pixel_byte,
+                      payload_size, image_->_data_offset);
+     }
+     /*
+       Set the frame memory the next payloads go to, e.g. the _data_ of a
+       XFramePool slot. The caller switches slots on XPLACE_HEADER.
+      */
+     void SetFrame(uint8_t* frame_)
+     {
+          _frame_ = frame_;
+     }
+     uint8_t* GetFrame()
+     {
+          return _frame_;
+     }
+     /*
+       Decode one packet and place its payload. A frame header packet
+       starts a new frame. Return XPLACE_*.
+      */
+     int32_t Put(const XPacket* packet_)
+     {
+          XHeader header;
+          if(!XParseImgPacket(packet_, header))
+          {
+               _stats._dropped++;
+               return XPLACE_ERROR;
+          }
+          if(header._isHeader)
+          {
+               ResetFrame();
+               _stats._frame_id = header._frame_id;
+               _stats._line_stamp = header._line_stamp;
+               XTraceInstant(XTRACE_HEADER, header._frame_id);
+               return XPLACE_HEADER;
+          }
+          return Place(header, packet_->data_ + PAYLOAD);
+     }
+     /*
+       Place a payload whose header is already decoded.
+      */
+     int32_t Place(const XHeader& header, const uint8_t* payload_)
+     {
+          uint32_t size = header._payload_size;
+          uint32_t line = header._line_id;
+          uint32_t id = header._packet_id;
+          if(!_frame_ || 0 == _slot_num || line >= _height || id >= _packet_per_line
+             || 0 != line % _line_per_packet)
+          {
+               _stats._dropped++;
+               return XPLACE_ERROR;
+          }
+          uint32_t expect = _payload_size;
+          if(_line_per_packet > 1)
+               expect = ((_height - line < _line_per_packet) ? _height - line : _line_per_packet)
+                    * _line_bytes;
+          else if(id + 1 == _packet_per_line)
+               expect = _line_bytes - id * _payload_size;
+          if(size != expect)
+          {
+               _stats._dropped++;
+               return XPLACE_ERROR;
+          }
+          uint32_t slot = line / _line_per_packet * _packet_per_line + id;
+          uint64_t bit = (uint64_t)1 << (slot & 63);
+          if(_arrived[slot >> 6] & bit)
+          {
+               _stats._duplicated++;
+               return XPLACE_PAYLOAD;
+          }
+          _arrived[slot >> 6] |= bit;
+
+          uint64_t pos = (uint64_t)line * _line_bytes + (uint64_t)id * _payload_size;
+          bool is_last_line = (pos + size == _frame_bytes);
+          if(0 == _data_offset)
+               memcpy(_frame_ + pos, payload_, size);
+          else
+          {
+               //Split at line boundaries to skip the line info bytes
+               uint32_t left = size;
+               while(left)
+               {
+                    uint32_t row = (uint32_t)(pos / _line_bytes);
+                    uint32_t col = (uint32_t)(pos % _line_bytes);
+                    uint32_t len = _line_bytes - col;
+                    if(len > left)
+                         len = left;
+                    memcpy(_frame_ + (uint64_t)row * _line_size + _data_offset
+                           + col, payload_, len);
+                    payload_ += len;
+                    pos += len;
+                    left -= len;
+               }
+          }
+          _stats._packets++;
+          _stats._bytes_copied += size;
+          if(is_last_line)
+               XTraceInstant(XTRACE_LAST_LINE, header._frame_id);
+          if(_stats._packets == _slot_num)
+               return XPLACE_FRAME_DONE;
+          return XPLACE_PAYLOAD;
+     }
+     /*
+       Payload bytes and packets not yet received for the current frame.
+      */
+     uint64_t GetMissingBytes()
+     {
+          return _frame_bytes - _stats._bytes_copied;
+     }
+     uint32_t GetMissingPackets()
+     {
+          return _slot_num - _stats._packets;
+     }
+     uint64_t GetFrameBytes()
+     {
+          return _frame_bytes;
+     }
+     /*
+       Payload packets of one frame.
+      */
+     uint32_t GetPacketNum()
+     {
+          return _slot_num;
+     }
+     void GetStats(XPlaceStats& stats)
+     {
+          stats = _stats;
+     }
+
+private:
+     XLinePlacer(const XLinePlacer&);
+     XLinePlacer& operator = (const XLinePlacer&);
+
+     void ResetFrame()
+     {
+          memset(&_stats, 0, sizeof(_stats));
+          if(!_arrived.empty())
+               memset(&_arrived[0], 0, _arrived.size() * sizeof(uint64_t));
+     }
+
+     uint8_t* _frame_;
+     uint32_t _width;
+     uint32_t _height;
+     uint32_t _pixel_byte;
+     uint32_t _data_offset;
+     uint32_t _line_bytes;    //Pixel bytes of one line
+     uint32_t _line_size;     //Line pitch in frame memory
+     uint64_t _frame_bytes;
+     uint32_t _payload_size;  //Payload bytes of every packet but the last of a line
+     uint32_t _packet_per_line;
+     uint32_t _line_per_packet;
+     uint32_t _slot_num;      //Payload packets per frame
+     std::vector<uint64_t> _arrived;   //One bit per slot, current frame
+     XPlaceStats _stats;
+};
+#endif //XLINE_PLACE_H
@@ -0,0 +1,331 @@
+/*
+  Copyright (c), Detection Technology Inc.
+  All right reserved.
+
+ */
+
+#ifndef XPACKET_RING_H
+#define XPACKET_RING_H
+#include "xpacket_pool.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#define XRING_CACHE_LINE  64
+#define XRING_SPIN_COUNT  256      //Spins before yielding the CPU
+#define XRING_YIELD_TIME  50       //Yield before sleeping, us, covers the gaps of a burst
+#define XRING_WAIT_TIME   100      //Default wait for a packet, ms
+
+/*
+  Single-producer/single-consumer ring of packet pointers. Head is only
+  written by the consumer and tail only by the producer, each on its own
+  cache line, so passing a packet costs no lock and no syscall. Each side
+  also keeps a cached copy of the other index and only reloads it when the
+  ring looks full or empty.
+  A consumer that finds the ring empty for long sleeps in PopWait(). It
+  flags itself in _is_waiting first, and the producer only takes the mutex
+  to wake it when it sees the flag, so a busy ring still costs no syscall.
+  Capacity must be a power of two.
+ */
+class XPacketRing
+{
+public:
+     XPacketRing()
+          :_slots_(NULL)
+          ,_mask(0)
+     {
+          _head.store(0);
+          _tail.store(0);
+          _is_waiting.store(0);
+          _cached_head = 0;
+          _cached_tail = 0;
+     }
+     ~XPacketRing()
+     {
+          delete [] _slots_;
+     }
+
+     bool Initialize(uint32_t capacity)
+     {
+          if(0 == capacity || (capacity & (capacity - 1)))
+               return 0;
+          delete [] _slots_;
+          _slots_ = new XPacket*[capacity];
+          _mask = capacity - 1;
+          Reset();
+          return 1;
+     }
+     /*
+       Only call when neither side is running.
+      */
+     void Reset()
+     {
+          _head.store(0, std::memory_order_relaxed);
+          _tail.store(0, std::memory_order_relaxed);
+          _is_waiting.store(0, std::memory_order_relaxed);
+          _cached_head = 0;
+          _cached_tail = 0;
+     }
+     uint32_t GetCapacity()
+     {
+          return _mask + 1;
+     }
+     uint32_t GetCount()
+     {
+          return _tail.load(std::memory_order_acquire)
+               - _head.load(std::memory_order_acquire);
+     }
+     /*
+       Producer side. Push up to num packets, return how many were pushed.
+      */
+     uint32_t Push(XPacket** packets_, uint32_t num)
+     {
+          uint32_t tail = _tail.load(std::memory_order_relaxed);
+          uint32_t space = _mask + 1 - (tail - _cached_head);
+          if(space < num)
+          {
+               _cached_head = _head.load(std::memory_order_acquire);
+               space = _mask + 1 - (tail - _cached_head);
+               if(space < num)
+                    num = space;
+          }
+          for(uint32_t i = 0; i < num; i++)
+               _slots_[(tail + i) & _mask] = packets_[i];
+          _tail.store(tail + num, std::memory_order_release);
+          //Pairs with the fence in PopWait(): either the consumer sees the
+          //new tail or we see its flag
+          std::atomic_thread_fence(std::memory_order_seq_cst);
+          if(num && _is_waiting.load(std::memory_order_relaxed))
+          {
+               std::lock_guard<std::mutex> lock(_mutex);
+               _cond.notify_one();
+          }
+          return num;
+     }
+     /*
+       Consumer side. Pop up to num packets, return how many were popped.
+      */
+     uint32_t Pop(XPacket** packets_, uint32_t num)
+     {
+          uint32_t head = _head.load(std::memory_order_relaxed);
+          uint32_t avail = _cached_tail - head;
+          if(avail < num)
+          {
+               _cached_tail = _tail.load(std::memory_order_acquire);
+               avail = _cached_tail - head;
+               if(avail < num)
+                    num = avail;
+          }
+          for(uint32_t i = 0; i < num; i++)
+               packets_[i] = _slots_[(head + i) & _mask];
+          _head.store(head + num, std::memory_order_release);
+          return num;
+     }
+     /*
+       Consumer side. Pop up to num packets, sleeping until the producer
+       pushes or end passes. Return how many were popped.
+      */
+     uint32_t PopWait(XPacket** packets_, uint32_t num,
+                      std::chrono::steady_clock::time_point end)
+     {
+          std::unique_lock<std::mutex> lock(_mutex);
+          _is_waiting.store(1, std::memory_order_relaxed);
+          std::atomic_thread_fence(std::memory_order_seq_cst);
+          uint32_t got = Pop(packets_, num);
+          while(!got && std::cv_status::timeout != _cond.wait_until(lock, end))
+               got = Pop(packets_, num);
+          if(!got)
+               got = Pop(packets_, num);
+          _is_waiting.store(0, std::memory_order_relaxed);
+          return got;
+     }
+
+private:
+     XPacketRing(const XPacketRing&);
+     XPacketRing& operator = (const XPacketRing&);
+
+     //Padding keeps the consumer and producer fields a full cache line
+     //apart, whatever the alignment of the object itself
+     XPacket** _slots_;
+     uint32_t _mask;
+     char _pad0[XRING_CACHE_LINE];
+     std::atomic<uint32_t> _head;
+     uint32_t _cached_tail;        //Consumer's copy of _tail
+     char _pad1[XRING_CACHE_LINE];
+     std::atomic<uint32_t> _tail;
+     uint32_t _cached_head;        //Producer's copy of _head
+     char _pad2[XRING_CACHE_LINE];
+     std::atomic<bool> _is_waiting;  //Consumer sleeps in PopWait()
+     std::mutex _mutex;
+     std::condition_variable _cond;
+};
+
+/*
+  Packet pool built on two XPacketRing. The free ring carries empty packets
+  from the parse thread back to the grab thread, the used ring carries filled
+  packets from the grab thread to the parse thread.
+  The single packet calls keep the XPacketPool API, so existing grab and
+  parse loops can switch over unchanged. The batched calls move up to a
+  whole recvmmsg() batch per ring operation.
+ */
+class XPacketRingPool
+{
+public:
+     XPacketRingPool()
+          :_is_init(0)
+          ,_packets_(NULL)
+          ,_mem_pool_(NULL)
+          ,_wait_time(XRING_WAIT_TIME)
+     {}
+     ~XPacketRingPool()
+     {
+          Release();
+     }
+
+     bool Initialize()
+     {
+          if(_is_init)
+               return 1;
+          _packets_ = new XPacket[XPAC_NUM];
+          _mem_pool_ = (uint8_t*)_aligned_malloc((size_t)XPAC_SIZE * XPAC_NUM,
+                                                 SSE_ALIGN_BYTE);
+          if(!_mem_pool_ || !_free_ring.Initialize(XPAC_NUM)
+             || !_used_ring.Initialize(XPAC_NUM))
+          {
+               Release();
+               return 0;
+          }
+          _is_init = 1;
+          Reset();
+          return 1;
+     }
+     /*
+       Put every packet back to the free ring. Only call when the grab and
+       parse threads are stopped.
+      */
+     void Reset()
+     {
+          if(!_is_init)
+               return;
+          _free_ring.Reset();
+          _used_ring.Reset();
+          for(uint32_t i = 0; i < XPAC_NUM; i++)
+          {
+               XPacket* packet_ = &_packets_[i];
+               packet_->next_ = NULL;
+               packet_->size = 0;
+               packet_->data_ = _mem_pool_ + (size_t)i * XPAC_SIZE;
+               _free_ring.Push(&packet_, 1);
+          }
+     }
+     void SetWaitTime(uint32_t millisecond)
+     {
+          _wait_time = millisecond;
+     }
+
+     //XPacketPool compatible calls, return NULL after the wait time
+     XPacket* GetFreePacket()
+     {
+          XPacket* packet_ = NULL;
+          GetFreePackets(&packet_, 1);
+          return packet_;
+     }
+     XPacket* GetUsedPacket()
+     {
+          XPacket* packet_ = NULL;
+          GetUsedPackets(&packet_, 1);
+          return packet_;
+     }
+     void PushFreePacket(XPacket* packet_)
+     {
+          PushFreePackets(&packet_, 1);
+     }
+     void PushUsedPacket(XPacket* packet_)
+     {
+          PushUsedPackets(&packet_, 1);
+     }
+
+     //Batched calls, return the number of packets moved
+     uint32_t GetFreePackets(XPacket** packets_, uint32_t num)
+     {
+          return Wait(_free_ring, packets_, num);
+     }
+     uint32_t GetUsedPackets(XPacket** packets_, uint32_t num)
+     {
+          return Wait(_used_ring, packets_, num);
+     }
+     /*
+       The rings hold every packet of the pool, so a push never runs out of
+       space.
+      */
+     void PushFreePackets(XPacket** packets_, uint32_t num)
+     {
+          _free_ring.Push(packets_, num);
+     }
+     void PushUsedPackets(XPacket** packets_, uint32_t num)
+     {
+          _used_ring.Push(packets_, num);
+     }
+     uint32_t GetFreeNum()
+     {
+          return _free_ring.GetCount();
+     }
+     uint32_t GetUsedNum()
+     {
+          return _used_ring.GetCount();
+     }
+
+private:
+     XPacketRingPool(const XPacketRingPool&);
+     XPacketRingPool& operator = (const XPacketRingPool&);
+
+     /*
+       Pop at least one packet. Spin first, yield for XRING_YIELD_TIME,
+       then sleep until a push or the end of the wait time. Within a burst
+       of packets the consumer stays awake, between frames it sleeps.
+      */
+     uint32_t Wait(XPacketRing& ring, XPacket** packets_, uint32_t num)
+     {
+          uint32_t got = ring.Pop(packets_, num);
+          if(got || !_is_init)
+               return got;
+          for(uint32_t i = 0; i < XRING_SPIN_COUNT; i++)
+          {
+               got = ring.Pop(packets_, num);
+               if(got)
+                    return got;
+          }
+          std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+          std::chrono::steady_clock::time_point end =
+               now + std::chrono::milliseconds(_wait_time);
+          std::chrono::steady_clock::time_point yield_end =
+               now + std::chrono::microseconds(XRING_YIELD_TIME);
+          do
+          {
+               std::this_thread::yield();
+               got = ring.Pop(packets_, num);
+               if(got)
+                    return got;
+          }while(std::chrono::steady_clock::now() < yield_end);
+          return ring.PopWait(packets_, num, end);
+     }
+     void Release()
+     {
+          _is_init = 0;
+          delete [] _packets_;
+          _packets_ = NULL;
+          if(_mem_pool_)
+               _aligned_free(_mem_pool_);
+          _mem_pool_ = NULL;
+     }
+
+     bool     _is_init;
+     XPacket* _packets_;
+     uint8_t* _mem_pool_;
+     uint32_t _wait_time;
+     XPacketRing _free_ring;
+     XPacketRing _used_ring;
+};
+#endif //XPACKET_RING_H
@@ -0,0 +1,623 @@
+/*
+  Copyright (c), Detection Technology Inc.
+  All right reserved.
+
+ */
+
+#ifndef XPCAP_REPLAY_H
+#define XPCAP_REPLAY_H
+#include "xconfigure.h"
+#include "xfile_map.h"
+#include <string.h>
+#include <vector>
+#ifdef __linux__
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#endif
+
+#define XPCAP_SHB_TYPE      0x0A0D0D0A   //pcapng section header block
+#define XPCAP_IDB_TYPE      0x00000001   //Interface description block
+#define XPCAP_SPB_TYPE      0x00000003   //Simple packet block
+#define XPCAP_EPB_TYPE      0x00000006   //Enhanced packet block
+#define XPCAP_BYTE_ORDER    0x1A2B3C4D
+#define XPCAP_MAGIC_US      0xA1B2C3D4   //Classic pcap, us timestamps
+#define XPCAP_MAGIC_NS      0xA1B23C4D   //Classic pcap, ns timestamps
+
+//Link types
+#define XPCAP_LINK_ETHERNET 1
+#define XPCAP_LINK_RAW      101
+#define XPCAP_LINK_SLL      113
+
+/*
+  One UDP datagram of a capture. Addresses and ports are in host order,
+  _data_ points into the mapped capture.
+ */
+struct XPcapPacket
+{
+     uint64_t _time_ns;       //Since the first packet
+     uint32_t _src_ip;
+     uint32_t _dst_ip;
+     uint16_t _src_port;
+     uint16_t _dst_port;
+     uint32_t _size;
+     const uint8_t* _data_;
+};
+
+/*
+  XPcapFile indexes the UDP/IPv4 datagrams of a pcapng or classic pcap
+  file without libpcap. The file is mapped, nothing is copied. Both byte
+  orders, per interface timestamp resolutions, VLAN tags and Ethernet, raw
+  IP and Linux cooked link types are read, other blocks, IP fragments and
+  truncated packets are skipped.
+ */
+class XPcapFile
+{
+public:
+     XPcapFile()
+          :_is_swap(0)
+     {}
+     ~XPcapFile()
+     {
+          Close();
+     }
+
+     bool Open(const char* file_)
+     {
+          Close();
+          if(!_map.Open(file_, XMAP_READ) || _map.GetSize() < 24)
+          {
+               Close();
+               return 0;
+          }
+          uint32_t magic = GetU32(_map.GetData(), 0);
+          bool ret = (XPCAP_SHB_TYPE == magic) ? LoadPcapng() : LoadPcap();
+          if(!ret)
+          {
+               Close();
+               return 0;
+          }
+          //Times relative to the first packet, captures may be out of order
+          uint64_t first = ~(uint64_t)0;
+          for(size_t i = 0; i < _packets.size(); i++)
+               if(_packets[i]._time_ns < first)
+                    first = _packets[i]._time_ns;
+          for(size_t i = 0; i < _packets.size(); i++)
+               _packets[i]._time_ns -= first;
+          return 1;
+     }
+     void Close()
+     {
+          _packets.clear();
+          _links.clear();
+          _map.Close();
+          _is_swap = 0;
+     }
+     uint32_t GetPacketNum()
+     {
+          return (uint32_t)_packets.size();
+     }
+     const XPcapPacket* GetPacket(uint32_t index)
+     {
+          if(index >= _packets.size())
+               return NULL;
+          return &_packets[index];
+     }
+     /*
+       Time of the last packet in ns.
+      */
+     uint64_t GetDuration()
+     {
+          uint64_t duration = 0;
+          for(size_t i = 0; i < _packets.size(); i++)
+               if(_packets[i]._time_ns > duration)
+                    duration = _packets[i]._time_ns;
+          return duration;
+     }
+
+private:
+     XPcapFile(const XPcapFile&);
+     XPcapFile& operator = (const XPcapFile&);
+
+     /*
+       Link type and ns per timestamp unit of a pcapng interface.
+      */
+     struct XPcapLink
+     {
+          uint32_t _type;
+          double   _unit_ns;
+     };
+
+     uint16_t GetU16(const uint8_t* data_, size_t pos)
+     {
+          uint16_t value;
+          memcpy(&value, data_ + pos, 2);
+          return _is_swap ? (uint16_t)((value >> 8) | (value << 8)) : value;
+     }
+     uint32_t GetU32(const uint8_t* data_, size_t pos)
+     {
+          uint32_t value;
+          memcpy(&value, data_ + pos, 4);
+          if(_is_swap)
+               value = (value >> 24) | ((value >> 8) & 0xFF00)
+                    | ((value << 8) & 0xFF0000) | (value << 24);
+          return value;
+     }
+     static uint16_t GetBE16(const uint8_t* data_)
+     {
+          return (uint16_t)((data_[0] << 8) | data_[1]);
+     }
+     static uint32_t GetBE32(const uint8_t* data_)
+     {
+          return ((uint32_t)data_[0] << 24) | ((uint32_t)data_[1] << 16)
+               | ((uint32_t)data_[2] << 8) | data_[3];
+     }
+     bool LoadPcapng()
+     {
+          const uint8_t* data_ = _map.GetData();
+          size_t size = _map.GetSize();
+          size_t pos = 0;
+          while(pos + 12 <= size)
+          {
+               uint32_t type = GetU32(data_, pos);
+               if(XPCAP_SHB_TYPE == type)
+               {
+                    //The byte order magic sets the order of the section
+                    _is_swap = 0;
+                    uint32_t order = GetU32(data_, pos + 8);
+                    if(XPCAP_BYTE_ORDER != order)
+                    {
+                         _is_swap = 1;
+                         if(XPCAP_BYTE_ORDER != GetU32(data_, pos + 8))
+                              return 0;
+                    }
+                    _links.clear();
+               }
+               uint32_t len = GetU32(data_, pos + 4);
+               if(len < 12 || (len & 3) || pos + len > size)
+                    break;
+               const uint8_t* body_ = data_ + pos + 8;
+               uint32_t body_len = len - 12;
+               if(XPCAP_IDB_TYPE == type && body_len >= 8)
+                    AddLink(body_, body_len);
+               else if(XPCAP_EPB_TYPE == type && body_len >= 20)
+               {
+                    uint32_t link = GetU32(body_, 0);
+                    uint64_t time = ((uint64_t)GetU32(body_, 4) << 32) | GetU32(body_, 8);
+                    uint32_t cap_len = GetU32(body_, 12);
+                    if(link < _links.size() && 20 + (uint64_t)cap_len <= body_len)
+                         AddFrame(_links[link]._type, ToNs(time, _links[link]._unit_ns),
+                                  body_ + 20, cap_len);
+               }
+               else if(XPCAP_SPB_TYPE == type && body_len >= 4 && !_links.empty())
+               {
+                    //No timestamp, replayed back to back
+                    uint32_t cap_len = GetU32(body_, 0);
+                    if(cap_len > body_len - 4)
+                         cap_len = body_len - 4;
+                    AddFrame(_links[0]._type, 0, body_ + 4, cap_len);
+               }
+               pos += len;
+          }
+          return 1;
+     }
+     /*
+       Whole ns units stay integer, a double loses ns past 2^53.
+      */
+     static uint64_t ToNs(uint64_t time, double unit_ns)
+     {
+          if(unit_ns >= 1 && unit_ns == (double)(uint64_t)unit_ns)
+               return time * (uint64_t)unit_ns;
+          return (uint64_t)(time * unit_ns);
+     }
+     void AddLink(const uint8_t* body_, uint32_t body_len)
+     {
+          XPcapLink link;
+          link._type = GetU16(body_, 0);
+          link._unit_ns = 1000;
+          //if_tsresol option, power of 10 or of 2 if the top bit is set
+          for(uint32_t pos = 8; pos + 4 <= body_len; )
+          {
+               uint16_t code = GetU16(body_, pos);
+               uint16_t len = GetU16(body_, pos + 2);
+               if(0 == code || pos + 4 + len > body_len)
+                    break;
+               if(9 == code && len >= 1)
+               {
+                    uint8_t resol = body_[pos + 4];
+                    double unit = 1;
+                    for(uint32_t i = 0; i < (resol & 0x7Fu); i++)
+                         unit /= (resol & 0x80) ? 2 : 10;
+                    link._unit_ns = unit * 1e9;
+               }
+               pos += 4 + ((len + 3u) & ~3u);
+          }
+          _links.push_back(link);
+     }
+     bool LoadPcap()
+     {
+          const uint8_t* data_ = _map.GetData();
+          size_t size = _map.GetSize();
+          uint32_t magic = GetU32(data_, 0);
+          if(XPCAP_MAGIC_US != magic && XPCAP_MAGIC_NS != magic)
+          {
+               _is_swap = 1;
+               magic = GetU32(data_, 0);
+               if(XPCAP_MAGIC_US != magic && XPCAP_MAGIC_NS != magic)
+                    return 0;
+          }
+          uint64_t unit_ns = (XPCAP_MAGIC_NS == magic) ? 1 : 1000;
+          uint32_t link_type = GetU32(data_, 20) & 0xFFFF;
+          for(size_t pos = 24; pos + 16 <= size; )
+          {
+               uint64_t time = (uint64_t)GetU32(data_, pos) * 1000000000ull
+                    + GetU32(data_, pos + 4) * unit_ns;
+               uint32_t cap_len = GetU32(data_, pos + 8);
+               if(pos + 16 + (uint64_t)cap_len > size)
+                    break;
+               AddFrame(link_type, time, data_ + pos + 16, cap_len);
+               pos += 16 + cap_len;
+          }
+          return 1;
+     }
+     /*
+       Take the UDP/IPv4 datagram out of one link layer frame.
+      */
+     void AddFrame(uint32_t link_type, uint64_t time_ns, const uint8_t* frame_, uint32_t len)
+     {
+          uint32_t pos = 0;
+          uint16_t ether_type = 0x0800;
+          if(XPCAP_LINK_ETHERNET == link_type)
+          {
+               if(len < 14)
+                    return;
+               ether_type = GetBE16(frame_ + 12);
+               pos = 14;
+               //802.1Q / 802.1ad tags
+               while((0x8100 == ether_type || 0x88A8 == ether_type) && pos + 4 <= len)
+               {
+                    ether_type = GetBE16(frame_ + pos + 2);
+                    pos += 4;
+               }
+          }
+          else if(XPCAP_LINK_SLL == link_type)
+          {
+               if(len < 16)
+                    return;
+               ether_type = GetBE16(frame_ + 14);
+               pos = 16;
+          }
+          else if(XPCAP_LINK_RAW != link_type)
+               return;
+          if(0x0800 != ether_type || pos + 20 > len || 4 != (frame_[pos] >> 4))
+               return;
+          const uint8_t* ip_ = frame_ + pos;
+          uint32_t ip_len = (ip_[0] & 0x0Fu) * 4;
+          uint32_t total_len = GetBE16(ip_ + 2);
+          //UDP only, no fragments
+          if(17 != ip_[9] || (GetBE16(ip_ + 6) & 0x3FFF) || ip_len < 20
+             || total_len < ip_len + 8 || pos + total_len > len)
+               return;
+          const uint8_t* udp_ = ip_ + ip_len;
+          uint32_t udp_len = GetBE16(udp_ + 4);
+          if(udp_len < 8 || udp_len > total_len - ip_len)
+               return;
+          XPcapPacket packet;
+          packet._time_ns = time_ns;
+          packet._src_ip = GetBE32(ip_ + 12);
+          packet._dst_ip = GetBE32(ip_ + 16);
+          packet._src_port = GetBE16(udp_);
+          packet._dst_port = GetBE16(udp_ + 2);
+          packet._size = udp_len - 8;
+          packet._data_ = udp_ + 8;
+          _packets.push_back(packet);
+     }
+
+     XFileMap _map;
+     bool _is_swap;
+     std::vector<XPcapLink> _links;
+     std::vector<XPcapPacket> _packets;
+};
+
+#ifdef __linux__
+#define XREPLAY_SOURCE_IP   "127.0.0.2"  //Plays the detector, the SDK has 127.0.0.1
+#define XREPLAY_TARGET_IP   "127.0.0.1"
+#define XREPLAY_BATCH       64           //Packets per sendmmsg()
+#define XREPLAY_SPIN_NS     200000       //Busy wait below this, sleep above
+
+/*
+  Counters of XPcapReplay. A packet is late when it leaves after its
+  scaled capture time, _max_late_ns is the worst case.
+ */
+struct XReplayStats
+{
+     uint64_t _packets;
+     uint64_t _bytes;
+     uint64_t _loops;
+     uint64_t _late;
+     uint64_t _max_late_ns;
+};
+
+/*
+  XPcapReplay re-sends the UDP payloads of an XPcapFile to the local
+  XUDPCmdEngine / XUDPImgEngine. Each packet goes out from a socket bound
+  to the source IP and its captured source port (an ephemeral one if that
+  is taken) to the target IP and its captured destination port, so the
+  engines see the detector's ports.
+  Run() keeps the capture timing divided by speed, e.g. 1, 2 or 10, or
+  sends back to back in sendmmsg() batches with speed 0. A loop starts
+  when the previous one ends.
+ */
+class XPcapReplay
+{
+public:
+     XPcapReplay()
+          :_file_(NULL)
+          ,_is_stop(0)
+     {
+          memset(&_stats, 0, sizeof(_stats));
+     }
+     ~XPcapReplay()
+     {
+          Close();
+     }
+
+     /*
+       Take the packets of file_ which match the filter, src_ip in host
+       order or 0 for any, dst_port 0 for any.
+      */
+     bool Open(XPcapFile* file_, uint32_t src_ip = 0, uint16_t dst_port = 0,
+               const char* source_ip_ = XREPLAY_SOURCE_IP,
+               const char* target_ip_ = XREPLAY_TARGET_IP)
+     {
+          Close();
+          if(!file_)
+               return 0;
+          sockaddr_in source;
+          memset(&source, 0, sizeof(source));
+          memset(&_target, 0, sizeof(_target));
+          source.sin_family = AF_INET;
+          _target.sin_family = AF_INET;
+          if(1 != inet_pton(AF_INET, source_ip_, &source.sin_addr)
+             || 1 != inet_pton(AF_INET, target_ip_, &_target.sin_addr))
+               return 0;
+          _file_ = file_;
+          for(uint32_t i = 0; i < file_->GetPacketNum(); i++)
+          {
+               const XPcapPacket* packet_ = file_->GetPacket(i);
+               if((src_ip && src_ip != packet_->_src_ip)
+                  || (dst_port && dst_port != packet_->_dst_port))
+                    continue;
+               XReplayItem item;
+               item._index = i;
+               item._fd = GetSocket(source, packet_->_src_port);
+               if(item._fd < 0)
+               {
+                    Close();
+                    return 0;
+               }
+               _items.push_back(item);
+          }
+          //Send in capture time order
+          std::stable_sort(_items.begin(), _items.end(), XReplayItemLess(file_));
+          return !_items.empty();
+     }
+     void Close()
+     {
+          for(size_t i = 0; i < _sockets.size(); i++)
+               close(_sockets[i]._fd);
+          _sockets.clear();
+          _items.clear();
+          _file_ = NULL;
+     }
+     uint32_t GetPacketNum()
+     {
+          return (uint32_t)_items.size();
+     }
+     /*
+       Replay loop_num times, 0 until Stop(). Blocks, Stop() may be called
+       from another thread or a signal handler.
+      */
+     void Run(double speed, uint32_t loop_num = 1)
+     {
+          {
+               std::lock_guard<std::mutex> lock(_mutex);
+               memset(&_stats, 0, sizeof(_stats));
+          }
+          _is_stop = 0;
+          if(_items.empty())
+               return;
+          for(uint32_t loop = 0; (0 == loop_num || loop < loop_num) && !_is_stop; loop++)
+          {
+               if(speed > 0)
+                    RunTimed(speed);
+               else
+                    RunBatch();
+               std::lock_guard<std::mutex> lock(_mutex);
+               _stats._loops++;
+          }
+     }
+     void Stop()
+     {
+          _is_stop = 1;
+     }
+     void GetStats(XReplayStats& stats)
+     {
+          std::lock_guard<std::mutex> lock(_mutex);
+          stats = _stats;
+     }
+
+private:
+     XPcapReplay(const XPcapReplay&);
+     XPcapReplay& operator = (const XPcapReplay&);
+
+     struct XReplayItem
+     {
+          uint32_t _index;
+          int32_t  _fd;
+     };
+     struct XReplaySocket
+     {
+          uint16_t _port;
+          int32_t  _fd;
+     };
+
+     struct XReplayItemLess
+     {
+          explicit XReplayItemLess(XPcapFile* file_)
+               :_file_(file_)
+          {}
+          bool operator () (const XReplayItem& a, const XReplayItem& b) const
+          {
+               return _file_->GetPacket(a._index)->_time_ns
+                    < _file_->GetPacket(b._index)->_time_ns;
+          }
+          XPcapFile* _file_;
+     };
+     int32_t GetSocket(sockaddr_in source, uint16_t port)
+     {
+          for(size_t i = 0; i < _sockets.size(); i++)
+               if(_sockets[i]._port == port)
+                    return _sockets[i]._fd;
+          int32_t fd = socket(AF_INET, SOCK_DGRAM, 0);
+          if(fd < 0)
+               return -1;
+          int32_t buf_size = 8 * 1024 * 1024;
+          setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &buf_size, sizeof(buf_size));
+          source.sin_port = htons(port);
+          if(bind(fd, (sockaddr*)&source, sizeof(source)) != 0)
+          {
+               source.sin_port = 0;
+               if(bind(fd, (sockaddr*)&source, sizeof(source)) != 0)
+               {
+                    close(fd);
+                    return -1;
+               }
+          }
+          XReplaySocket sock;
+          sock._port = port;
+          sock._fd = fd;
+          _sockets.push_back(sock);
+          return fd;
+     }
+     void AddStats(const XReplayStats& stats)
+     {
+          std::lock_guard<std::mutex> lock(_mutex);
+          _stats._packets += stats._packets;
+          _stats._bytes += stats._bytes;
+          _stats._late += stats._late;
+          if(stats._max_late_ns > _stats._max_late_ns)
+               _stats._max_late_ns = stats._max_late_ns;
+     }
+     /*
+       One loop at the capture timing divided by speed. Long waits sleep,
+       the last XREPLAY_SPIN_NS are spun for sub-ms accuracy.
+      */
+     void RunTimed(double speed)
+     {
+          XReplayStats stats;
+          memset(&stats, 0, sizeof(stats));
+          sockaddr_in target = _target;
+          //Timed from the first packet that passed the filter
+          uint64_t first = _file_->GetPacket(_items[0]._index)->_time_ns;
+          std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+          for(size_t i = 0; i < _items.size() && !_is_stop; i++)
+          {
+               const XPcapPacket* packet_ = _file_->GetPacket(_items[i]._index);
+               std::chrono::steady_clock::time_point due = start
+                    + std::chrono::nanoseconds((uint64_t)((packet_->_time_ns - first) / speed));
+               std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+               if(due - now > std::chrono::nanoseconds(XREPLAY_SPIN_NS))
+                    std::this_thread::sleep_until(due - std::chrono::nanoseconds(XREPLAY_SPIN_NS));
+               while((now = std::chrono::steady_clock::now()) < due)
+                    ;
+               uint64_t late = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    now - due).count();
+               if(late > XREPLAY_SPIN_NS)
+                    stats._late++;
+               if(late > stats._max_late_ns)
+                    stats._max_late_ns = late;
+               target.sin_port = htons(packet_->_dst_port);
+               if(sendto(_items[i]._fd, packet_->_data_, packet_->_size, 0,
+                         (sockaddr*)&target, sizeof(target)) >= 0)
+               {
+                    stats._packets++;
+                    stats._bytes += packet_->_size;
+               }
+               //Publish now and then, the counters are read while running
+               if(0 == (stats._packets & 1023))
+               {
+                    AddStats(stats);
+                    memset(&stats, 0, sizeof(stats));
+               }
+          }
+          AddStats(stats);
+     }
+     /*
+       One loop back to back, runs of packets on the same socket go out in
+       one sendmmsg().
+      */
+     void RunBatch()
+     {
+          mmsghdr msgs[XREPLAY_BATCH];
+          iovec iovs[XREPLAY_BATCH];
+          sockaddr_in targets[XREPLAY_BATCH];
+          for(size_t i = 0; i < _items.size() && !_is_stop; )
+          {
+               XReplayStats stats;
+               memset(&stats, 0, sizeof(stats));
+               int32_t fd = _items[i]._fd;
+               uint32_t num = 0;
+               for(; i < _items.size() && num < XREPLAY_BATCH && _items[i]._fd == fd; i++, num++)
+               {
+                    const XPcapPacket* packet_ = _file_->GetPacket(_items[i]._index);
+                    targets[num] = _target;
+                    targets[num].sin_port = htons(packet_->_dst_port);
+                    iovs[num].iov_base = (void*)packet_->_data_;
+                    iovs[num].iov_len = packet_->_size;
+                    memset(&msgs[num], 0, sizeof(msgs[num]));
+                    msgs[num].msg_hdr.msg_name = &targets[num];
+                    msgs[num].msg_hdr.msg_namelen = sizeof(targets[num]);
+                    msgs[num].msg_hdr.msg_iov = &iovs[num];
+                    msgs[num].msg_hdr.msg_iovlen = 1;
+               }
+               uint32_t sent = 0;
+               while(sent < num && !_is_stop)
+               {
+                    int32_t ret = sendmmsg(fd, msgs + sent, num - sent, 0);
+                    if(ret < 0)
+                    {
+                         //Loopback ran out of buffer, give the receiver a moment
+                         if(ENOBUFS == errno || EAGAIN == errno)
+                         {
+                              std::this_thread::yield();
+                              continue;
+                         }
+                         break;
+                    }
+                    for(int32_t k = 0; k < ret; k++)
+                         stats._bytes += iovs[sent + k].iov_len;
+                    sent += (uint32_t)ret;
+               }
+               stats._packets = sent;
+               AddStats(stats);
+          }
+     }
+
+     XPcapFile* _file_;
+     sockaddr_in _target;
+     std::vector<XReplayItem> _items;
+     std::vector<XReplaySocket> _sockets;
+     std::atomic<bool> _is_stop;
+     XReplayStats _stats;
+     std::mutex _mutex;
+};
+#endif //__linux__
+#endif //XPCAP_REPLAY_H
@@ -0,0 +1,167 @@
+/*
+  Copyright (c), Detection Technology Inc.
+  All right reserved.
+
+ */
+
+#ifndef XRAW_FILE_H
+#define XRAW_FILE_H
+#include "xconfigure.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#ifdef _MSC_VER
+#include <io.h>
+#endif
+
+/*
+  Geometry of a raw .dat file written by XImageHandler. The frames are
+  stored back to back without line info, the geometry is in the .txt header
+  file of the same name (Width=, Height=, PixelDepth=, NumberOfImages=).
+ */
+struct XRawInfo
+{
+     uint32_t _width;
+     uint32_t _height;
+     uint32_t _pixel_depth;
+     uint32_t _image_num;
+};
+
+inline uint32_t XRawPixelByte(const XRawInfo& info)
+{
+     return (info._pixel_depth > 16) ? 4 : 2;
+}
+inline size_t XRawFrameSize(const XRawInfo& info)
+{
+     return (size_t)info._width * info._height * XRawPixelByte(info);
+}
+/*
+  Header file name of a .dat file, "dir/img1.dat" -> "dir/img1.txt".
+ */
+inline std::string XRawHeaderName(const char* dat_file_)
+{
+     std::string name(dat_file_);
+     size_t dot = name.find_last_of('.');
+     size_t slash = name.find_last_of("/\\");
+     if(std::string::npos != dot && (std::string::npos == slash || dot > slash))
+          name.erase(dot);
+     return name + ".txt";
+}
+/*
+  File name of a path without its directory, "dir/img1.dat" -> "img1.dat".
+ */
+inline std::string XRawBaseName(const char* file_)
+{
+     std::string name(file_);
+     size_t slash = name.find_last_of("/\\");
+     if(std::string::npos != slash)
+          name.erase(0, slash + 1);
+     return name;
+}
+/*
+  Read the header file of dat_file_. Return 0 when it is missing or has no
+  usable geometry.
+ */
+inline bool XReadRawInfo(const char* dat_file_, XRawInfo& info)
+{
+     memset(&info, 0, sizeof(info));
+     FILE* file_ = fopen(XRawHeaderName(dat_file_).c_str(), "r");
+     if(!file_)
+          return 0;
+     char line[256];
+     while(fgets(line, sizeof(line), file_))
+     {
+          char* value_ = strchr(line, '=');
+          if(!value_)
+               continue;
+          *value_++ = 0;
+          uint32_t value = (uint32_t)strtoul(value_, NULL, 10);
+          if(0 == strcmp(line, "Width"))
+               info._width = value;
+          else if(0 == strcmp(line, "Height"))
+               info._height = value;
+          else if(0 == strcmp(line, "PixelDepth"))
+               info._pixel_depth = value;
+          else if(0 == strcmp(line, "NumberOfImages"))
+               info._image_num = value;
+     }
+     fclose(file_);
+     return info._width && info._height && info._pixel_depth;
+}
+/*
+  Write the header file of dat_file_ in the XImageHandler layout.
+ */
+inline bool XWriteRawInfo(const char* dat_file_, const XRawInfo& info)
+{
+     FILE* file_ = fopen(XRawHeaderName(dat_file_).c_str(), "w");
+     if(!file_)
+          return 0;
+     fprintf(file_, "ImageFileName=%s\n", XRawBaseName(dat_file_).c_str());
+     fprintf(file_, "Width=%u\n", info._width);
+     fprintf(file_, "Height=%u\n", info._height);
+     fprintf(file_, "PixelDepth=%u\n", info._pixel_depth);
+     fprintf(file_, "NumberOfImages=%u\n", info._image_num);
+     return 0 == fclose(file_);
+}
+/*
+  Copy the header file of src_dat_ to the one of dst_dat_ keeping every key
+  the detector wrote (SerialNumber=, Firmware=, GainRange=...), only
+  ImageFileName= is changed to name dst_dat_.
+ */
+inline bool XCopyRawInfo(const char* src_dat_, const char* dst_dat_)
+{
+     FILE* src_ = fopen(XRawHeaderName(src_dat_).c_str(), "r");
+     if(!src_)
+          return 0;
+     FILE* dst_ = fopen(XRawHeaderName(dst_dat_).c_str(), "w");
+     if(!dst_)
+     {
+          fclose(src_);
+          return 0;
+     }
+     bool ret = 1;
+     char line[256];
+     while(ret && fgets(line, sizeof(line), src_))
+     {
+          if(0 == strncmp(line, "ImageFileName=", 14))
+               ret = (fprintf(dst_, "ImageFileName=%s\n", XRawBaseName(dst_dat_).c_str()) > 0);
+          else
+               ret = (EOF != fputs(line, dst_));
+     }
+     ret &= !ferror(src_);
+     fclose(src_);
+     ret &= (0 == fclose(dst_));
+     return ret;
+}
+/*
+  64 bit file offsets on both compilers.
+ */
+inline bool XFileSeek(FILE* file_, uint64_t offset)
+{
+#ifdef _MSC_VER
+     return 0 == _fseeki64(file_, (__int64)offset, SEEK_SET);
+#else
+     return 0 == fseeko(file_, (off_t)offset, SEEK_SET);
+#endif
+}
+inline uint64_t XFileSize(FILE* file_)
+{
+#ifdef _MSC_VER
+     _fseeki64(file_, 0, SEEK_END);
+     return (uint64_t)_ftelli64(file_);
+#else
+     fseeko(file_, 0, SEEK_END);
+     return (uint64_t)ftello(file_);
+#endif
+}
+inline bool XFileTruncate(FILE* file_, uint64_t size)
+{
+     fflush(file_);
+#ifdef _MSC_VER
+     return 0 == _chsize_s(_fileno(file_), (__int64)size);
+#else
+     return 0 == ftruncate(fileno(file_), (off_t)size);
+#endif
+}
+#endif //XRAW_FILE_H
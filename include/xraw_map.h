@@ -0,0 +1,129 @@
+/*
+  Copyright (c), Detection Technology Inc.
+  All right reserved.
+
+ */
+
+#ifndef XRAW_MAP_H
+#define XRAW_MAP_H
+#include "xconfigure.h"
+#include "ximage.h"
+#include "xraw_file.h"
+#include "xfile_map.h"
+#include <vector>
+
+/*
+  XRawMap opens a raw .dat file like XImageHandler::ReadFile() but maps it
+  instead of reading it. The .txt header is parsed once and every frame is
+  an XImage pointing into the mapping, so opening a large sequence costs
+  neither time nor memory up front and pages are read as the frames are
+  touched. The mapping is advised sequential, WillNeed() prefetches frames
+  ahead of use.
+  GetImages() has the layout of XImageHandler::_images_ and feeds
+  XCorrection::DoCorrect(), XCorrectBatch or XAnalyze. As they correct in
+  place, open with XMAP_COPY unless the file may be changed.
+  The images do not own their data and are valid until Close().
+ */
+class XRawMap
+{
+public:
+     XRawMap()
+          :_frame_size(0)
+     {
+          memset(&_info, 0, sizeof(_info));
+     }
+     ~XRawMap()
+     {
+          Close();
+     }
+
+     bool Open(const char* dat_file_, uint32_t access = XMAP_READ)
+     {
+          Close();
+          if(!XReadRawInfo(dat_file_, _info))
+               return 0;
+          _frame_size = XRawFrameSize(_info);
+          if(!_map.Open(dat_file_, access) || _map.GetSize() < _frame_size)
+          {
+               Close();
+               return 0;
+          }
+          //A file cut short by an aborted grab keeps its whole frames
+          uint64_t frame_num = _map.GetSize() / _frame_size;
+          if(_info._image_num > frame_num)
+               _info._image_num = (uint32_t)frame_num;
+          _images.resize(_info._image_num);
+          for(uint32_t i = 0; i < _info._image_num; i++)
+          {
+               XImage* image_ = new XImage;
+               image_->_width = _info._width;
+               image_->_height = _info._height;
+               image_->_pixel_depth = _info._pixel_depth;
+               image_->_data_offset = 0;
+               image_->_size = _frame_size;
+               image_->_data_ = _map.GetData() + _frame_size * i;
+               image_->_device_ = NULL;
+               _images[i] = image_;
+          }
+          return 1;
+     }
+     void Close()
+     {
+          for(size_t i = 0; i < _images.size(); i++)
+          {
+               _images[i]->_data_ = NULL;
+               delete _images[i];
+          }
+          _images.clear();
+          _map.Close();
+          _frame_size = 0;
+          memset(&_info, 0, sizeof(_info));
+     }
+     bool IsOpen()
+     {
+          return _map.IsOpen();
+     }
+     uint32_t GetFrameNum()
+     {
+          return (uint32_t)_images.size();
+     }
+     const XRawInfo& GetInfo()
+     {
+          return _info;
+     }
+     XImage* GetImage(uint32_t index)
+     {
+          if(index >= _images.size())
+               return NULL;
+          return _images[index];
+     }
+     std::vector<XImage*>* GetImages()
+     {
+          return &_images;
+     }
+     /*
+       Start reading frame_num frames from index in the background.
+      */
+     void WillNeed(uint32_t index, uint32_t frame_num = 1)
+     {
+          _map.Advise(_frame_size * index, _frame_size * frame_num, XMAP_WILLNEED);
+     }
+     /*
+       Drop the pages of frames already processed. With XMAP_COPY their
+       changes are lost.
+      */
+     void DontNeed(uint32_t index, uint32_t frame_num = 1)
+     {
+          _map.Advise(_frame_size * index, _frame_size * frame_num, XMAP_DONTNEED);
+     }
+
+private:
+     XRawMap(const XRawMap&);
+     XRawMap& operator = (const XRawMap&);
+
+     size_t   _frame_size;
+     XFileMap _map;
+     XRawInfo _info;
+     std::vector<XImage*> _images;
+};
+#endif //XRAW_MAP_H
@@ -0,0 +1,493 @@
+/*
+  Copyright (c), Detection Technology Inc.
+  All right reserved.
+
+ */
+
+#ifndef XRAW_SINK_H
+#define XRAW_SINK_H
+#ifdef __linux__
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include <string>
+#include "xconfigure.h"
+#include "ximage.h"
+#include "xraw_file.h"
+
+//Backend of XRawSink::OpenFile(), a backend which is not available falls
+//back to the next lower one
+#define XSINK_BUFFERED    0   //write() through the page cache
+#define XSINK_DIRECT      1   //O_DIRECT, one blocking pwrite() per chunk
+#define XSINK_URING       2   //O_DIRECT, chunks written through io_uring
+
+#define XSINK_ALIGN       4096              //O_DIRECT buffer and size alignment
+#define XSINK_CHUNK_SIZE  (4 * 1024 * 1024) //Bytes per write
+#define XSINK_QUEUE_DEPTH 8                 //Chunks in flight
+
+/*
+  Minimal io_uring on the raw syscalls, only what XRawSink needs: queue a
+  write, wait for completions.
+ */
+class XUring
+{
+public:
+     XUring()
+          :_fd(-1)
+          ,_sq_ptr_(MAP_FAILED)
+          ,_cq_ptr_(MAP_FAILED)
+          ,_sqes_(MAP_FAILED)
+          ,_sq_len(0)
+          ,_cq_len(0)
+          ,_sqes_len(0)
+     {}
+     ~XUring()
+     {
+          Close();
+     }
+
+     bool Open(uint32_t entries)
+     {
+          Close();
+          struct io_uring_params params;
+          memset(&params, 0, sizeof(params));
+          _fd = (int32_t)syscall(__NR_io_uring_setup, entries, &params);
+          if(_fd < 0)
+               return 0;
+          _sq_len = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+          _cq_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+          bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+          if(single && _cq_len > _sq_len)
+               _sq_len = _cq_len;
+          _sq_ptr_ = mmap(NULL, _sq_len, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQ_RING);
+          if(MAP_FAILED == _sq_ptr_)
+          {
+               Close();
+               return 0;
+          }
+          if(single)
+               _cq_ptr_ = _sq_ptr_;
+          else
+               _cq_ptr_ = mmap(NULL, _cq_len, PROT_READ | PROT_WRITE,
+                               MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_CQ_RING);
+          _sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+          _sqes_ = mmap(NULL, _sqes_len, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQES);
+          if(MAP_FAILED == _cq_ptr_ || MAP_FAILED == _sqes_)
+          {
+               Close();
+               return 0;
+          }
+          uint8_t* sq_ = (uint8_t*)_sq_ptr_;
+          uint8_t* cq_ = (uint8_t*)_cq_ptr_;
+          _sq_tail_ = (uint32_t*)(sq_ + params.sq_off.tail);
+          _sq_mask = *(uint32_t*)(sq_ + params.sq_off.ring_mask);
+          _sq_array_ = (uint32_t*)(sq_ + params.sq_off.array);
+          _cq_head_ = (uint32_t*)(cq_ + params.cq_off.head);
+          _cq_tail_ = (uint32_t*)(cq_ + params.cq_off.tail);
+          _cq_mask = *(uint32_t*)(cq_ + params.cq_off.ring_mask);
+          _cqes_ = (struct io_uring_cqe*)(cq_ + params.cq_off.cqes);
+          return 1;
+     }
+     void Close()
+     {
+          if(MAP_FAILED != _sqes_)
+               munmap(_sqes_, _sqes_len);
+          if(MAP_FAILED != _cq_ptr_ && _cq_ptr_ != _sq_ptr_)
+               munmap(_cq_ptr_, _cq_len);
+          if(MAP_FAILED != _sq_ptr_)
+               munmap(_sq_ptr_, _sq_len);
+          if(_fd >= 0)
+               close(_fd);
+          _fd = -1;
+          _sq_ptr_ = MAP_FAILED;
+          _cq_ptr_ = MAP_FAILED;
+          _sqes_ = MAP_FAILED;
+     }
+     bool IsOpen()
+     {
+          return _fd >= 0;
+     }
+     /*
+       Queue and submit one write of len bytes at offset.
+      */
+     bool Write(int32_t fd, const void* data_, uint32_t len, uint64_t offset,
+                uint64_t user_data)
+     {
+          uint32_t tail = *_sq_tail_;
+          uint32_t index = tail & _sq_mask;
+          struct io_uring_sqe* sqe_ = &((struct io_uring_sqe*)_sqes_)[index];
+          memset(sqe_, 0, sizeof(*sqe_));
+          sqe_->opcode = IORING_OP_WRITE;
+          sqe_->fd = fd;
+          sqe_->addr = (uint64_t)(uintptr_t)data_;
+          sqe_->len = len;
+          sqe_->off = offset;
+          sqe_->user_data = user_data;
+          _sq_array_[index] = index;
+          __atomic_store_n(_sq_tail_, tail + 1, __ATOMIC_RELEASE);
+          return syscall(__NR_io_uring_enter, _fd, 1, 0, 0, NULL, 0) == 1;
+     }
+     /*
+       Wait for one completion, return its result (bytes or -errno).
+      */
+     int32_t WaitOne(uint64_t& user_data)
+     {
+          while(1)
+          {
+               uint32_t head = *_cq_head_;
+               if(head != __atomic_load_n(_cq_tail_, __ATOMIC_ACQUIRE))
+               {
+                    struct io_uring_cqe* cqe_ = &_cqes_[head & _cq_mask];
+                    user_data = cqe_->user_data;
+                    int32_t res = cqe_->res;
+                    __atomic_store_n(_cq_head_, head + 1, __ATOMIC_RELEASE);
+                    return res;
+               }
+               if(syscall(__NR_io_uring_enter, _fd, 0, 1, IORING_ENTER_GETEVENTS,
+                          NULL, 0) < 0 && EINTR != errno)
+                    return -errno;
+          }
+     }
+
+private:
+     XUring(const XUring&);
+     XUring& operator = (const XUring&);
+
+     int32_t  _fd;
+     void*    _sq_ptr_;
+     void*    _cq_ptr_;
+     void*    _sqes_;
+     size_t   _sq_len;
+     size_t   _cq_len;
+     size_t   _sqes_len;
+     uint32_t* _sq_tail_;
+     uint32_t  _sq_mask;
+     uint32_t* _sq_array_;
+     uint32_t* _cq_head_;
+     uint32_t* _cq_tail_;
+     uint32_t  _cq_mask;
+     struct io_uring_cqe* _cqes_;
+};
+
+/*
+  XRawSink writes a .dat sequence in the XImageHandler raw layout (pixel
+  rows without line info, frames back to back) without filling the page
+  cache. Frames are copied into XSINK_CHUNK_SIZE buffers aligned for
+  O_DIRECT, and with XSINK_URING up to XSINK_QUEUE_DEPTH chunks are in
+  flight while the next one fills, so Write() returns after the copy.
+  The file is preallocated for the expected frame count and cut to the
+  written size on CloseFile(), which also writes the .txt header.
+  Call from one thread, e.g. IXImgSink::OnFrameReady().
+ */
+class XRawSink
+{
+public:
+     XRawSink()
+          :_fd(-1)
+          ,_backend(XSINK_BUFFERED)
+          ,_queue_depth(0)
+          ,_buf_(NULL)
+          ,_cur(0)
+          ,_fill(0)
+          ,_in_flight(0)
+          ,_offset(0)
+          ,_bytes(0)
+          ,_last_err(0)
+     {
+          memset(&_info, 0, sizeof(_info));
+          memset(_busy, 0, sizeof(_busy));
+          memset(_len, 0, sizeof(_len));
+          memset(_done, 0, sizeof(_done));
+          memset(_chunk_offset, 0, sizeof(_chunk_offset));
+     }
+     ~XRawSink()
+     {
+          CloseFile();
+     }
+
+     /*
+       frame_size * frame_num bytes are preallocated when both are given.
+       Return 0 if the file can't be opened at all or the preallocation
+       does not fit, a file system without fallocate() is not an error.
+      */
+     bool OpenFile(const char* file_, uint32_t backend = XSINK_URING,
+                   uint64_t frame_size = 0, uint32_t frame_num = 0,
+                   uint32_t queue_depth = XSINK_QUEUE_DEPTH)
+     {
+          CloseFile();
+          if(0 == queue_depth || queue_depth > XSINK_QUEUE_DEPTH)
+               queue_depth = XSINK_QUEUE_DEPTH;
+          _fd = -1;
+          if(backend >= XSINK_DIRECT)
+          {
+               _fd = open(file_, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+               //e.g. tmpfs has no O_DIRECT
+               if(_fd < 0)
+                    backend = XSINK_BUFFERED;
+          }
+          if(_fd < 0)
+               _fd = open(file_, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+          if(_fd < 0)
+          {
+               _last_err = errno;
+               return 0;
+          }
+          if(XSINK_URING == backend && !_uring.Open(queue_depth))
+               backend = XSINK_DIRECT;
+          if(XSINK_URING != backend)
+               queue_depth = 1;
+          _buf_ = (uint8_t*)_aligned_malloc((size_t)XSINK_CHUNK_SIZE * queue_depth,
+                                            XSINK_ALIGN);
+          if(!_buf_)
+          {
+               _last_err = ENOMEM;
+               CloseFile();
+               return 0;
+          }
+          if(frame_size && frame_num
+             && fallocate(_fd, 0, 0, (off_t)(frame_size * frame_num)) != 0
+             && EOPNOTSUPP != errno && ENOSYS != errno)
+          {
+               _last_err = errno;
+               close(_fd);
+               _fd = -1;
+               _uring.Close();
+               _aligned_free(_buf_);
+               _buf_ = NULL;
+               return 0;
+          }
+          _file = file_;
+          _backend = backend;
+          _queue_depth = queue_depth;
+          _cur = 0;
+          _fill = 0;
+          _in_flight = 0;
+          _offset = 0;
+          _bytes = 0;
+          _last_err = 0;
+          memset(&_info, 0, sizeof(_info));
+          memset(_busy, 0, sizeof(_busy));
+          return 1;
+     }
+     bool IsOpen()
+     {
+          return _fd >= 0;
+     }
+     /*
+       Backend in use after fallbacks.
+      */
+     uint32_t GetBackend()
+     {
+          return _backend;
+     }
+     /*
+       Append the pixel rows of image_. All frames of a file have the same
+       geometry.
+      */
+     bool Write(XImage* image_)
+     {
+          if(_fd < 0 || !image_ || !image_->_data_)
+               return 0;
+          if(0 == _info._image_num)
+          {
+               _info._width = image_->_width;
+               _info._height = image_->_height;
+               _info._pixel_depth = image_->_pixel_depth;
+          }
+          else if(image_->_width != _info._width || image_->_height != _info._height
+                  || image_->_pixel_depth != _info._pixel_depth)
+               return 0;
+          uint32_t line_bytes = image_->_width * XRawPixelByte(_info);
+          for(uint32_t row = 0; row < image_->_height; row++)
+          {
+               const uint8_t* line_ = image_->GetLineAddr(row) + image_->_data_offset;
+               if(!Append(line_, line_bytes))
+                    return 0;
+          }
+          _info._image_num++;
+          return 1;
+     }
+     /*
+       Write what is left, wait for all writes, cut the file to its size and
+       write the .txt header.
+      */
+     bool CloseFile()
+     {
+          if(_fd < 0)
+               return 1;
+          bool ret = (0 == _last_err);
+          if(ret && _fill)
+          {
+               //O_DIRECT needs whole blocks, the padding is cut off below
+               uint32_t len = _fill;
+               if(XSINK_BUFFERED != _backend)
+               {
+                    len = (_fill + XSINK_ALIGN - 1) & ~(XSINK_ALIGN - 1);
+                    memset(GetChunk(_cur) + _fill, 0, len - _fill);
+               }
+               ret = Submit(len, _fill);
+          }
+          while(_in_flight)
+               ret &= Reap();
+          if(ftruncate(_fd, (off_t)_bytes) != 0)
+               ret = 0;
+          close(_fd);
+          _fd = -1;
+          _uring.Close();
+          if(_buf_)
+               _aligned_free(_buf_);
+          _buf_ = NULL;
+          if(_info._image_num)
+               ret &= XWriteRawInfo(_file.c_str(), _info);
+          return ret;
+     }
+     uint64_t GetBytesWritten()
+     {
+          return _bytes;
+     }
+     uint32_t GetFrameNum()
+     {
+          return _info._image_num;
+     }
+     /*
+       errno of the first failed write, 0 if none.
+      */
+     int32_t GetLastError()
+     {
+          return _last_err;
+     }
+
+private:
+     XRawSink(const XRawSink&);
+     XRawSink& operator = (const XRawSink&);
+
+     uint8_t* GetChunk(uint32_t index)
+     {
+          return _buf_ + (size_t)XSINK_CHUNK_SIZE * index;
+     }
+     bool Append(const uint8_t* data_, uint32_t len)
+     {
+          while(len)
+          {
+               uint32_t copy = XSINK_CHUNK_SIZE - _fill;
+               if(copy > len)
+                    copy = len;
+               memcpy(GetChunk(_cur) + _fill, data_, copy);
+               _fill += copy;
+               data_ += copy;
+               len -= copy;
+               if(XSINK_CHUNK_SIZE == _fill && !Submit(_fill, _fill))
+                    return 0;
+          }
+          return 1;
+     }
+     /*
+       Write the current chunk, len bytes of which size are data, and move
+       to the next free chunk.
+      */
+     bool Submit(uint32_t len, uint32_t size)
+     {
+          if(_last_err)
+               return 0;
+          uint8_t* chunk_ = GetChunk(_cur);
+          if(XSINK_URING == _backend)
+          {
+               if(!_uring.Write(_fd, chunk_, len, _offset, _cur))
+               {
+                    _last_err = errno ? errno : EIO;
+                    return 0;
+               }
+               _busy[_cur] = 1;
+               _len[_cur] = len;
+               _done[_cur] = 0;
+               _chunk_offset[_cur] = _offset;
+               _in_flight++;
+          }
+          else
+          {
+               uint32_t done = 0;
+               while(done < len)
+               {
+                    ssize_t ret = pwrite(_fd, chunk_ + done, len - done,
+                                         (off_t)(_offset + done));
+                    if(ret < 0 && EINTR == errno)
+                         continue;
+                    if(ret <= 0)
+                    {
+                         _last_err = (ret < 0) ? errno : EIO;
+                         return 0;
+                    }
+                    done += (uint32_t)ret;
+               }
+          }
+          _offset += size;
+          _bytes += size;
+          _cur = (_cur + 1) % _queue_depth;
+          _fill = 0;
+          while(_busy[_cur])
+               if(!Reap())
+                    return 0;
+          return 1;
+     }
+     /*
+       Wait for one completion. A short write is submitted again for the
+       rest of its chunk, the chunk stays busy until all of it is written.
+      */
+     bool Reap()
+     {
+          uint64_t index = 0;
+          int32_t res = _uring.WaitOne(index);
+          if(index >= XSINK_QUEUE_DEPTH)
+          {
+               _in_flight--;
+               if(!_last_err)
+                    _last_err = EIO;
+               return 0;
+          }
+          if(res > 0)
+          {
+               _done[index] += (uint32_t)res;
+               if(_done[index] >= _len[index])
+               {
+                    _busy[index] = 0;
+                    _in_flight--;
+                    return 1;
+               }
+               if(!_last_err && _uring.Write(_fd, GetChunk((uint32_t)index) + _done[index],
+                                             _len[index] - _done[index],
+                                             _chunk_offset[index] + _done[index], index))
+                    return 1;
+          }
+          _busy[index] = 0;
+          _in_flight--;
+          if(!_last_err)
+               _last_err = (res < 0) ? -res : (res > 0 && errno) ? errno : EIO;
+          return 0;
+     }
+
+     int32_t  _fd;
+     uint32_t _backend;
+     uint32_t _queue_depth;
+     uint8_t* _buf_;
+     uint32_t _cur;           //Chunk being filled
+     uint32_t _fill;          //Bytes in the current chunk
+     uint32_t _in_flight;
+     uint64_t _offset;        //File offset of the current chunk
+     uint64_t _bytes;
+     int32_t  _last_err;
+     bool     _busy[XSINK_QUEUE_DEPTH];
+     uint32_t _len[XSINK_QUEUE_DEPTH];      //Bytes submitted per chunk
+     uint32_t _done[XSINK_QUEUE_DEPTH];     //Bytes of them written so far
+     uint64_t _chunk_offset[XSINK_QUEUE_DEPTH];
+     XUring   _uring;
+     XRawInfo _info;
+     std::string _file;
+};
+#endif //__linux__
+#endif //XRAW_SINK_H
@@ -0,0 +1,257 @@
+/*
+  Copyright (c), Detection Technology Inc.
+  All right reserved.
+
+ */
+
+#ifndef XTIF_MAP_H
+#define XTIF_MAP_H
+#include "xconfigure.h"
+#include "ximage.h"
+#include "xfile_map.h"
+#include "xtif_stream.h"
+#include <string.h>
+#include <vector>
+
+#define XTIF_MAX_PAGE     0x100000     //Bound of the IFD chain walk
+
+/*
+  XTifMap loads the TIFF files written by XTifFormat::Save() or XTifStream
+  without reading them: the file is mapped, each IFD is checked once and
+  every page is an XImage pointing straight at its strip data. Browsing
+  a directory of projections then costs page cache reads only.
+  Only little endian, uncompressed, one sample pages stored in 16 or 32
+  bit pixels, whose strips are back to back, are taken, classic TIFF or BigTIFF. Open()
+  returns 0 for anything else, so the caller can fall back to
+  XTifFormat::Load().
+  The images do not own their data and are valid until Close().
+ */
+class XTifMap
+{
+public:
+     XTifMap()
+     {}
+     ~XTifMap()
+     {
+          Close();
+     }
+
+     bool Open(const char* file_, uint32_t access = XMAP_READ)
+     {
+          Close();
+          if(!_map.Open(file_, access) || !Parse())
+          {
+               Close();
+               return 0;
+          }
+          return 1;
+     }
+     void Close()
+     {
+          for(size_t i = 0; i < _images.size(); i++)
+          {
+               _images[i]->_data_ = NULL;
+               delete _images[i];
+          }
+          _images.clear();
+          _int_times.clear();
+          _map.Close();
+     }
+     bool IsOpen()
+     {
+          return _map.IsOpen();
+     }
+     uint32_t GetPageNum()
+     {
+          return (uint32_t)_images.size();
+     }
+     XImage* GetImage(uint32_t page = 0)
+     {
+          if(page >= _images.size())
+               return NULL;
+          return _images[page];
+     }
+     std::vector<XImage*>* GetImages()
+     {
+          return &_images;
+     }
+     /*
+       XTIF_TAG_GCU_INT_TIME of a page, 0 if it has none.
+      */
+     uint32_t GetIntTime(uint32_t page = 0)
+     {
+          if(page >= _int_times.size())
+               return 0;
+          return _int_times[page];
+     }
+     void WillNeed(uint32_t page)
+     {
+          if(page < _images.size())
+               _map.Advise(_images[page]->_data_ - _map.GetData(),
+                           _images[page]->_size, XMAP_WILLNEED);
+     }
+
+private:
+     XTifMap(const XTifMap&);
+     XTifMap& operator = (const XTifMap&);
+
+     struct XTifPageInfo
+     {
+          uint64_t _width;
+          uint64_t _height;
+          uint64_t _bits;
+          uint64_t _compress;
+          uint64_t _samples;
+          uint64_t _int_time;
+          uint64_t _strip_num;
+          uint64_t _offsets_pos;   //Where the strip offsets are
+          uint64_t _counts_pos;
+          uint32_t _offset_size;   //Bytes per strip offset / count
+          uint32_t _count_size;
+     };
+
+     uint64_t GetLE(uint64_t pos, uint32_t bytes)
+     {
+          const uint8_t* data_ = _map.GetData() + pos;
+          uint64_t value = 0;
+          for(uint32_t i = 0; i < bytes; i++)
+               value |= (uint64_t)data_[i] << (8 * i);
+          return value;
+     }
+     /*
+       Bytes of one value of a TIFF field type, 0 if unknown.
+      */
+     static uint32_t GetTypeSize(uint16_t type)
+     {
+          static const uint8_t size[19] = {0, 1, 1, 2, 4, 8, 1, 1, 2, 4, 8, 4, 8,
+                                           4, 0, 0, 8, 8, 8};
+          return (type < 19) ? size[type] : 0;
+     }
+     bool Parse()
+     {
+          uint64_t size = _map.GetSize();
+          if(size < 8 || GetLE(0, 2) != XTIF_BYTE_ORDER_LITTLE)
+               return 0;
+          uint64_t version = GetLE(2, 2);
+          bool is_big = (XTIF_BIG_FLAG == version);
+          if(!is_big && XTIF_FLAG != version)
+               return 0;
+          if(is_big && (size < 16 || GetLE(4, 2) != 8))
+               return 0;
+          uint32_t count_size = is_big ? 8 : 2;
+          uint32_t entry_size = is_big ? 20 : 12;
+          uint32_t inline_size = is_big ? 8 : 4;
+          uint64_t ifd_pos = is_big ? GetLE(8, 8) : GetLE(4, 4);
+          while(ifd_pos && _images.size() < XTIF_MAX_PAGE)
+          {
+               //BigTIFF offsets are 64 bit, compare against what is left
+               //of the file so that no sum wraps
+               if(ifd_pos > size || count_size > size - ifd_pos)
+                    return 0;
+               uint64_t entry_num = GetLE(ifd_pos, count_size);
+               uint64_t entry_pos = ifd_pos + count_size;
+               if(entry_num > XTIF_TAG_ENTRY_MAX
+                  || entry_num * entry_size + inline_size > size - entry_pos)
+                    return 0;
+               XTifPageInfo info;
+               memset(&info, 0, sizeof(info));
+               info._compress = 1;
+               info._samples = 1;
+               for(uint64_t i = 0; i < entry_num; i++, entry_pos += entry_size)
+               {
+                    uint16_t id = (uint16_t)GetLE(entry_pos, 2);
+                    uint16_t type = (uint16_t)GetLE(entry_pos + 2, 2);
+                    uint64_t count = GetLE(entry_pos + 4, is_big ? 8 : 4);
+                    uint64_t value_pos = entry_pos + (is_big ? 12 : 8);
+                    uint32_t type_size = GetTypeSize(type);
+                    //Readers skip fields of unknown type
+                    if(0 == type_size)
+                         continue;
+                    if(count > size)
+                         return 0;
+                    //Values that do not fit the entry are at an offset
+                    if(count * type_size > inline_size)
+                    {
+                         value_pos = GetLE(value_pos, inline_size);
+                         if(value_pos > size || count * type_size > size - value_pos)
+                              return 0;
+                    }
+                    uint64_t value = count ? GetLE(value_pos, type_size) : 0;
+                    switch(id)
+                    {
+                    case XTIF_TAG_WIDTH:          info._width = value; break;
+                    case XTIF_TAG_HEIGHT:         info._height = value; break;
+                    case XTIF_TAG_PIXDEPTH:       info._bits = value; break;
+                    case XTIF_TAG_COMPRESS:       info._compress = value; break;
+                    case XTIF_TAG_SAMPLES_PIXEL:  info._samples = value; break;
+                    case XTIF_TAG_GCU_INT_TIME:   info._int_time = value; break;
+                    case XTIF_TAG_STRIP_OFFSET:
+                         info._strip_num = count;
+                         info._offsets_pos = value_pos;
+                         info._offset_size = type_size;
+                         break;
+                    case XTIF_TAG_STRIP_COUNT:
+                         if(count != info._strip_num)
+                              return 0;
+                         info._counts_pos = value_pos;
+                         info._count_size = type_size;
+                         break;
+                    }
+               }
+               if(!AddPage(info))
+                    return 0;
+               ifd_pos = GetLE(entry_pos, inline_size);
+          }
+          return !_images.empty();
+     }
+     /*
+       Check one page and add its image.
+      */
+     bool AddPage(const XTifPageInfo& info)
+     {
+          if(0 == info._width || 0 == info._height || info._width > 0xFFFFFFFF
+             || info._height > 0xFFFFFFFF || info._bits <= 8 || info._bits > 32
+             || 1 != info._compress || 1 != info._samples || 0 == info._strip_num
+             || info._offset_size < 2 || info._count_size < 2)
+               return 0;
+          //Depths up to 16 bit are kept in 16 bit pixels, like XImage
+          uint64_t size = _map.GetSize();
+          uint32_t pixel_byte = (info._bits > 16) ? 4 : 2;
+          //A frame larger than the file is rejected before the product can wrap
+          if(info._width > size / pixel_byte / info._height)
+               return 0;
+          uint64_t frame_size = info._width * info._height * pixel_byte;
+          uint64_t first = GetLE(info._offsets_pos, info._offset_size);
+          if(first > size)
+               return 0;
+          uint64_t next = first;
+          for(uint64_t i = 0; i < info._strip_num; i++)
+          {
+               //Strips must be back to back to form one frame
+               if(GetLE(info._offsets_pos + i * info._offset_size, info._offset_size) != next)
+                    return 0;
+               uint64_t count = GetLE(info._counts_pos + i * info._count_size, info._count_size);
+               if(count > size - next)
+                    return 0;
+               next += count;
+          }
+          if(next - first != frame_size)
+               return 0;
+          XImage* image_ = new XImage;
+          image_->_width = (uint32_t)info._width;
+          image_->_height = (uint32_t)info._height;
+          image_->_pixel_depth = (uint32_t)info._bits;
+          image_->_data_offset = 0;
+          image_->_size = (size_t)frame_size;
+          image_->_data_ = _map.GetData() + first;
+          image_->_device_ = NULL;
+          _images.push_back(image_);
+          _int_times.push_back((uint32_t)info._int_time);
+          return 1;
+     }
+
+     XFileMap _map;
+     std::vector<XImage*> _images;
+     std::vector<uint32_t> _int_times;
+};
+#endif //XTIF_MAP_H
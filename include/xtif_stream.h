@@ -0,0 +1,419 @@
+/*
+  Copyright (c), Detection Technology Inc.
+  All right reserved.
+
+ */
+
+#ifndef XTIF_STREAM_H
+#define XTIF_STREAM_H
+#include "xconfigure.h"
+#include "ximage.h"
+#include "xraw_file.h"
+#include "xtif_format.h"
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <vector>
+
+#define XTIF_BIG_FLAG          0x2B          //BigTIFF version
+#define XTIF_CLASSIC_LIMIT     0xFFFFFFFFull //Largest classic TIFF offset
+#define XTIF_STRIP_BYTES       (256 * 1024)  //Target strip size
+#define XTIF_HEADER_SIZE       16            //Room for the BigTIFF header
+
+#define XTIF_TAG_SUBFILE_TYPE  254
+#define XTIF_TAG_TYPE_LONG8    16
+#define XTIF_SUBFILE_PAGE      2
+
+/*
+  XTifStream writes a multi page TIFF during acquisition, one page per
+  frame. The lines of a frame go to disk as they arrive, in strips of
+  about XTIF_STRIP_BYTES, and the frame's IFD is appended after its data
+  and linked from the previous one. Every finished page can be read even
+  if the grab is cut short.
+  The file starts as classic TIFF. When the next frame would end past
+  big_limit (4 GB), the IFDs written so far are written again in BigTIFF
+  form at the end of the file and the header is switched. The pixel data
+  stays where it is, only the IFDs are copied.
+  Pages are uncompressed, 16 bit or 32 bit unsigned, little endian. The
+  layout does not depend on the struct packing of xtif_format.h because
+  IFDs are built byte by byte.
+ */
+class XTifStream
+{
+public:
+     XTifStream()
+          :_file_(NULL)
+          ,_big_limit(XTIF_CLASSIC_LIMIT)
+          ,_is_big(0)
+          ,_end(0)
+          ,_next_pos(0)
+          ,_page_num(0)
+          ,_rows_written(0)
+          ,_int_time(0)
+     {
+          memset(&_page, 0, sizeof(_page));
+     }
+     ~XTifStream()
+     {
+          Close();
+     }
+
+     /*
+       big_limit 0 writes BigTIFF from the start.
+      */
+     bool Open(const char* file_, uint64_t big_limit = XTIF_CLASSIC_LIMIT)
+     {
+          Close();
+          _file_ = fopen(file_, "wb+");
+          if(!_file_)
+               return 0;
+          _big_limit = big_limit;
+          _is_big = 0;
+          _page_num = 0;
+          _pages.clear();
+          //The classic header is followed by 8 spare bytes, the BigTIFF
+          //header needs 16
+          uint8_t header[XTIF_HEADER_SIZE];
+          memset(header, 0, sizeof(header));
+          PutLE(header, XTIF_BYTE_ORDER_LITTLE, 2);
+          PutLE(header + 2, XTIF_FLAG, 2);
+          if(fwrite(header, sizeof(header), 1, _file_) != 1)
+          {
+               Close();
+               return 0;
+          }
+          _end = XTIF_HEADER_SIZE;
+          _next_pos = 4;
+          if(0 == big_limit && !SwitchToBig())
+          {
+               Close();
+               return 0;
+          }
+          return 1;
+     }
+     /*
+       Finish the open page, if any, and close the file.
+      */
+     bool Close()
+     {
+          if(!_file_)
+               return 1;
+          bool ret = 1;
+          if(_page._height)
+               ret = EndFrame();
+          if(0 != fclose(_file_))
+               ret = 0;
+          _file_ = NULL;
+          _pages.clear();
+          return ret;
+     }
+     void SetSerial(const char* sn_)
+     {
+          _serial = sn_ ? sn_ : "";
+     }
+     /*
+       Integration time of the next pages, in the XTIF_TAG_GCU_INT_TIME tag.
+      */
+     void SetIntTime(uint32_t int_time)
+     {
+          _int_time = int_time;
+     }
+     /*
+       Start a page. Lines then follow with WriteLines() and EndFrame()
+       writes the IFD.
+      */
+     bool BeginFrame(uint32_t width, uint32_t height, uint32_t pixel_depth)
+     {
+          if(!_file_ || _page._height || 0 == width || 0 == height)
+               return 0;
+          uint32_t pixel_byte = (pixel_depth > 16) ? 4 : 2;
+          uint64_t frame_bytes = (uint64_t)width * height * pixel_byte;
+          uint32_t line_bytes = width * pixel_byte;
+          XTifPage page;
+          page._data_pos = _end;
+          page._width = width;
+          page._height = height;
+          page._pixel_byte = pixel_byte;
+          page._rows_strip = XTIF_STRIP_BYTES / line_bytes;
+          if(0 == page._rows_strip)
+               page._rows_strip = 1;
+          if(page._rows_strip > height)
+               page._rows_strip = height;
+          page._int_time = _int_time;
+          time_t now = time(NULL);
+          strftime(page._date_time, sizeof(page._date_time), "%Y:%m:%d %H:%M:%S",
+                   localtime(&now));
+          //Page data, the word alignment byte and the classic IFD with its
+          //strip tables and strings must stay within classic offsets
+          if(!_is_big)
+          {
+               std::vector<uint8_t> ifd;
+               BuildIfd(page, 0, ifd);
+               if(_end + frame_bytes + 1 + ifd.size() > _big_limit && !SwitchToBig())
+                    return 0;
+               page._data_pos = _end;
+          }
+          _page = page;
+          _rows_written = 0;
+          return XFileSeek(_file_, _end);
+     }
+     /*
+       Append rows lines, pitch bytes apart in data_ (0 = packed).
+      */
+     bool WriteLines(const uint8_t* data_, uint32_t rows, uint32_t pitch = 0)
+     {
+          if(!_file_ || !_page._height || !data_ || _rows_written + rows > _page._height)
+               return 0;
+          uint32_t line_bytes = _page._width * _page._pixel_byte;
+          if(0 == pitch || line_bytes == pitch)
+          {
+               if(fwrite(data_, line_bytes, rows, _file_) != rows)
+                    return 0;
+          }
+          else
+          {
+               for(uint32_t row = 0; row < rows; row++)
+                    if(fwrite(data_ + (size_t)row * pitch, line_bytes, 1, _file_) != 1)
+                         return 0;
+          }
+          _rows_written += rows;
+          _end += (uint64_t)line_bytes * rows;
+          return 1;
+     }
+     /*
+       Write the IFD of the page and link it. Missing lines are zero.
+      */
+     bool EndFrame()
+     {
+          if(!_file_ || !_page._height)
+               return 0;
+          bool ret = (_rows_written == _page._height);
+          if(!ret)
+          {
+               std::vector<uint8_t> zero(_page._width * _page._pixel_byte, 0);
+               while(_rows_written < _page._height)
+                    if(!WriteLines(&zero[0], 1))
+                         break;
+          }
+          if(_rows_written == _page._height && WriteIfd(_page))
+          {
+               if(!_is_big)
+                    _pages.push_back(_page);
+               _page_num++;
+          }
+          else
+               ret = 0;
+          _page._height = 0;
+          return ret;
+     }
+     /*
+       One frame in one call, the line info of image_ is skipped.
+      */
+     bool Write(XImage* image_)
+     {
+          if(!image_ || !image_->_data_ || !BeginFrame(image_->_width, image_->_height,
+                                                       image_->_pixel_depth))
+               return 0;
+          uint32_t pixel_byte = (image_->_pixel_depth > 16) ? 4 : 2;
+          uint32_t pitch = image_->_width * pixel_byte + image_->_data_offset;
+          if(!WriteLines(image_->_data_ + image_->_data_offset, image_->_height, pitch))
+          {
+               EndFrame();
+               return 0;
+          }
+          return EndFrame();
+     }
+     uint32_t GetPageNum()
+     {
+          return _page_num;
+     }
+     bool IsBigTiff()
+     {
+          return _is_big;
+     }
+     uint64_t GetFileSize()
+     {
+          return _end;
+     }
+
+private:
+     XTifStream(const XTifStream&);
+     XTifStream& operator = (const XTifStream&);
+
+     struct XTifPage
+     {
+          uint64_t _data_pos;
+          uint32_t _width;
+          uint32_t _height;
+          uint32_t _pixel_byte;
+          uint32_t _rows_strip;
+          uint32_t _int_time;
+          char     _date_time[20];
+     };
+     struct XTifEntry
+     {
+          uint16_t _id;
+          uint16_t _type;
+          uint64_t _count;
+          std::vector<uint8_t> _data;
+     };
+
+     static void PutLE(uint8_t* data_, uint64_t value, uint32_t bytes)
+     {
+          for(uint32_t i = 0; i < bytes; i++)
+               data_[i] = (uint8_t)(value >> (8 * i));
+     }
+     static void AddEntry(std::vector<XTifEntry>& entries, uint16_t id, uint16_t type,
+                          const std::vector<uint64_t>& values)
+     {
+          uint32_t size = (XTIF_TAG_TYPE_SHORT == type) ? 2
+               : ((XTIF_TAG_TYPE_LONG8 == type) ? 8 : 4);
+          XTifEntry entry;
+          entry._id = id;
+          entry._type = type;
+          entry._count = values.size();
+          entry._data.resize(values.size() * size);
+          for(size_t i = 0; i < values.size(); i++)
+               PutLE(&entry._data[i * size], values[i], size);
+          entries.push_back(entry);
+     }
+     static void AddEntry(std::vector<XTifEntry>& entries, uint16_t id, uint16_t type,
+                          uint64_t value)
+     {
+          AddEntry(entries, id, type, std::vector<uint64_t>(1, value));
+     }
+     static void AddAscii(std::vector<XTifEntry>& entries, uint16_t id, const char* text_)
+     {
+          XTifEntry entry;
+          entry._id = id;
+          entry._type = XTIF_TAG_TYPE_ASC;
+          entry._data.assign(text_, text_ + strlen(text_) + 1);
+          entry._count = entry._data.size();
+          entries.push_back(entry);
+     }
+     /*
+       Build the IFD of page, to be written at ifd_pos, into ifd. Values that
+       do not fit in their entry follow it. Return where the offset of the
+       next IFD goes, relative to ifd_pos.
+      */
+     uint64_t BuildIfd(const XTifPage& page, uint64_t ifd_pos, std::vector<uint8_t>& ifd)
+     {
+          uint32_t line_bytes = page._width * page._pixel_byte;
+          uint32_t strip_num = (page._height + page._rows_strip - 1) / page._rows_strip;
+          std::vector<uint64_t> offsets(strip_num);
+          std::vector<uint64_t> counts(strip_num);
+          for(uint32_t i = 0; i < strip_num; i++)
+          {
+               uint32_t rows = page._height - i * page._rows_strip;
+               if(rows > page._rows_strip)
+                    rows = page._rows_strip;
+               offsets[i] = page._data_pos + (uint64_t)i * page._rows_strip * line_bytes;
+               counts[i] = (uint64_t)rows * line_bytes;
+          }
+          uint16_t long_type = _is_big ? XTIF_TAG_TYPE_LONG8 : XTIF_TAG_TYPE_LONG;
+          //Entries are sorted by tag
+          std::vector<XTifEntry> entries;
+          AddEntry(entries, XTIF_TAG_SUBFILE_TYPE, XTIF_TAG_TYPE_LONG, XTIF_SUBFILE_PAGE);
+          AddEntry(entries, XTIF_TAG_WIDTH, XTIF_TAG_TYPE_LONG, page._width);
+          AddEntry(entries, XTIF_TAG_HEIGHT, XTIF_TAG_TYPE_LONG, page._height);
+          AddEntry(entries, XTIF_TAG_PIXDEPTH, XTIF_TAG_TYPE_SHORT, page._pixel_byte * 8);
+          AddEntry(entries, XTIF_TAG_COMPRESS, XTIF_TAG_TYPE_SHORT, 1);
+          AddEntry(entries, XTIF_TAG_PHOTO_INTERPRE, XTIF_TAG_TYPE_SHORT, 1);
+          AddEntry(entries, XTIF_TAG_STRIP_OFFSET, long_type, offsets);
+          AddEntry(entries, XTIF_TAG_ORIENTATION, XTIF_TAG_TYPE_SHORT, 1);
+          AddEntry(entries, XTIF_TAG_SAMPLES_PIXEL, XTIF_TAG_TYPE_SHORT, 1);
+          AddEntry(entries, XTIF_TAG_ROWS_STRIP, XTIF_TAG_TYPE_LONG, page._rows_strip);
+          AddEntry(entries, XTIF_TAG_STRIP_COUNT, long_type, counts);
+          AddAscii(entries, XTIF_TAG_DATE_TIME, page._date_time);
+          if(!_serial.empty())
+               AddAscii(entries, XTIF_TAG_GCU_SN, _serial.c_str());
+          AddEntry(entries, XTIF_TAG_GCU_INT_TIME, XTIF_TAG_TYPE_LONG, page._int_time);
+
+          uint32_t count_size = _is_big ? 8 : 2;
+          uint32_t entry_size = _is_big ? 20 : 12;
+          uint32_t inline_size = _is_big ? 8 : 4;
+          uint64_t ifd_size = count_size + entries.size() * entry_size + inline_size;
+          ifd.assign((size_t)ifd_size, 0);
+          std::vector<uint8_t> extra;
+          PutLE(&ifd[0], entries.size(), count_size);
+          uint8_t* entry_ = &ifd[count_size];
+          for(size_t i = 0; i < entries.size(); i++, entry_ += entry_size)
+          {
+               const XTifEntry& entry = entries[i];
+               PutLE(entry_, entry._id, 2);
+               PutLE(entry_ + 2, entry._type, 2);
+               PutLE(entry_ + 4, entry._count, _is_big ? 8 : 4);
+               uint8_t* value_ = entry_ + (_is_big ? 12 : 8);
+               if(entry._data.size() <= inline_size)
+                    memcpy(value_, &entry._data[0], entry._data.size());
+               else
+               {
+                    //Values that do not fit follow the IFD, word aligned
+                    PutLE(value_, ifd_pos + ifd_size + extra.size(), inline_size);
+                    extra.insert(extra.end(), entry._data.begin(), entry._data.end());
+                    if(extra.size() & 1)
+                         extra.push_back(0);
+               }
+          }
+          ifd.insert(ifd.end(), extra.begin(), extra.end());
+          return count_size + entries.size() * entry_size;
+     }
+     /*
+       Append the IFD of page at the end of the file and link it from the
+       previous IFD (or the header).
+      */
+     bool WriteIfd(const XTifPage& page)
+     {
+          uint32_t inline_size = _is_big ? 8 : 4;
+          uint64_t ifd_pos = (_end + 1) & ~1ull;        //IFDs start on a word
+          std::vector<uint8_t> ifd;
+          uint64_t next_pos = BuildIfd(page, ifd_pos, ifd);
+          uint8_t link[8];
+          PutLE(link, ifd_pos, inline_size);
+          if(!XFileSeek(_file_, _end)
+             || (ifd_pos != _end && fputc(0, _file_) == EOF)
+             || fwrite(&ifd[0], 1, ifd.size(), _file_) != ifd.size()
+             || fflush(_file_) != 0
+             //Link only once the IFD is complete
+             || !XFileSeek(_file_, _next_pos)
+             || fwrite(link, inline_size, 1, _file_) != 1
+             || fflush(_file_) != 0)
+               return 0;
+          _next_pos = ifd_pos + next_pos;
+          _end = ifd_pos + ifd.size();
+          return XFileSeek(_file_, _end);
+     }
+     /*
+       Write the pages so far again with BigTIFF IFDs, then the header.
+      */
+     bool SwitchToBig()
+     {
+          _is_big = 1;
+          //The BigTIFF first IFD offset is at 8, in the spare bytes
+          _next_pos = 8;
+          for(size_t i = 0; i < _pages.size(); i++)
+               if(!WriteIfd(_pages[i]))
+                    return 0;
+          _pages.clear();
+          uint8_t header[8];
+          PutLE(header, XTIF_BYTE_ORDER_LITTLE, 2);
+          PutLE(header + 2, XTIF_BIG_FLAG, 2);
+          PutLE(header + 4, 8, 2);                //Offset size
+          PutLE(header + 6, 0, 2);
+          return XFileSeek(_file_, 0) && fwrite(header, sizeof(header), 1, _file_) == 1
+               && fflush(_file_) == 0 && XFileSeek(_file_, _end);
+     }
+
+     FILE*    _file_;
+     uint64_t _big_limit;
+     bool     _is_big;
+     uint64_t _end;
+     uint64_t _next_pos;      //Where the offset of the next IFD goes
+     uint32_t _page_num;
+     uint32_t _rows_written;
+     uint32_t _int_time;
+     std::string _serial;
+     XTifPage _page;          //Page being written
+     std::vector<XTifPage> _pages;  //Classic pages, kept for SwitchToBig()
+};
+#endif //XTIF_STREAM_H
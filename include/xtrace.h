@@ -0,0 +1,462 @@
+/*
+  Copyright (c), Detection Technology Inc.
+  All right reserved.
+
+ */
+
+#ifndef XTRACE_H
+#define XTRACE_H
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define XTRACE_X86 1
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#endif
+
+//Trace points of the acquisition path
+#define XTRACE_RECV         0   //Packets received by one syscall, arg packet number
+#define XTRACE_HEADER       1   //Frame header parsed, arg FRAME_ID
+#define XTRACE_LAST_LINE    2   //Last line of the frame placed, arg FRAME_ID
+#define XTRACE_FRAME_READY  3   //Frame handed to the transfer thread, arg frame buffer
+#define XTRACE_SINK         4   //Span of OnFrameReady(), arg frame buffer
+#define XTRACE_ID_NUM       5
+
+#define XTRACE_EVENT_NUM    (1 << 16)   //Default events kept per thread, power of 2
+#define XTRACE_THREAD_NUM   32          //Max traced threads
+#define XTRACE_NAME_SIZE    32
+
+inline const char* XTraceName(uint32_t id)
+{
+     switch(id)
+     {
+     case XTRACE_RECV:        return "recv";
+     case XTRACE_HEADER:      return "header";
+     case XTRACE_LAST_LINE:   return "last line";
+     case XTRACE_FRAME_READY: return "frame ready";
+     case XTRACE_SINK:        return "sink";
+     }
+     return "unknown";
+}
+inline const char* XTraceArgName(uint32_t id)
+{
+     switch(id)
+     {
+     case XTRACE_RECV:        return "packets";
+     case XTRACE_HEADER:
+     case XTRACE_LAST_LINE:   return "frame_id";
+     }
+     return "buffer";
+}
+
+/*
+  Raw timestamp: the TSC on x86, steady_clock nanoseconds elsewhere.
+  XTraceRecorder converts it to time with a ratio measured over the session,
+  which needs an invariant TSC, as on every x86 CPU of the last decade.
+ */
+inline uint64_t XTraceTick()
+{
+#ifdef XTRACE_X86
+     return __rdtsc();
+#else
+     return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+inline uint64_t XTraceClockNs()
+{
+     return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*
+  The runtime switch. Constant initialized, so testing it is one relaxed
+  load and a branch, which is all a trace point costs while tracing is off.
+ */
+inline std::atomic<bool>& XTraceSwitch()
+{
+     static std::atomic<bool> is_on(false);
+     return is_on;
+}
+inline bool XTraceIsOn()
+{
+     return XTraceSwitch().load(std::memory_order_relaxed);
+}
+
+/*
+  One event. _dur is 0 for an instant event.
+ */
+struct XTraceEvent
+{
+     uint64_t _tick;
+     uint64_t _dur;
+     uint32_t _arg;
+     uint32_t _id;
+};
+
+/*
+  Event ring of one thread. Only the owner thread writes, it publishes each
+  event by a release store of _count, so no lock or atomic read-modify-write
+  is on the trace path. When the ring is full the oldest events are
+  overwritten. _is_free is set when the owner thread exits.
+ */
+struct XTraceBuffer
+{
+     XTraceEvent* _events_;
+     uint32_t _mask;
+     uint32_t _tid;
+     std::atomic<uint64_t> _count;
+     std::atomic<bool> _is_free;
+     char _name[XTRACE_NAME_SIZE];
+
+     void Put(uint32_t id, uint32_t arg, uint64_t tick, uint64_t dur)
+     {
+          uint64_t n = _count.load(std::memory_order_relaxed);
+          XTraceEvent& event = _events_[n & _mask];
+          event._tick = tick;
+          event._dur = dur;
+          event._arg = arg;
+          event._id = id;
+          _count.store(n + 1, std::memory_order_release);
+     }
+};
+
+/*
+  XTraceRecorder collects the trace points of all threads and writes them as
+  Chrome trace_event JSON, which chrome://tracing and ui.perfetto.dev open.
+  Each thread gets its own XTraceBuffer at its first event while tracing is
+  on, a thread names its track with SetThreadName() at any time. A named
+  thread takes over the buffer of an exited thread of the same name, so the
+  engine threads of successive acquisitions share one track.
+  Start(), Clear() and WriteJson() are meant for a stopped recorder, events
+  written during them may be lost or half written.
+  Use the process wide recorder of XTraceRecorder::Get() and the XTrace*()
+  helpers below.
+ */
+class XTraceRecorder
+{
+public:
+     XTraceRecorder()
+          :_event_num(XTRACE_EVENT_NUM)
+          ,_start_tick(0)
+          ,_start_ns(0)
+          ,_stop_tick(0)
+          ,_stop_ns(0)
+     {
+          _buffer_num.store(0);
+          _lost_threads.store(0);
+          memset(_buffers_, 0, sizeof(_buffers_));
+     }
+     ~XTraceRecorder()
+     {
+          XTraceSwitch().store(false);
+          for(uint32_t i = 0; i < XTRACE_THREAD_NUM; i++)
+          {
+               if(_buffers_[i])
+               {
+                    delete [] _buffers_[i]->_events_;
+                    delete _buffers_[i];
+               }
+          }
+     }
+
+     static XTraceRecorder& Get()
+     {
+          static XTraceRecorder recorder;
+          return recorder;
+     }
+
+     /*
+       Drop the events of the last session and start tracing. event_num is
+       rounded up to a power of 2 and applies to the buffers created from
+       now on.
+      */
+     bool Start(uint32_t event_num = XTRACE_EVENT_NUM)
+     {
+          if(XTraceIsOn())
+               return 0;
+          uint32_t num = 1;
+          while(num < event_num && num < (1u << 30))
+               num <<= 1;
+          {
+               std::lock_guard<std::mutex> lock(_mutex);
+               _event_num = num;
+          }
+          Clear();
+          _start_ns = XTraceClockNs();
+          _start_tick = XTraceTick();
+          _stop_tick = 0;
+          _stop_ns = 0;
+          XTraceSwitch().store(true);
+          return 1;
+     }
+     /*
+       Stop tracing and fix the tick to time ratio of the session.
+      */
+     void Stop()
+     {
+          if(!XTraceIsOn())
+               return;
+          XTraceSwitch().store(false);
+          _stop_tick = XTraceTick();
+          _stop_ns = XTraceClockNs();
+     }
+     void Clear()
+     {
+          uint32_t num = std::min(_buffer_num.load(), (uint32_t)XTRACE_THREAD_NUM);
+          for(uint32_t i = 0; i < num; i++)
+               _buffers_[i]->_count.store(0);
+          _lost_threads.store(0);
+     }
+
+     /*
+       Instant event at now.
+      */
+     void Instant(uint32_t id, uint32_t arg)
+     {
+          XTraceBuffer* buffer_ = GetBuffer();
+          if(buffer_)
+               buffer_->Put(id, arg, XTraceTick(), 0);
+     }
+     /*
+       Span event from start_tick, taken with XTraceTick(), to now.
+      */
+     void Span(uint32_t id, uint32_t arg, uint64_t start_tick)
+     {
+          XTraceBuffer* buffer_ = GetBuffer();
+          if(buffer_)
+          {
+               uint64_t tick = XTraceTick();
+               buffer_->Put(id, arg, start_tick, (tick > start_tick) ? tick - start_tick : 0);
+          }
+     }
+     /*
+       Name the track of the calling thread, e.g. "engine" or "parse".
+      */
+     void SetThreadName(const char* name_)
+     {
+          ThreadSlot& slot = GetSlot();
+          strncpy(slot._name, name_, XTRACE_NAME_SIZE - 1);
+          slot._name[XTRACE_NAME_SIZE - 1] = 0;
+          if(slot._buffer_)
+               memcpy(slot._buffer_->_name, slot._name, XTRACE_NAME_SIZE);
+     }
+
+     /*
+       Events kept, and events overwritten because a ring was full.
+      */
+     uint64_t GetEventNum()
+     {
+          uint64_t total = 0;
+          uint32_t num = std::min(_buffer_num.load(), (uint32_t)XTRACE_THREAD_NUM);
+          for(uint32_t i = 0; i < num; i++)
+               total += std::min(_buffers_[i]->_count.load(), (uint64_t)_buffers_[i]->_mask + 1);
+          return total;
+     }
+     uint64_t GetOverwriteNum()
+     {
+          uint64_t total = 0;
+          uint32_t num = std::min(_buffer_num.load(), (uint32_t)XTRACE_THREAD_NUM);
+          for(uint32_t i = 0; i < num; i++)
+          {
+               uint64_t count = _buffers_[i]->_count.load();
+               if(count > (uint64_t)_buffers_[i]->_mask + 1)
+                    total += count - _buffers_[i]->_mask - 1;
+          }
+          return total;
+     }
+     /*
+       Threads which traced nothing because all XTRACE_THREAD_NUM buffers
+       were taken.
+      */
+     uint32_t GetLostThreads()
+     {
+          return _lost_threads.load();
+     }
+
+     /*
+       Write the session as {"traceEvents": [...]}, in microseconds from
+       Start(). Spans are complete events ("X"), the rest instant events
+       ("i"), and every thread gets a thread_name metadata event.
+      */
+     bool WriteJson(const char* file_name_)
+     {
+          FILE* out_ = fopen(file_name_, "w");
+          if(!out_)
+               return 0;
+          uint64_t stop_tick = _stop_tick;
+          uint64_t stop_ns = _stop_ns;
+          if(XTraceIsOn() || 0 == stop_tick)
+          {
+               stop_tick = XTraceTick();
+               stop_ns = XTraceClockNs();
+          }
+          double us_per_tick = 0;
+          if(stop_tick > _start_tick)
+               us_per_tick = (double)(stop_ns - _start_ns) / (stop_tick - _start_tick) / 1000.0;
+
+          fprintf(out_, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+          fprintf(out_, "  {\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 0, "
+                  "\"args\": {\"name\": \"X-LIB\"}}");
+          uint32_t num = std::min(_buffer_num.load(), (uint32_t)XTRACE_THREAD_NUM);
+          for(uint32_t i = 0; i < num; i++)
+          {
+               const XTraceBuffer* buffer_ = _buffers_[i];
+               fprintf(out_, ",\n  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, "
+                       "\"args\": {\"name\": \"%s\"}}", buffer_->_tid, buffer_->_name);
+               uint64_t count = buffer_->_count.load(std::memory_order_acquire);
+               uint64_t first = (count > (uint64_t)buffer_->_mask + 1) ? count - buffer_->_mask - 1 : 0;
+               for(uint64_t n = first; n < count; n++)
+               {
+                    const XTraceEvent& event = buffer_->_events_[n & buffer_->_mask];
+                    if(event._tick < _start_tick || event._id >= XTRACE_ID_NUM)
+                         continue;
+                    double ts = (event._tick - _start_tick) * us_per_tick;
+                    if(event._dur)
+                         fprintf(out_, ",\n  {\"name\": \"%s\", \"cat\": \"xlib\", \"ph\": \"X\", "
+                                 "\"ts\": %.3f, \"dur\": %.3f, \"pid\": 1, \"tid\": %u, "
+                                 "\"args\": {\"%s\": %u}}", XTraceName(event._id), ts,
+                                 event._dur * us_per_tick, buffer_->_tid,
+                                 XTraceArgName(event._id), event._arg);
+                    else
+                         fprintf(out_, ",\n  {\"name\": \"%s\", \"cat\": \"xlib\", \"ph\": \"i\", "
+                                 "\"s\": \"t\", \"ts\": %.3f, \"pid\": 1, \"tid\": %u, "
+                                 "\"args\": {\"%s\": %u}}", XTraceName(event._id), ts,
+                                 buffer_->_tid, XTraceArgName(event._id), event._arg);
+               }
+          }
+          fprintf(out_, "\n]}\n");
+          return 0 == fclose(out_);
+     }
+
+private:
+     XTraceRecorder(const XTraceRecorder&);
+     XTraceRecorder& operator = (const XTraceRecorder&);
+
+     struct ThreadSlot
+     {
+          ThreadSlot()
+               :_buffer_(NULL)
+               ,_is_lost(0)
+          {
+               memset(_name, 0, sizeof(_name));
+          }
+          ~ThreadSlot()
+          {
+               if(_buffer_)
+                    _buffer_->_is_free.store(true);
+          }
+
+          XTraceBuffer* _buffer_;
+          bool _is_lost;
+          char _name[XTRACE_NAME_SIZE];
+     };
+     static ThreadSlot& GetSlot()
+     {
+          static thread_local ThreadSlot slot;
+          return slot;
+     }
+     /*
+       Buffer of the calling thread, taken at its first event. Buffers
+       live as long as the recorder, so the thread local pointer never
+       dangles while the recorder exists.
+      */
+     XTraceBuffer* GetBuffer()
+     {
+          ThreadSlot& slot = GetSlot();
+          if(slot._buffer_ || slot._is_lost)
+               return slot._buffer_;
+
+          std::lock_guard<std::mutex> lock(_mutex);
+          uint32_t index = _buffer_num.load();
+          for(uint32_t i = 0; slot._name[0] && i < index; i++)
+          {
+               if(_buffers_[i]->_is_free.load() && 0 == strcmp(_buffers_[i]->_name, slot._name))
+               {
+                    _buffers_[i]->_is_free.store(false);
+                    slot._buffer_ = _buffers_[i];
+                    return slot._buffer_;
+               }
+          }
+          if(index >= XTRACE_THREAD_NUM)
+          {
+               slot._is_lost = 1;
+               _lost_threads.fetch_add(1);
+               return NULL;
+          }
+          XTraceBuffer* buffer_ = new XTraceBuffer;
+          buffer_->_events_ = new XTraceEvent[_event_num];
+          buffer_->_mask = _event_num - 1;
+          buffer_->_tid = index + 1;
+          buffer_->_count.store(0);
+          buffer_->_is_free.store(false);
+          if(slot._name[0])
+               memcpy(buffer_->_name, slot._name, XTRACE_NAME_SIZE);
+          else
+               snprintf(buffer_->_name, XTRACE_NAME_SIZE, "thread %u", index + 1);
+          _buffers_[index] = buffer_;
+          _buffer_num.store(index + 1);
+          slot._buffer_ = buffer_;
+          return buffer_;
+     }
+
+     std::mutex _mutex;                  //Guards buffer creation
+     uint32_t _event_num;
+     XTraceBuffer* _buffers_[XTRACE_THREAD_NUM];
+     std::atomic<uint32_t> _buffer_num;
+     std::atomic<uint32_t> _lost_threads;
+     uint64_t _start_tick;
+     uint64_t _start_ns;
+     uint64_t _stop_tick;
+     uint64_t _stop_ns;
+};
+
+/*
+  Trace points. Each is a switch test and nothing else while tracing is off.
+ */
+inline void XTraceInstant(uint32_t id, uint32_t arg)
+{
+     if(XTraceIsOn())
+          XTraceRecorder::Get().Instant(id, arg);
+}
+inline void XTraceSetThreadName(const char* name_)
+{
+     XTraceRecorder::Get().SetThreadName(name_);
+}
+
+/*
+  Span of a scope, e.g. of a sink callback. The span is only recorded when
+  tracing was on at its start.
+ */
+class XTraceScope
+{
+public:
+     XTraceScope(uint32_t id, uint32_t arg)
+          :_id(id)
+          ,_arg(arg)
+          ,_start_tick(XTraceIsOn() ? XTraceTick() : 0)
+     {}
+     ~XTraceScope()
+     {
+          if(_start_tick && XTraceIsOn())
+               XTraceRecorder::Get().Span(_id, _arg, _start_tick);
+     }
+
+private:
+     XTraceScope(const XTraceScope&);
+     XTraceScope& operator = (const XTraceScope&);
+
+     uint32_t _id;
+     uint32_t _arg;
+     uint64_t _start_tick;
+};
+#endif //XTRACE_H
@@ -43,6 +43,10 @@ class XUDPSocket
   int32_t IsDataAvailable(int32_t millisecond);
   int32_t Send(const unsigned char* send_buf_, int32_t buf_len);
   int32_t Recv(unsigned char* recv_buf_, int32_t buf_len);
+  /*
+    Native descriptor, used by XUDPMmsgRecv to receive packets in batches.
+  */
+  int32_t GetHandle() { return _socket; }
   
  private:
   XUDPSocket(const XUDPSocket&);
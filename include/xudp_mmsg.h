@@ -0,0 +1,205 @@
+/*
+  Copyright (c), Detection Technology Inc.
+  All rights reserved.
+
+  This is the batched image packet receiver for Linux.
+
+ */
+
+#ifndef XUDP_MMSG_H
+#define XUDP_MMSG_H
+#ifdef __linux__
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include "xpacket_pool.h"
+#include "xtrace.h"
+
+//Receive mode, chosen when the image socket is opened
+#define XUDP_RECV_SINGLE  0   //One recv() per packet
+#define XUDP_RECV_BATCH   1   //One recvmmsg() for up to XUDP_MMSG_BATCH packets
+
+#define XUDP_MMSG_BATCH   64  //Max packets returned by one syscall
+
+/*
+  Receive statistics. _hist[n] counts the syscalls which returned n packets,
+  _hist[0] counts the calls which found the socket empty.
+ */
+struct XRecvStats
+{
+     uint64_t _syscalls;
+     uint64_t _packets;
+     uint64_t _hist[XUDP_MMSG_BATCH + 1];
+     uint32_t _last_batch;
+};
+
+/*
+  XUDPMmsgRecv fills XPacket buffers taken from XPacketPool straight from the
+  socket. In batch mode one recvmmsg() call fills as many packets as the
+  kernel has queued, so under load the grab thread makes one syscall for a
+  whole batch instead of one select() and one recv() per 9 KB packet.
+  The socket is only borrowed, XUDPSocket still owns it.
+ */
+class XUDPMmsgRecv
+{
+public:
+     XUDPMmsgRecv()
+          :_socket(-1)
+          ,_mode(XUDP_RECV_SINGLE)
+          ,_batch(1)
+     {
+          ResetStats();
+     }
+     ~XUDPMmsgRecv()
+     {}
+
+     bool Open(XUDPSocket* sock_, uint32_t mode = XUDP_RECV_BATCH,
+               uint32_t batch = XUDP_MMSG_BATCH)
+     {
+          if(!sock_ || INVALID_SOCKET == sock_->GetHandle())
+               return 0;
+          return Open(sock_->GetHandle(), mode, batch);
+     }
+     bool Open(int32_t socket, uint32_t mode = XUDP_RECV_BATCH,
+               uint32_t batch = XUDP_MMSG_BATCH)
+     {
+          if(socket < 0)
+               return 0;
+          _socket = socket;
+          _mode = mode;
+          if(XUDP_RECV_SINGLE == _mode || 0 == batch)
+               batch = 1;
+          if(batch > XUDP_MMSG_BATCH)
+               batch = XUDP_MMSG_BATCH;
+          _batch = batch;
+          memset(_msgs, 0, sizeof(_msgs));
+          for(uint32_t i = 0; i < XUDP_MMSG_BATCH; i++)
+          {
+               _msgs[i].msg_hdr.msg_iov = &_iovs[i];
+               _msgs[i].msg_hdr.msg_iovlen = 1;
+          }
+          ResetStats();
+          return 1;
+     }
+     void Close()
+     {
+          _socket = -1;
+     }
+     bool IsOpen()
+     {
+          return _socket >= 0;
+     }
+     uint32_t GetMode()
+     {
+          return _mode;
+     }
+     uint32_t GetBatch()
+     {
+          return _batch;
+     }
+     /*
+       Receive up to count packets into packets_[0..count). Each packet's
+       size is set to the datagram length. Wait at most millisecond when the
+       socket is empty. Return the number of packets filled, 0 on timeout and
+       SOCKET_ERROR on socket error.
+      */
+     int32_t Recv(XPacket** packets_, uint32_t count, int32_t millisecond)
+     {
+          if(_socket < 0 || !packets_ || 0 == count)
+               return SOCKET_ERROR;
+          if(count > _batch)
+               count = _batch;
+
+          int32_t num = RecvOnce(packets_, count);
+          if(0 == num)
+          {
+               struct pollfd pfd;
+               pfd.fd = _socket;
+               pfd.events = POLLIN;
+               pfd.revents = 0;
+               int32_t ret = poll(&pfd, 1, millisecond);
+               if(ret < 0)
+                    return (EINTR == errno) ? 0 : SOCKET_ERROR;
+               if(0 == ret)
+                    return 0;
+               num = RecvOnce(packets_, count);
+          }
+          return num;
+     }
+     void GetStats(XRecvStats& stats)
+     {
+          stats = _stats;
+     }
+     void ResetStats()
+     {
+          memset(&_stats, 0, sizeof(_stats));
+     }
+     /*
+       Average packets returned per syscall, 0 if nothing received yet.
+      */
+     double GetAvgBatch()
+     {
+          if(0 == _stats._syscalls)
+               return 0;
+          return (double)_stats._packets / _stats._syscalls;
+     }
+
+private:
+     XUDPMmsgRecv(const XUDPMmsgRecv&);
+     XUDPMmsgRecv& operator = (const XUDPMmsgRecv&);
+
+     /*
+       One non-blocking syscall. Return 0 when nothing is queued.
+      */
+     int32_t RecvOnce(XPacket** packets_, uint32_t count)
+     {
+          int32_t num = 0;
+          if(1 == count)
+          {
+               ssize_t len = recv(_socket, packets_[0]->data_, XPAC_SIZE,
+                                  MSG_DONTWAIT);
+               if(len >= 0)
+               {
+                    packets_[0]->size = (int32_t)len;
+                    num = 1;
+               }
+               else
+                    num = -1;
+          }
+          else
+          {
+               for(uint32_t i = 0; i < count; i++)
+               {
+                    _iovs[i].iov_base = packets_[i]->data_;
+                    _iovs[i].iov_len = XPAC_SIZE;
+               }
+               num = recvmmsg(_socket, _msgs, count, MSG_DONTWAIT, NULL);
+               for(int32_t i = 0; i < num; i++)
+                    packets_[i]->size = (int32_t)_msgs[i].msg_len;
+          }
+          if(num < 0)
+          {
+               if(EAGAIN == errno || EWOULDBLOCK == errno || EINTR == errno)
+                    num = 0;
+               else
+                    return SOCKET_ERROR;
+          }
+          _stats._syscalls++;
+          _stats._packets += num;
+          _stats._hist[num]++;
+          _stats._last_batch = num;
+          if(num)
+               XTraceInstant(XTRACE_RECV, (uint32_t)num);
+          return num;
+     }
+
+     int32_t _socket;
+     uint32_t _mode;
+     uint32_t _batch;
+     struct mmsghdr _msgs[XUDP_MMSG_BATCH];
+     struct iovec _iovs[XUDP_MMSG_BATCH];
+     XRecvStats _stats;
+};
+#endif //__linux__
+#endif //XUDP_MMSG_H
@@ -0,0 +1,217 @@
+/*
+  Copyright (c), Detection Technology Inc.
+  All right reserved.
+
+ */
+
+#ifndef XWORKER_POOL_H
+#define XWORKER_POOL_H
+#include "xconfigure.h"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#define XWORKER_MAX_CPU 64
+
+/*
+  Task function of XWorkerPool::Run(), called once per task index.
+ */
+typedef void (*XTaskFunc)(void* arg_, uint32_t task);
+
+/*
+  Persistent worker threads for data parallel loops. Run() hands out the
+  task indices of one job to the workers and to the calling thread and
+  returns when all of them are done, so the threads are created once and
+  not per frame.
+  With an affinity mask, the workers are pinned round robin to the CPUs set
+  in the mask, the same way XAcquisition::Open() spreads its threads. The
+  mask is 64 bits wide, bit n is CPU n; on Windows that is CPU n of the
+  processor group of the process.
+ */
+class XWorkerPool
+{
+public:
+     XWorkerPool()
+          :_func_(NULL)
+          ,_arg_(NULL)
+          ,_task_num(0)
+          ,_generation(0)
+          ,_busy_num(0)
+          ,_is_stop(0)
+          ,_affinity_mask(0)
+     {
+          _next_task.store(0);
+          _done_task.store(0);
+     }
+     ~XWorkerPool()
+     {
+          Close();
+     }
+
+     /*
+       Start thread_num - 1 workers, the caller of Run() is the last one.
+       0 uses one thread per hardware thread.
+      */
+     bool Open(uint32_t thread_num = 0, uint64_t affinity_mask = 0)
+     {
+          Close();
+          if(0 == thread_num)
+               thread_num = std::thread::hardware_concurrency();
+          if(0 == thread_num)
+               thread_num = 1;
+          _affinity_mask = affinity_mask;
+          GetAffinityList(&_cpu_list, affinity_mask);
+          _is_stop = 0;
+          for(uint32_t i = 0; i + 1 < thread_num; i++)
+          {
+               _threads.push_back(std::thread(&XWorkerPool::WorkerProc, this));
+               if(!_cpu_list.empty())
+                    SetAffinity(_threads.back(), _cpu_list[i % _cpu_list.size()]);
+          }
+          return 1;
+     }
+     void Close()
+     {
+          {
+               std::lock_guard<std::mutex> lock(_mutex);
+               _is_stop = 1;
+          }
+          _start_cond.notify_all();
+          for(size_t i = 0; i < _threads.size(); i++)
+               _threads[i].join();
+          _threads.clear();
+     }
+     /*
+       Threads taking part in Run(), the caller included.
+      */
+     uint32_t GetThreadNum()
+     {
+          return (uint32_t)_threads.size() + 1;
+     }
+     uint64_t GetAffinityMask()
+     {
+          return _affinity_mask;
+     }
+     /*
+       Call func_(arg_, task) for task in [0, task_num) and wait for all of
+       them. Only one Run() at a time.
+      */
+     void Run(XTaskFunc func_, void* arg_, uint32_t task_num)
+     {
+          if(0 == task_num)
+               return;
+          std::lock_guard<std::mutex> run_lock(_run_mutex);
+          if(_threads.empty() || 1 == task_num)
+          {
+               for(uint32_t i = 0; i < task_num; i++)
+                    func_(arg_, i);
+               return;
+          }
+          {
+               //A worker which woke up late for the last job may still be
+               //leaving DoTasks()
+               std::unique_lock<std::mutex> lock(_mutex);
+               while(_busy_num)
+                    _done_cond.wait(lock);
+               _func_ = func_;
+               _arg_ = arg_;
+               _task_num = task_num;
+               _next_task.store(0);
+               _done_task.store(0);
+               _generation++;
+          }
+          _start_cond.notify_all();
+          DoTasks();
+          std::unique_lock<std::mutex> lock(_mutex);
+          while(_done_task.load() < _task_num)
+               _done_cond.wait(lock);
+          _func_ = NULL;
+     }
+     /*
+       CPU indices set in affinity_mask.
+      */
+     static void GetAffinityList(std::vector<uint32_t>* list_, uint64_t affinity_mask)
+     {
+          list_->clear();
+          for(uint32_t i = 0; i < XWORKER_MAX_CPU; i++)
+               if(affinity_mask & ((uint64_t)1 << i))
+                    list_->push_back(i);
+     }
+
+private:
+     XWorkerPool(const XWorkerPool&);
+     XWorkerPool& operator = (const XWorkerPool&);
+
+     void WorkerProc()
+     {
+          uint64_t generation = 0;
+          while(1)
+          {
+               {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    while(!_is_stop && generation == _generation)
+                         _start_cond.wait(lock);
+                    if(_is_stop)
+                         return;
+                    generation = _generation;
+                    _busy_num++;
+               }
+               DoTasks();
+               std::lock_guard<std::mutex> lock(_mutex);
+               if(0 == --_busy_num)
+                    _done_cond.notify_all();
+          }
+     }
+     void DoTasks()
+     {
+          uint32_t task;
+          while((task = _next_task.fetch_add(1)) < _task_num)
+          {
+               _func_(_arg_, task);
+               if(_done_task.fetch_add(1) + 1 == _task_num)
+               {
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    _done_cond.notify_all();
+               }
+          }
+     }
+     static void SetAffinity(std::thread& thread, uint32_t cpu)
+     {
+#ifdef _MSC_VER
+          //A 32 bit process only sees the first 32 CPUs
+          if(cpu < sizeof(DWORD_PTR) * 8)
+               SetThreadAffinityMask(thread.native_handle(), (DWORD_PTR)1 << cpu);
+#elif defined(__linux__)
+          cpu_set_t cpu_set;
+          CPU_ZERO(&cpu_set);
+          CPU_SET(cpu, &cpu_set);
+          pthread_setaffinity_np(thread.native_handle(), sizeof(cpu_set), &cpu_set);
+#else
+          (void)thread;
+          (void)cpu;
+#endif
+     }
+
+     std::vector<std::thread> _threads;
+     std::vector<uint32_t> _cpu_list;
+     std::mutex _mutex;
+     std::mutex _run_mutex;
+     std::condition_variable _start_cond;
+     std::condition_variable _done_cond;
+     XTaskFunc _func_;
+     void*     _arg_;
+     uint32_t  _task_num;
+     uint64_t  _generation;
+     uint32_t  _busy_num;     //Workers inside DoTasks()
+     bool      _is_stop;
+     uint64_t  _affinity_mask;
+     std::atomic<uint32_t> _next_task;
+     std::atomic<uint32_t> _done_task;
+};
+#endif //XWORKER_POOL_H